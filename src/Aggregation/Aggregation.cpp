@@ -0,0 +1,103 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Aggregation.h"
+
+AggregationType aggregationFromString(const std::string & name) {
+  if (name == "min") {return AGGMIN;}
+  if (name == "mean") {return AGGMEAN;}
+  if (name == "boltzmann") {return AGGBOLTZMANN;}
+  throw AggregationException("Unknown receptor aggregation \"" + name
+                             + "\", use min, mean or boltzmann");
+}
+
+float aggregate(const std::vector<float> & affinities, AggregationType type,
+                float kT, const std::vector<float> & weights) {
+  bool weighted = weights.size() == affinities.size();
+  std::vector<float> values, w;
+  for (unsigned int i = 0; i < affinities.size(); i++) {
+    if (std::isnan(affinities[i])) {continue;}
+    values.push_back(affinities[i]);
+    w.push_back(weighted ? weights[i] : 1.0f);
+  }
+  if (values.empty()) {return std::numeric_limits<float>::quiet_NaN();}
+  float min = std::numeric_limits<float>::infinity();
+  double sum = 0.0, wsum = 0.0;
+  for (unsigned int i = 0; i < values.size(); i++) {
+    min = (values[i] < min) ? values[i] : min;
+    sum += w[i] * values[i];
+    wsum += w[i];
+  }
+  switch (type) {
+    case AGGMIN:
+      return min;
+    case AGGMEAN:
+      return sum / wsum;
+    case AGGBOLTZMANN: {
+      if (std::isinf(min)) {return min;}
+      // Shifted by the minimum for numerical stability
+      double z = 0.0;
+      for (unsigned int i = 0; i < values.size(); i++) {
+        z += w[i] * std::exp(-(values[i] - min) / kT);
+      }
+      return min - kT * std::log(z / wsum);
+    }
+  }
+  return min;
+}
+
+std::vector<float> optimisticAffinities(const std::vector<float> & affinities,
+                                        const DockingBound & bound) {
+  std::vector<float> optimistic = affinities;
+  for (unsigned int i = 0; i < optimistic.size(); i++) {
+    if (!std::isnan(optimistic[i])) {continue;}
+    if (i < bound.floors.size() && !std::isnan(bound.floors[i])) {
+      optimistic[i] = bound.floors[i];
+    } else {
+      optimistic[i] = - std::numeric_limits<float>::infinity();
+    }
+  }
+  return optimistic;
+}
+
+bool cannotMakeCut(const std::vector<float> & affinities,
+                   const DockingBound & bound,
+                   AggregationType type, float kT) {
+  if (std::isinf(bound.bound)) {return false;}
+  return aggregate(optimisticAffinities(affinities, bound), type, kT,
+                   bound.weights) > bound.bound;
+}
+
+std::vector<std::pair<std::string, std::vector<float>>> packBound(
+                                              const DockingBound & bound) {
+  std::vector<std::pair<std::string, std::vector<float>>> packed;
+  packed.push_back(std::make_pair("bound", std::vector<float>(1,
+                                                              bound.bound)));
+  packed.push_back(std::make_pair("order",
+                                  std::vector<float>(bound.order.begin(),
+                                                     bound.order.end())));
+  packed.push_back(std::make_pair("floors", bound.floors));
+  packed.push_back(std::make_pair("weights", bound.weights));
+  packed.push_back(std::make_pair("cutoff", std::vector<float>(1,
+                                                               bound.cutoff)));
+  return packed;
+}
+
+DockingBound unpackBound(
+      const std::vector<std::pair<std::string, std::vector<float>>> & packed) {
+  DockingBound bound;
+  for (auto & p : packed) {
+    if (p.first == "bound" && !p.second.empty()) {
+      bound.bound = p.second.at(0);
+    } else if (p.first == "order") {
+      for (auto i : p.second) {
+        bound.order.push_back(static_cast<unsigned int>(i));
+      }
+    } else if (p.first == "floors") {
+      bound.floors = p.second;
+    } else if (p.first == "weights") {
+      bound.weights = p.second;
+    } else if (p.first == "cutoff" && !p.second.empty()) {
+      bound.cutoff = p.second.at(0);
+    }
+  }
+  return bound;
+}
@@ -0,0 +1,99 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Aggregation
+ *
+ * Combines the docking results of a ligand against every receptor
+ * (conformation) into one binding affinity:
+ *  - min: best affinity over all receptors
+ *  - mean: mean affinity
+ *  - boltzmann: Boltzmann-weighted soft minimum, -kT ln(mean(exp(-a/kT)))
+ *
+ * All three are monotonically increasing in every affinity. This allows a
+ * worker to stop docking a ligand once even the best affinities still
+ * possible for the remaining receptors (their floors) can not bring the
+ * aggregate below the bound required to make the elite cut.
+ *
+ * Receptors not docked (yet) are NaN.
+ *
+ * Receptors may carry weights, e.g. the share of the conformations a
+ * representative stands for (see Ensemble): mean and boltzmann are then
+ * weighted averages, min does not depend on them.
+*/
+#ifndef SRC_AGGREGATION_AGGREGATION_H_
+#define SRC_AGGREGATION_AGGREGATION_H_
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <utility>
+#include <exception>
+
+enum AggregationType {AGGMIN, AGGMEAN, AGGBOLTZMANN};
+
+class AggregationException : virtual public std::exception {
+ public:
+    AggregationException(const std::string msg1) {
+      errorMsg = "Error in Aggregation!\nMessage: " + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+/* Per-generation bound broadcast by the master:
+ *  bound:  aggregated affinity a ligand needs to make the elite cut
+ *          (infinity: no bound, dock everything)
+ *  order:  receptor indices in the order they should be docked
+ *  floors: lowest affinity expected for each receptor
+ *  weights: weight of each receptor, empty: all equal
+ *  cutoff: aggregated affinity of the elite cut, also without early abort
+ *          (infinity: unknown)
+*/
+struct DockingBound {
+  float bound = std::numeric_limits<float>::infinity();
+  float cutoff = std::numeric_limits<float>::infinity();
+  std::vector<unsigned int> order;
+  std::vector<float> floors;
+  std::vector<float> weights;
+};
+
+/* aggregationFromString(name):
+ *
+ * Returns type for "min", "mean" or "boltzmann"
+*/
+AggregationType aggregationFromString(const std::string &);
+/* aggregate(affinities, type, kT, weights):
+ *
+ * Returns aggregated affinity, ignoring NaN entries, NaN if there are none.
+ * weights has one entry per receptor or none (all equal)
+*/
+float aggregate(const std::vector<float> &, AggregationType, float,
+                const std::vector<float> & = std::vector<float>());
+/* optimisticAffinities(affinities, bound):
+ *
+ * Returns affinities with every receptor not docked (NaN) at its floor,
+ * -infinity without one: the best the ligand could still reach
+*/
+std::vector<float> optimisticAffinities(const std::vector<float> &,
+                                        const DockingBound &);
+/* cannotMakeCut(affinities, bound, type, kT):
+ *
+ * Returns true if the aggregate (weighted by bound.weights) is above
+ * bound.bound even if every receptor not docked yet reaches its floor
+*/
+bool cannotMakeCut(const std::vector<float> &, const DockingBound &,
+                   AggregationType, float);
+/* packBound(bound) / unpackBound(packed):
+ *
+ * Conversion to and from (name, values) pairs for serialization
+*/
+std::vector<std::pair<std::string, std::vector<float>>> packBound(
+                                                        const DockingBound &);
+DockingBound unpackBound(
+            const std::vector<std::pair<std::string, std::vector<float>>> &);
+
+#endif  // SRC_AGGREGATION_AGGREGATION_H_
@@ -0,0 +1,191 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Catalog.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include "../PDB/PDB.h"
+
+static const char kMagic[8] = {'F', 'D', 'G', 'A', 'C', 'A', 'T', '1'};
+
+template <typename T>
+static void writeValue(std::ofstream & out, T value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool readValue(std::ifstream & in, T & value) {
+  return static_cast<bool>(in.read(reinterpret_cast<char *>(&value),
+                                   sizeof(value)));
+}
+
+static void writeString(std::ofstream & out, const std::string & s) {
+  writeValue<uint32_t>(out, s.size());
+  out.write(s.data(), s.size());
+}
+
+static bool readString(std::ifstream & in, std::string & s) {
+  uint32_t length;
+  if (!readValue(in, length) || length > (1u << 20)) {return false;}
+  s.resize(length);
+  return length == 0 || static_cast<bool>(in.read(&s[0], length));
+}
+
+// Sequence and residue count of a PDB file, water not counted
+static void parseEntry(const std::string & file, CatalogEntry & entry) {
+  entry.sequence.clear();
+  entry.residues = 0;
+  entry.valid = false;
+  try {
+    AtomTable atoms = readPDB(file);
+    for (size_t i = 0; i < atoms.size(); i++) {
+      if (i > 0 && atoms.resSeq[i] == atoms.resSeq[i - 1]) {continue;}
+      std::string resName = atoms.resName(i);
+      if (resName != "HOH" && resName != "WAT") {entry.residues++;}
+    }
+    entry.sequence = sequence(atoms);
+  } catch (PDBException &) {
+    return;
+  }
+  entry.valid = !entry.sequence.empty()
+                && entry.sequence.size() == entry.residues;
+}
+
+void Catalog::load() {
+  std::ifstream in(indexFile, std::ios::binary);
+  char magic[8];
+  uint32_t count;
+  if (!in.read(magic, sizeof(magic))
+      || !std::equal(magic, magic + sizeof(magic), kMagic)
+      || !readValue(in, count)) {
+    return;
+  }
+  std::map<std::string, CatalogEntry> loaded;
+  for (uint32_t i = 0; i < count; i++) {
+    CatalogEntry entry;
+    uint8_t valid;
+    if (!readString(in, entry.name) || !readValue(in, entry.mtime)
+        || !readValue(in, entry.size) || !readString(in, entry.sequence)
+        || !readValue(in, entry.residues) || !readValue(in, valid)) {
+      // Truncated, everything is parsed again
+      return;
+    }
+    entry.valid = valid != 0;
+    loaded[entry.name] = entry;
+  }
+  entries = loaded;
+}
+
+void Catalog::save() {
+  // Written aside and renamed, a crash never leaves half an index
+  std::string tmp = indexFile + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(kMagic, sizeof(kMagic));
+    writeValue<uint32_t>(out, entries.size());
+    for (auto & e : entries) {
+      writeString(out, e.second.name);
+      writeValue(out, e.second.mtime);
+      writeValue(out, e.second.size);
+      writeString(out, e.second.sequence);
+      writeValue(out, e.second.residues);
+      writeValue<uint8_t>(out, e.second.valid ? 1 : 0);
+    }
+    if (!out) {
+      throw CatalogException("Could not write index " + tmp, dir);
+    }
+  }
+  if (std::rename(tmp.c_str(), indexFile.c_str()) != 0) {
+    throw CatalogException("Could not write index " + indexFile, dir);
+  }
+}
+
+unsigned int Catalog::update() {
+  DIR * d = opendir(dir.c_str());
+  if (d == NULL) {
+    throw CatalogException("Could not open directory", dir);
+  }
+  std::map<std::string, CatalogEntry> current;
+  std::vector<CatalogEntry *> changed;
+  struct dirent * ent;
+  while ((ent = readdir(d)) != NULL) {
+    std::string name = ent->d_name;
+    struct stat st;
+    if (name.empty() || name[0] == '.'
+        || stat((dir + "/" + name).c_str(), &st) != 0
+        || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    auto known = entries.find(name);
+    if (known != entries.end() && known->second.mtime == st.st_mtime
+        && known->second.size == st.st_size) {
+      current[name] = known->second;
+      continue;
+    }
+    // Map nodes stay put, the pointer is valid until current is gone
+    CatalogEntry & entry = current[name];
+    entry.name = name;
+    entry.mtime = st.st_mtime;
+    entry.size = st.st_size;
+    changed.push_back(&entry);
+  }
+  closedir(d);
+  // Files are independent, a new library parses on all cores
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (size_t i = 0; i < changed.size(); i++) {
+    parseEntry(dir + "/" + changed[i]->name, *changed[i]);
+  }
+  bool removed = false;
+  for (auto & e : entries) {
+    removed = removed || current.count(e.first) == 0;
+  }
+  entries = current;
+  if (!changed.empty() || removed) {
+    save();
+  }
+  return changed.size();
+}
+
+std::vector<CatalogEntry> Catalog::usable(unsigned int minLength,
+                                          unsigned int maxLength) const {
+  std::vector<CatalogEntry> result;
+  std::set<std::string> seen;
+  for (auto & e : entries) {
+    const CatalogEntry & entry = e.second;
+    if (!entry.valid || entry.sequence.size() < minLength
+        || (maxLength > 0 && entry.sequence.size() > maxLength)
+        || !seen.insert(entry.sequence).second) {
+      continue;
+    }
+    result.push_back(entry);
+  }
+  return result;
+}
+
+std::vector<CatalogEntry> Catalog::sample(unsigned int amount,
+                                          unsigned int minLength,
+                                          unsigned int maxLength,
+                                          const std::set<std::string> & exclude,
+                                          std::mt19937 & mt) const {
+  std::vector<CatalogEntry> candidates;
+  for (auto & entry : usable(minLength, maxLength)) {
+    if (exclude.count(entry.sequence) == 0) {candidates.push_back(entry);}
+  }
+  // Partial Fisher-Yates, the first amount candidates are the sample
+  size_t n = std::min<size_t>(amount, candidates.size());
+  for (size_t i = 0; i < n; i++) {
+    std::uniform_int_distribution<size_t> pick(i, candidates.size() - 1);
+    std::swap(candidates[i], candidates[pick(mt)]);
+  }
+  candidates.resize(n);
+  return candidates;
+}
+
+std::string Catalog::path(const CatalogEntry & entry) const {
+  return dir + "/" + entry.name;
+}
+
+size_t Catalog::size() const {
+  return entries.size();
+}
@@ -0,0 +1,113 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Catalog
+ *
+ * Persistent index of a directory of peptide PDBs (initialpdbs,
+ * randompdbs): file name, modification time and size, FASTA sequence,
+ * residue count and whether the file is usable. Only files new or changed
+ * since the last run are parsed, so the initial population is sampled
+ * without listing, shuffling and parsing the library again, and without
+ * picking duplicates or broken files that would be dropped later.
+ *
+ * Index file format (binary, little endian as written by the host):
+ *   "FDGACAT1", uint32 entries, then per entry
+ *   uint32 name length, name, int64 mtime, int64 size,
+ *   uint32 sequence length, sequence, uint32 residues, uint8 valid
+*/
+#ifndef SRC_CATALOG_CATALOG_H_
+#define SRC_CATALOG_CATALOG_H_
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <random>
+#include <cstdint>
+#include <exception>
+
+class CatalogException : virtual public std::exception {
+ public:
+    CatalogException(const std::string msg1, const std::string dir1) {
+      errorMsg = "Error in Catalog!\nDirectory: " + dir1 + "\nMessage: "
+                 + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+/* Indexed file:
+ *  name:     file name within the directory
+ *  mtime, size: of the file when it was parsed
+ *  sequence: one-letter sequence
+ *  residues: number of residues of the file, including non-standard ones
+ *            but not water
+ *  valid:    readable PDB whose residues are all standard amino acids
+*/
+struct CatalogEntry {
+  std::string name;
+  int64_t mtime = 0;
+  int64_t size = 0;
+  std::string sequence;
+  uint32_t residues = 0;
+  bool valid = false;
+};
+
+class Catalog {
+ public:
+    Catalog(const std::string & dir1, const std::string & indexFile1) {
+      dir = dir1;
+      indexFile = indexFile1;
+      load();
+    }
+
+    /* update():
+     *
+     * Parses files new or changed since the index was written, drops files
+     * removed and saves the index if anything changed. Returns number of
+     * files parsed
+    */
+    unsigned int update();
+    /* usable(minLength, maxLength):
+     *
+     * Returns valid entries with a sequence length in [minLength, maxLength]
+     * (0: no limit), one per sequence (first by file name)
+    */
+    std::vector<CatalogEntry> usable(unsigned int, unsigned int) const;
+    /* sample(amount, minLength, maxLength, exclude, mt):
+     *
+     * Returns up to amount entries drawn uniformly from the usable ones,
+     * skipping sequences in exclude
+    */
+    std::vector<CatalogEntry> sample(unsigned int, unsigned int, unsigned int,
+                                     const std::set<std::string> &,
+                                     std::mt19937 &) const;
+    /* path(entry):
+     *
+     * Returns path of the file of entry
+    */
+    std::string path(const CatalogEntry &) const;
+    /* size():
+     *
+     * Returns number of indexed files
+    */
+    size_t size() const;
+
+ private:
+    std::string dir;
+    std::string indexFile;
+    std::map<std::string, CatalogEntry> entries;
+
+    /* load() / save():
+     *
+     * Read and write the index file, a missing or unreadable index is
+     * treated as empty
+    */
+    void load();
+    void save();
+};
+
+#endif  // SRC_CATALOG_CATALOG_H_
@@ -6,11 +6,14 @@
 #ifndef SRC_COMMUNICATION_H_
 #define SRC_COMMUNICATION_H_
 
-#define SENDFILESSIZE 0
-#define SENDFILESCONT 1
-#define SENDAFFINSIZE 2
-#define SENDAFFINCONT 3
 #define SENDRECEPTORS 4
 #define SENDNMTHREADS 5
+#define SENDJOB 7
+#define SENDRESULT 8
+#define SHUTDOWN 9
+#define CANCEL 10
+#define HEARTBEAT 11
+#define PREPRECEPTORS 12
+#define PREPDONE 13
 
 #endif  // SRC_COMMUNICATION_H_
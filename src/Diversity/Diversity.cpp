@@ -0,0 +1,112 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Diversity.h"
+
+namespace {
+const char kAlphabet[] = "ARNDCQEGHILKMFPSTWYV";
+const unsigned int kAlphabetSize = 20;
+
+// Residue code: 1..20 for the alphabet, 21 for anything else, 0 is padding
+unsigned char residueCode(char c) {
+  for (unsigned int i = 0; i < kAlphabetSize; i++) {
+    if (kAlphabet[i] == c) {
+      return i + 1;
+    }
+  }
+  return kAlphabetSize + 1;
+}
+}  // namespace
+
+unsigned int Diversity::uniqueCount(const std::vector<std::string> &seqs) {
+  std::unordered_set<std::string> unique(seqs.begin(), seqs.end());
+  return unique.size();
+}
+
+std::vector<float> Diversity::positionEntropy(
+                                  const std::vector<std::string> &seqs) {
+  size_t maxLen = 0;
+  for (auto & s : seqs) {
+    maxLen = (s.size() > maxLen) ? s.size() : maxLen;
+  }
+  std::vector<float> entropy(maxLen, 0.0f);
+  for (size_t pos = 0; pos < maxLen; pos++) {
+    unsigned int counts[kAlphabetSize + 2] = {0};
+    unsigned int total = 0;
+    for (auto & s : seqs) {
+      if (pos < s.size()) {
+        counts[residueCode(s[pos])]++;
+        total++;
+      }
+    }
+    float h = 0.0f;
+    for (unsigned int i = 1; i <= kAlphabetSize + 1; i++) {
+      if (counts[i] == 0) {continue;}
+      float p = static_cast<float>(counts[i]) / total;
+      h -= p * std::log2(p);
+    }
+    entropy.at(pos) = h;
+  }
+  return entropy;
+}
+
+float Diversity::meanHamming(const std::vector<std::string> &seqs) {
+  size_t n = seqs.size();
+  if (n < 2) {return 0.0f;}
+  size_t maxLen = 0;
+  for (auto & s : seqs) {
+    maxLen = (s.size() > maxLen) ? s.size() : maxLen;
+  }
+  // Pack into rows of a multiple of 16 bytes, padding with 0 so positions
+  // past the end of both sequences compare equal
+  const size_t stride = ((maxLen + 15) / 16) * 16;
+  std::vector<unsigned char> packed(n * stride, 0);
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < seqs[i].size(); j++) {
+      packed[i * stride + j] = residueCode(seqs[i][j]);
+    }
+  }
+
+  unsigned long long mismatches = 0;  // NOLINT
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char * a = &packed[i * stride];
+    for (size_t j = i + 1; j < n; j++) {
+      const unsigned char * b = &packed[j * stride];
+      unsigned int equal = 0;
+#ifdef __SSE2__
+      for (size_t k = 0; k < stride; k += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + k));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + k));
+        equal += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+      }
+#else
+      for (size_t k = 0; k < stride; k++) {
+        equal += (a[k] == b[k]);
+      }
+#endif
+      mismatches += stride - equal;
+    }
+  }
+  return static_cast<float>(mismatches) / (n * (n - 1) / 2);
+}
+
+DiversityStats Diversity::calculate(const std::vector<std::string> &seqs) {
+  DiversityStats result;
+  result.unique = uniqueCount(seqs);
+  result.positionEntropy = positionEntropy(seqs);
+  result.meanEntropy = 0.0f;
+  for (auto h : result.positionEntropy) {
+    result.meanEntropy += h;
+  }
+  if (!result.positionEntropy.empty()) {
+    result.meanEntropy /= result.positionEntropy.size();
+  }
+  result.meanHamming = meanHamming(seqs);
+  return result;
+}
+
+void Diversity::log(unsigned int generation, const DiversityStats &result,
+                    float best) {
+  stats << generation << "\t" << result.unique << "\t"
+        << result.meanEntropy << "\t" << result.meanHamming << "\t"
+        << best << "\n";
+  stats.flush();
+}
@@ -0,0 +1,81 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Diversity
+ *
+ * Diversity metrics of a generation of peptide sequences:
+ *  - number of unique individuals (hash set, O(n))
+ *  - per-position Shannon entropy over the 20 letter amino acid alphabet
+ *  - mean pairwise Hamming distance, compared 16 residues at a time with
+ *    SSE2 on sequences packed into zero-padded byte arrays
+ *
+ * Results are appended to a stats file that is opened once and kept open,
+ * one line per generation.
+*/
+#ifndef SRC_DIVERSITY_DIVERSITY_H_
+#define SRC_DIVERSITY_DIVERSITY_H_
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_set>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct DiversityStats {
+  unsigned int unique;
+  // Entropy for each position in bits, mean over all positions
+  std::vector<float> positionEntropy;
+  float meanEntropy;
+  float meanHamming;
+};
+
+class Diversity {
+ public:
+    Diversity(const std::string statsFile1) {
+      statsFile = statsFile1;
+      stats.open(statsFile, std::ios::out | std::ios::app);
+      if (stats.tellp() == 0) {
+        stats << "generation\tunique\tentropy\thamming\tbest\n";
+      }
+    }
+
+    ~Diversity() {
+      stats.close();
+    }
+
+    /* calculate(sequences):
+     *
+     * Returns all diversity metrics for given generation
+    */
+    DiversityStats calculate(const std::vector<std::string> &);
+    /* log(generation, stats, best fitness):
+     *
+     * Appends a line to the stats file, flushed at most once per call
+    */
+    void log(unsigned int, const DiversityStats &, float);
+    /* uniqueCount(sequences):
+     *
+     * Returns number of different sequences
+    */
+    static unsigned int uniqueCount(const std::vector<std::string> &);
+    /* positionEntropy(sequences):
+     *
+     * Returns Shannon entropy (bits) of the residue distribution at each
+     * position, only counting sequences long enough to have that position
+    */
+    static std::vector<float> positionEntropy(
+                                  const std::vector<std::string> &);
+    /* meanHamming(sequences):
+     *
+     * Returns mean Hamming distance over all pairs, a difference in length
+     * counts as mismatches
+    */
+    static float meanHamming(const std::vector<std::string> &);
+
+ private:
+    std::string statsFile;
+    std::ofstream stats;
+};
+
+#endif  // SRC_DIVERSITY_DIVERSITY_H_
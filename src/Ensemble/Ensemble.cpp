@@ -0,0 +1,309 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Ensemble.h"
+#include <cmath>
+#include <cctype>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// Largest eigenvalue of a symmetric 4x4 matrix (cyclic Jacobi)
+static double largestEigenvalue(double m[4][4]) {
+  for (int sweep = 0; sweep < 50; sweep++) {
+    double off = 0.0;
+    for (int p = 0; p < 4; p++) {
+      for (int q = p + 1; q < 4; q++) {off += m[p][q] * m[p][q];}
+    }
+    if (off < 1e-18) {break;}
+    for (int p = 0; p < 4; p++) {
+      for (int q = p + 1; q < 4; q++) {
+        if (std::fabs(m[p][q]) < 1e-30) {continue;}
+        double theta = (m[q][q] - m[p][p]) / (2.0 * m[p][q]);
+        double t = (theta >= 0 ? 1.0 : -1.0)
+                   / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+        double c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+        for (int k = 0; k < 4; k++) {
+          double kp = m[k][p], kq = m[k][q];
+          m[k][p] = c * kp - s * kq;
+          m[k][q] = s * kp + c * kq;
+        }
+        for (int k = 0; k < 4; k++) {
+          double pk = m[p][k], qk = m[q][k];
+          m[p][k] = c * pk - s * qk;
+          m[q][k] = s * pk + c * qk;
+        }
+      }
+    }
+  }
+  return std::max(std::max(m[0][0], m[1][1]), std::max(m[2][2], m[3][3]));
+}
+
+float superposedRMSD(const std::vector<float> & a,
+                     const std::vector<float> & b) {
+  size_t n = std::min(a.size(), b.size()) / 3;
+  if (n == 0) {return 0.0;}
+  double ca[3] = {0, 0, 0}, cb[3] = {0, 0, 0};
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 0; k < 3; k++) {
+      ca[k] += a[3 * i + k];
+      cb[k] += b[3 * i + k];
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    ca[k] /= n;
+    cb[k] /= n;
+  }
+  // Correlation matrix and inner products of the centered points
+  double s[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  double g = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    double pa[3], pb[3];
+    for (int k = 0; k < 3; k++) {
+      pa[k] = a[3 * i + k] - ca[k];
+      pb[k] = b[3 * i + k] - cb[k];
+      g += pa[k] * pa[k] + pb[k] * pb[k];
+    }
+    for (int j = 0; j < 3; j++) {
+      for (int k = 0; k < 3; k++) {s[j][k] += pa[j] * pb[k];}
+    }
+  }
+  // Horn: the largest eigenvalue of this matrix is the maximum of
+  // sum(a . R b) over all rotations R
+  double m[4][4] = {
+    {s[0][0] + s[1][1] + s[2][2], s[1][2] - s[2][1], s[2][0] - s[0][2],
+     s[0][1] - s[1][0]},
+    {s[1][2] - s[2][1], s[0][0] - s[1][1] - s[2][2], s[0][1] + s[1][0],
+     s[2][0] + s[0][2]},
+    {s[2][0] - s[0][2], s[0][1] + s[1][0], -s[0][0] + s[1][1] - s[2][2],
+     s[1][2] + s[2][1]},
+    {s[0][1] - s[1][0], s[2][0] + s[0][2], s[1][2] + s[2][1],
+     -s[0][0] - s[1][1] + s[2][2]}};
+  double e = g - 2.0 * largestEigenvalue(m);
+  return std::sqrt(std::max(e, 0.0) / n);
+}
+
+// Hydrogens by name, also the ones numbered in front like 1HB
+static bool isHydrogen(const std::string & name) {
+  if (name.empty()) {return false;}
+  if (name[0] == 'H') {return true;}
+  return name.size() > 1 && std::isdigit(name[0]) && name[1] == 'H';
+}
+
+PocketStructure readPocket(const std::string & receptor) {
+  AtomTable atoms;
+  try {
+    atoms = readPDB(receptor);
+  } catch (PDBException & e) {
+    throw EnsembleException(e.what());
+  }
+  DockingBox box;
+  try {
+    box = readConf(receptor + "_conf");
+  } catch (PocketException & e) {
+    throw EnsembleException(e.what());
+  }
+  PocketStructure pocket;
+  pocket.box = box;
+  for (size_t i = 0; i < atoms.size(); i++) {
+    std::string name = atoms.name(i);
+    if (isHydrogen(name)) {continue;}
+    // First alternate location wins
+    std::array<float, 3> p = {{atoms.x[i], atoms.y[i], atoms.z[i]}};
+    pocket.coords.insert(std::make_pair(std::make_tuple(atoms.chain[i],
+                                                        atoms.resSeq[i],
+                                                        name), p));
+    if (name != "CA") {continue;}
+    bool inside = true;
+    for (int k = 0; k < 3; k++) {
+      inside = inside && std::fabs(p[k] - box.center[k]) <= box.size[k] / 2;
+    }
+    if (inside) {
+      pocket.inBox.insert(std::make_pair(atoms.chain[i], atoms.resSeq[i]));
+    }
+  }
+  return pocket;
+}
+
+float pocketRMSD(const PocketStructure & a, const PocketStructure & b) {
+  std::vector<float> pa, pb;
+  for (auto & atom : a.coords) {
+    auto other = b.coords.find(atom.first);
+    if (other == b.coords.end()) {continue;}
+    std::pair<char, int> residue(std::get<0>(atom.first),
+                                 std::get<1>(atom.first));
+    if (a.inBox.count(residue) == 0 || b.inBox.count(residue) == 0) {
+      continue;
+    }
+    pa.insert(pa.end(), atom.second.begin(), atom.second.end());
+    pb.insert(pb.end(), other->second.begin(), other->second.end());
+  }
+  if (pa.size() < 9) {return std::numeric_limits<float>::infinity();}
+  return superposedRMSD(pa, pb);
+}
+
+// Distance of the box centres in Angstrom
+static float boxDistance(const PocketStructure & a,
+                         const PocketStructure & b) {
+  float sum = 0.0;
+  for (int k = 0; k < 3; k++) {
+    float d = a.box.center[k] - b.box.center[k];
+    sum += d * d;
+  }
+  return std::sqrt(sum);
+}
+
+ReceptorEnsemble clusterReceptors(const std::vector<std::string> & receptors,
+                                  float cutoff) {
+  size_t n = receptors.size();
+  std::vector<PocketStructure> pockets(n);
+  std::vector<std::string> errors(n);
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < n; i++) {
+    try {
+      pockets[i] = readPocket(receptors[i]);
+    } catch (std::exception & e) {
+      errors[i] = e.what();
+    }
+  }
+  for (auto & e : errors) {
+    if (!e.empty()) {throw EnsembleException(e);}
+  }
+  // Neighbours within cutoff in the same pocket, every one its own
+  // neighbour
+  std::vector<std::vector<bool>> close(n, std::vector<bool>(n, false));
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < n; i++) {
+    close[i][i] = true;
+    for (size_t j = i + 1; j < n; j++) {
+      close[i][j] = boxDistance(pockets[i], pockets[j]) <= cutoff
+                    && pocketRMSD(pockets[i], pockets[j]) <= cutoff;
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = i + 1; j < n; j++) {close[j][i] = close[i][j];}
+  }
+  // Gromos: most neighbours left first, ties to the first receptor
+  const unsigned int none = n;
+  std::vector<unsigned int> center(n, none);
+  size_t left = n;
+  while (left > 0) {
+    unsigned int best = none, bestCount = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (center[i] != none) {continue;}
+      unsigned int count = 0;
+      for (size_t j = 0; j < n; j++) {
+        count += (center[j] == none && close[i][j]) ? 1 : 0;
+      }
+      if (count > bestCount) {
+        best = i;
+        bestCount = count;
+      }
+    }
+    for (size_t j = 0; j < n; j++) {
+      if (center[j] == none && close[best][j]) {
+        center[j] = best;
+        left--;
+      }
+    }
+  }
+  ReceptorEnsemble ensemble;
+  ensemble.receptors = receptors;
+  std::vector<int> index(n, -1);
+  for (size_t i = 0; i < n; i++) {
+    if (center[i] != i) {continue;}
+    index[i] = ensemble.representatives.size();
+    ensemble.representatives.push_back(receptors[i]);
+    ensemble.weights.push_back(0.0);
+  }
+  for (size_t i = 0; i < n; i++) {
+    ensemble.cluster.push_back(index[center[i]]);
+    ensemble.weights[index[center[i]]] += 1.0f / n;
+  }
+  return ensemble;
+}
+
+void saveEnsemble(const std::string & file, const ReceptorEnsemble & ensemble,
+                  float cutoff) {
+  std::string tmp = file + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    out << "# cutoff " << cutoff << "\n";
+    for (size_t i = 0; i < ensemble.receptors.size(); i++) {
+      out << ensemble.receptors[i] << " "
+          << ensemble.representatives[ensemble.cluster[i]] << "\n";
+    }
+    if (!out) {
+      throw EnsembleException("Could not write " + tmp);
+    }
+  }
+  if (std::rename(tmp.c_str(), file.c_str()) != 0) {
+    throw EnsembleException("Could not write " + file);
+  }
+}
+
+bool loadEnsemble(const std::string & file,
+                  const std::vector<std::string> & receptors, float cutoff,
+                  ReceptorEnsemble & ensemble) {
+  std::ifstream in(file);
+  std::string hash, word;
+  float savedCutoff;
+  if (!(in >> hash >> word >> savedCutoff) || hash != "#"
+      || word != "cutoff") {
+    return false;
+  }
+  // Written with the same precision
+  std::stringstream current, saved;
+  current << cutoff;
+  saved << savedCutoff;
+  if (current.str() != saved.str()) {return false;}
+  std::map<std::string, std::string> mapping;
+  std::string receptor, representative;
+  while (in >> receptor >> representative) {
+    mapping[receptor] = representative;
+  }
+  if (mapping.size() != receptors.size()) {return false;}
+  ReceptorEnsemble loaded;
+  loaded.receptors = receptors;
+  std::map<std::string, unsigned int> index;
+  for (auto & r : receptors) {
+    auto m = mapping.find(r);
+    if (m == mapping.end() || mapping.count(m->second) == 0
+        || mapping[m->second] != m->second) {
+      return false;
+    }
+  }
+  // Representatives in input order, as clusterReceptors returns them
+  for (auto & r : receptors) {
+    if (mapping[r] != r) {continue;}
+    index[r] = loaded.representatives.size();
+    loaded.representatives.push_back(r);
+    loaded.weights.push_back(0.0);
+  }
+  for (auto & r : receptors) {
+    unsigned int c = index[mapping[r]];
+    loaded.cluster.push_back(c);
+    loaded.weights[c] += 1.0f / receptors.size();
+  }
+  ensemble = loaded;
+  return true;
+}
+
+ReceptorEnsemble reduceEnsemble(const std::vector<std::string> & receptors,
+                                float cutoff, const std::string & file,
+                                Info * info) {
+  ReceptorEnsemble ensemble;
+  if (loadEnsemble(file, receptors, cutoff, ensemble)) {
+    info->infoMsg("Receptor ensemble taken from " + file);
+  } else {
+    ensemble = clusterReceptors(receptors, cutoff);
+    saveEnsemble(file, ensemble, cutoff);
+  }
+  for (size_t c = 0; c < ensemble.representatives.size(); c++) {
+    info->infoMsg("Representative " + ensemble.representatives[c]
+                  + " (weight " + std::to_string(ensemble.weights[c]) + ")");
+  }
+  info->infoMsg("Docking against " + std::to_string(
+                ensemble.representatives.size()) + " of "
+                + std::to_string(receptors.size()) + " receptors");
+  return ensemble;
+}
@@ -0,0 +1,117 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Ensemble
+ *
+ * Reduction of a receptor ensemble (conformations of the same target) to
+ * representatives before the GA starts. Near-duplicate conformations cost
+ * a docking run per ligand each without adding information.
+ *
+ * Two conformations are compared by the RMSD of the heavy atoms of the
+ * residues inside both of their docking boxes, after optimal superposition
+ * (Kabsch; computed with Horn's quaternion method, which gives the same
+ * minimum). Conformations are clustered like gmx cluster -method gromos:
+ * the conformation with the most neighbours within the cutoff represents
+ * them, both are removed and this repeats until none is left. Only
+ * conformations whose box centres lie within the cutoff of each other are
+ * neighbours: two overlapping boxes share residues but are different
+ * pockets, and stay separate even on the same structure. Every
+ * representative is weighted by the share of conformations it stands for,
+ * used by the aggregation of affinities.
+ *
+ * The mapping is written to a file and reused as long as the receptors
+ * and the cutoff stay the same, so results of later runs are comparable.
+*/
+#ifndef SRC_ENSEMBLE_ENSEMBLE_H_
+#define SRC_ENSEMBLE_ENSEMBLE_H_
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <tuple>
+#include <array>
+#include <exception>
+#include "../PDB/PDB.h"
+#include "../Pocket/Pocket.h"
+#include "../Info.h"
+
+class EnsembleException : virtual public std::exception {
+ public:
+    EnsembleException(const std::string msg1) {
+      errorMsg = "Error in Ensemble!\nMessage: " + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+/* Heavy atoms of a receptor:
+ *  coords:  x, y, z of every atom by chain, residue number and atom name
+ *  inBox:   residues (chain, number) with their CA inside the docking box
+ *  box:     the docking box
+*/
+struct PocketStructure {
+  std::map<std::tuple<char, int, std::string>, std::array<float, 3>> coords;
+  std::set<std::pair<char, int>> inBox;
+  DockingBox box;
+};
+
+/* Reduced ensemble:
+ *  receptors:       all receptors, input order
+ *  cluster:         index into representatives for every receptor
+ *  representatives: receptors docked against, input order
+ *  weights:         share of receptors each representative stands for
+*/
+struct ReceptorEnsemble {
+  std::vector<std::string> receptors;
+  std::vector<unsigned int> cluster;
+  std::vector<std::string> representatives;
+  std::vector<float> weights;
+};
+
+/* superposedRMSD(a, b):
+ *
+ * Returns RMSD of two point sets (x, y, z per point, same order) after
+ * optimal rigid superposition
+*/
+float superposedRMSD(const std::vector<float> &, const std::vector<float> &);
+/* readPocket(receptor):
+ *
+ * Returns heavy atoms of receptor and the residues in its box (receptor
+ * + "_conf")
+*/
+PocketStructure readPocket(const std::string &);
+/* pocketRMSD(a, b):
+ *
+ * Returns superposed RMSD of the atoms of the residues inside both boxes,
+ * infinity if they share less than 3 atoms (different pockets)
+*/
+float pocketRMSD(const PocketStructure &, const PocketStructure &);
+/* clusterReceptors(receptors, cutoff):
+ *
+ * Returns ensemble clustered with the gromos method, cutoff in Angstrom for
+ * the pocket RMSD and the distance of the box centres
+*/
+ReceptorEnsemble clusterReceptors(const std::vector<std::string> &, float);
+/* saveEnsemble(file, ensemble, cutoff) / loadEnsemble(file, receptors,
+ * cutoff, ensemble):
+ *
+ * Write and read the mapping, one "receptor representative" line per
+ * receptor. loadEnsemble returns false if there is no file or it was
+ * written for other receptors or another cutoff
+*/
+void saveEnsemble(const std::string &, const ReceptorEnsemble &, float);
+bool loadEnsemble(const std::string &, const std::vector<std::string> &,
+                  float, ReceptorEnsemble &);
+/* reduceEnsemble(receptors, cutoff, file, info):
+ *
+ * Returns the mapping stored in file if it is still valid, else clusters
+ * receptors and stores the result
+*/
+ReceptorEnsemble reduceEnsemble(const std::vector<std::string> &, float,
+                                const std::string &, Info *);
+
+#endif  // SRC_ENSEMBLE_ENSEMBLE_H_
@@ -1,6 +1,257 @@
 /* Copyright 2019 iGEM Team Freiburg 2019 */
 #include "GMXInstance.h"
 
+// Steps of preparePDB(), runMD() and clusterMD() in order, with the
+// checkpoint of mdrun steps
+static const std::vector<std::pair<std::string, std::string>> kSteps = {
+  {"clean", ""}, {"pdb2gmx", ""}, {"editconf", ""}, {"solvate", ""},
+  {"grompp_ions", ""}, {"genion", ""}, {"grompp_em", ""}, {"mdrun_em", ""},
+  {"grompp_nvt", ""}, {"mdrun_nvt", "nvt.cpt"}, {"grompp_npt", ""},
+  {"mdrun_npt", "npt.cpt"}, {"grompp_md", ""}, {"mdrun_md", "md_0_1.cpt"},
+  {"trjconv_nopbc", ""}, {"trjconv_pdb", ""}, {"cluster", ""}
+};
+
+// Stage of a step for its time limit, setup up to genion, MD up to the
+// production run, analysis afterwards
+static Stage stepStage(const std::string & step) {
+  Stage stage = STAGESETUP;
+  for (auto & s : kSteps) {
+    if (s.first == "grompp_em") {stage = STAGEMD;}
+    if (s.first == "trjconv_nopbc") {stage = STAGEANALYSIS;}
+    if (s.first == step) {return stage;}
+  }
+  return STAGEOTHER;
+}
+
+// Box sizes are rounded up to multiples of this (nm), so similar solutes
+// share a water box template
+static const float kBoxBucket = 0.2;
+// Water molecules with an atom closer than this (nm) to the solute are
+// removed, about what gmx solvate removes with its default radii
+static const float kSolventOverlap = 0.25;
+// Minimum distance between ions (nm), like genion -rmin
+static const float kIonDistance = 0.6;
+
+// FNV-1a
+static uint64_t fnv1a(const std::string & data, uint64_t hash) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static bool copyFile(const std::string & from, const std::string & to) {
+  std::ifstream src(from, std::ios::binary);
+  if (!src) {return false;}
+  std::ofstream dst(to, std::ios::binary | std::ios::trunc);
+  dst << src.rdbuf();
+  return static_cast<bool>(dst);
+}
+
+static long fileSize(const std::string & file) {
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0) {return -1;}
+  return st.st_size;
+}
+
+std::string GMXInstance::manifestPath(const std::string & step) {
+  return workDir + "/manifests/" + step;
+}
+
+std::string GMXInstance::stepKey(const std::string & step,
+                                 const std::string & command,
+                                 const std::vector<std::string> & inputs) {
+  // Relative to the directory, so copies elsewhere (backups) still match
+  std::string relative = command;
+  for (size_t pos = relative.find(workDir); pos != std::string::npos;
+       pos = relative.find(workDir, pos + 1)) {
+    relative.replace(pos, workDir.size(), ".");
+  }
+  uint64_t hash = fnv1a(relative, 14695981039346656037ULL);
+  for (auto input : inputs) {
+    if (input.compare(0, workDir.size() + 1, workDir + "/") == 0) {
+      std::string name = input.substr(workDir.size() + 1);
+      bool from = false;
+      for (auto & s : kSteps) {
+        from = from || s.first == step;
+        std::string snapshot = manifestPath(s.first) + "." + name;
+        if (from && fileSize(snapshot) >= 0) {
+          input = snapshot;
+          break;
+        }
+      }
+    }
+    // In pieces, trajectories can be large
+    std::ifstream in(input, std::ios::binary);
+    if (!in) {
+      hash = fnv1a("missing", hash);
+      continue;
+    }
+    std::vector<char> buffer(1 << 20);
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+      hash = fnv1a(std::string(buffer.data(), in.gcount()), hash);
+    }
+  }
+  std::stringstream key;
+  key << std::hex << hash;
+  return key.str();
+}
+
+bool GMXInstance::stepDone(const std::string & step, const std::string & key) {
+  std::ifstream manifest(manifestPath(step));
+  std::string recorded;
+  if (!(manifest >> recorded) || recorded != key) {return false;}
+  long size;
+  std::string output;
+  while (manifest >> size >> output) {
+    if (fileSize(workDir + "/" + output) != size) {return false;}
+  }
+  return true;
+}
+
+void GMXInstance::startStep(const std::string & step,
+                            const std::vector<std::string> & inPlace,
+                            const std::vector<std::string> & outputs) {
+  // Everything after this step has to run again, from scratch. Snapshots
+  // later steps took of files this step writes predate this run, the
+  // others are still what those steps started from
+  std::vector<std::string> snapshots;
+  DIR * dir = opendir((workDir + "/manifests").c_str());
+  if (dir != NULL) {
+    for (struct dirent * entry = readdir(dir); entry != NULL;
+         entry = readdir(dir)) {
+      snapshots.push_back(entry->d_name);
+    }
+    closedir(dir);
+  }
+  bool later = false;
+  for (auto & s : kSteps) {
+    if (later) {
+      std::remove(manifestPath(s.first).c_str());
+      if (!s.second.empty()) {
+        std::remove((workDir + "/" + s.second).c_str());
+      }
+      for (auto & name : snapshots) {
+        if (name.compare(0, s.first.size() + 1, s.first + ".") != 0) {
+          continue;
+        }
+        std::string file = name.substr(s.first.size() + 1);
+        if (std::count(inPlace.begin(), inPlace.end(), file) != 0
+            || std::count(outputs.begin(), outputs.end(), file) != 0) {
+          std::remove((workDir + "/manifests/" + name).c_str());
+        }
+      }
+    }
+    later = later || s.first == step;
+  }
+  std::remove(manifestPath(step).c_str());
+  // Files the step modifies are restored to their state before its first
+  // attempt, so running it again does not apply the change twice
+  mkdir((workDir + "/manifests").c_str(), 0777);
+  for (auto & file : inPlace) {
+    std::string snapshot = manifestPath(step) + "." + file;
+    if (!copyFile(snapshot, workDir + "/" + file)) {
+      copyFile(workDir + "/" + file, snapshot);
+    }
+  }
+}
+
+void GMXInstance::finishStep(const std::string & step, const std::string & key,
+                             const std::vector<std::string> & outputs) {
+  std::ofstream manifest(manifestPath(step), std::ios::trunc);
+  manifest << key << "\n";
+  for (auto & output : outputs) {
+    manifest << fileSize(workDir + "/" + output) << " " << output << "\n";
+  }
+}
+
+int GMXInstance::runStep(const std::string & step, const std::string & command,
+                         const std::vector<std::string> & inputs,
+                         const std::vector<std::string> & outputs,
+                         const std::vector<std::string> & inPlace) {
+  std::string key = stepKey(step, command, inputs);
+  if (stepDone(step, key)) {
+    info->infoMsg("(GMX, " + ligand + ") " + step + " done already");
+    return 0;
+  }
+  startStep(step, inPlace, outputs);
+  int success = runCommand(command, NULL, stepStage(step));
+  if (success != 0) {return success;}
+  finishStep(step, key, outputs);
+  return 0;
+}
+
+long mdpSteps(const std::string & mdp) {
+  std::ifstream in(mdp);
+  std::string line;
+  long nsteps = -1;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find(';'));
+    size_t eq = line.find('=');
+    if (eq == std::string::npos) {continue;}
+    std::istringstream name(line.substr(0, eq));
+    std::string key;
+    name >> key;
+    if (key == "nsteps") {
+      std::istringstream(line.substr(eq + 1)) >> nsteps;
+    }
+  }
+  return nsteps;
+}
+
+bool seedMdp(const std::string & from, const std::string & to,
+             unsigned int seed) {
+  std::ifstream in(from);
+  if (!in) {return false;}
+  std::stringstream seeded;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string setting = line.substr(0, line.find(';'));
+    size_t eq = setting.find('=');
+    if (eq != std::string::npos) {
+      std::istringstream name(setting.substr(0, eq));
+      std::string key;
+      name >> key;
+      std::replace(key.begin(), key.end(), '-', '_');
+      if (key == "gen_seed" || key == "ld_seed") {continue;}
+    }
+    seeded << line << "\n";
+  }
+  seeded << "gen_seed = " << seed << "\n";
+  seeded << "ld_seed = " << seed << "\n";
+  // Unchanged content keeps the manifests of the grompp steps valid
+  std::ifstream old(to);
+  std::stringstream current;
+  current << old.rdbuf();
+  if (old && current.str() == seeded.str()) {return true;}
+  std::ofstream out(to, std::ios::trunc);
+  out << seeded.str();
+  return static_cast<bool>(out);
+}
+
+bool rmsdPlateau(const std::vector<float> & rmsd, unsigned int chunks,
+                 float tolerance) {
+  // Frames are evenly spaced, so chunk i are frames i * n / chunks onwards.
+  // The first chunk still relaxes from the minimized structure and is never
+  // compared, so a plateau takes at least three
+  if (chunks < 3 || rmsd.size() < 2 * chunks) {return false;}
+  auto mean = [&rmsd, chunks](unsigned int chunk) {
+    size_t from = rmsd.size() * chunk / chunks;
+    size_t to = rmsd.size() * (chunk + 1) / chunks;
+    double sum = 0.0;
+    for (size_t i = from; i < to; i++) {sum += rmsd[i];}
+    return sum / (to - from);
+  };
+  return std::fabs(mean(chunks - 1) - mean(chunks - 2)) < tolerance;
+}
+
+unsigned int completedChunks(long step, long nsteps, unsigned int chunks) {
+  unsigned int done = 0;
+  while (done < chunks && nsteps * (done + 1) / chunks <= step) {done++;}
+  return done;
+}
+
 std::string GMXInstance::logStr() {
   return " >> " + workDir + "/GMXINSTLOG" + " 2>&1";
 }
@@ -34,7 +285,7 @@ void GMXInstance::energyMinim() {
   command.append(forcefield);
   command.append(" -ignh");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGESETUP);
   if (success != 0) {
     throw GMXException("Could not generate topology for MD", ligand, "TOP");
   }
@@ -56,7 +307,7 @@ void GMXInstance::energyMinim() {
   command.append(" -bt ");
   command.append(bt);
   command.append(logStr());
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGESETUP);
   if (success != 0) {
     throw GMXException("Could not define bounding box for MD", ligand);
   }
@@ -77,7 +328,7 @@ void GMXInstance::energyMinim() {
   command.append(" -p ");
   command.append("topol.top");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGESETUP);
   if (success != 0) {
     throw GMXException("Could not solvate for MD", ligand);
   }
@@ -102,7 +353,7 @@ void GMXInstance::energyMinim() {
   command.append(" -po ");
   command.append("mdout.mdp");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGESETUP);
   if (success != 0) {
     throw GMXException("Could not ionize for MD (1)", ligand);
   }
@@ -124,11 +375,15 @@ void GMXInstance::energyMinim() {
   command.append(" -nname ");
   command.append("CL");
   command.append(" -neutral ");
+  if (seed != 0) {
+    command.append("-seed ");
+    command.append(std::to_string(deriveSeed(seed, "genion")));
+  }
   command.append(logStr());
   command.append(" ");
   command.append("<<eof\n13\neof");  // group SOL, might have to change
                                      // to 16 depending on gromacs version
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGESETUP);
   if (success != 0) {
     throw GMXException("Could not ionize for MD (2)", ligand);
   }
@@ -153,7 +408,7 @@ void GMXInstance::energyMinim() {
   command.append(" -po ");
   command.append("mdout.mdp");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGEMD);
   if (success != 0) {
     throw GMXException("Could not prepare energy minimzation", ligand);
   }
@@ -177,7 +432,7 @@ void GMXInstance::energyMinim() {
   command.append(" -g ");
   command.append("em.log");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGEMD);
   if (success != 0) {
     throw GMXException("Could not do energy minimzation", ligand);
   }
@@ -199,7 +454,7 @@ void GMXInstance::energyMinim() {
   command.append(" -center ");
   command.append(logStr());
   command.append(" <<eof\n1\n0\neof");
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGEANALYSIS);
   if (success != 0) {
     throw GMXException("Could not do energy minimzation", ligand);
   }
@@ -218,7 +473,7 @@ void GMXInstance::energyMinim() {
   command.append("em.pdb");
   command.append(logStr());
   command.append(" <<eof\n1\neof");
-  success = system(command.c_str());
+  success = runCommand(command, NULL, STAGEANALYSIS);
   if (success != 0) {
     throw GMXException("Could not do energy minimzation", ligand);
   }
@@ -226,6 +481,11 @@ void GMXInstance::energyMinim() {
 }
 
 void GMXInstance::preparePDB() {
+  buildSystem();
+  equilibrate();
+}
+
+void GMXInstance::buildSystem() {
   // Export path to forcefield
   info->infoMsg("(GMX, " + ligand + ") Setting env forcefield value...");
   std::string command;
@@ -242,7 +502,7 @@ void GMXInstance::preparePDB() {
   command.append(workDir);
   command.append("/");
   command.append("clean.pdb");
-  success = system(command.c_str());
+  success = runStep("clean", command, {ligand}, {"clean.pdb"});
   if (success != 0) {
     throw(GMXException("Could not clean PDB file for MD", ligand));
   }
@@ -267,11 +527,23 @@ void GMXInstance::preparePDB() {
   command.append(forcefield);
   command.append(" -ignh");
   command.append(logStr());
-  success = system(command.c_str());
+  // The topology is extended by later steps, as one modified in place its
+  // size is not checked and their snapshots of it are dropped
+  success = runStep("pdb2gmx", command, {workDir + "/clean.pdb"},
+                    {"processed.gro", "posre.itp"}, {"topol.top"});
   if (success != 0) {
     throw GMXException("Could not generate topology for MD", ligand, "TOP");
   }
-  command.clear();
+  if (!boxCache.empty() && boxSupported(bt)) {
+    solvateFromCache();
+  } else {
+    solvateWithGMX();
+  }
+}
+
+void GMXInstance::solvateWithGMX() {
+  std::string command;
+  int success;
   // Define the bounding box
   info->infoMsg("(GMX, " + ligand + ") Defining the bounding box...");
   command.append("cd ");
@@ -289,7 +561,8 @@ void GMXInstance::preparePDB() {
   command.append(" -bt ");
   command.append(bt);
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("editconf", command, {workDir + "/processed.gro"},
+                    {"newbox.gro"});
   if (success != 0) {
     throw GMXException("Could not define bounding box for MD", ligand);
   }
@@ -310,7 +583,9 @@ void GMXInstance::preparePDB() {
   command.append(" -p ");
   command.append("topol.top");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("solvate", command,
+                    {workDir + "/newbox.gro", workDir + "/topol.top"},
+                    {"solv.gro"}, {"topol.top"});
   if (success != 0) {
     throw GMXException("Could not solvate for MD", ligand);
   }
@@ -335,7 +610,10 @@ void GMXInstance::preparePDB() {
   command.append(" -po ");
   command.append("mdout.mdp");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("grompp_ions", command,
+                    {mdpPath + "/ions.mdp", workDir + "/solv.gro",
+                     workDir + "/topol.top"},
+                    {"ions.tpr"});
   if (success != 0) {
     throw GMXException("Could not ionize for MD (1)", ligand);
   }
@@ -357,15 +635,116 @@ void GMXInstance::preparePDB() {
   command.append(" -nname ");
   command.append("CL");
   command.append(" -neutral ");
+  if (seed != 0) {
+    command.append("-seed ");
+    command.append(std::to_string(deriveSeed(seed, "genion")));
+  }
   command.append(logStr());
   command.append(" ");
   command.append("<<eof\n13\neof");  // group SOL, might have to change
                                      // to 16 depending on gromacs version
-  success = system(command.c_str());
+  success = runStep("genion", command,
+                    {workDir + "/ions.tpr", workDir + "/topol.top"},
+                    {"solv_ions.gro"}, {"topol.top"});
   if (success != 0) {
     throw GMXException("Could not ionize for MD (2)", ligand);
   }
   command.clear();
+}
+
+void GMXInstance::setBoxCache(const std::string & dir) {
+  boxCache = dir;
+}
+
+void GMXInstance::solvateFromCache() {
+  info->infoMsg("(GMX, " + ligand + ") Solvating from box cache...");
+  std::string processed = workDir + "/processed.gro";
+  std::string box;
+  try {
+    GroSystem solute = readGro(processed);
+    float length = boxLength(solute, boxsize, kBoxBucket);
+    box = boxCache + "/" + boxTemplateName(bt, length);
+    if (fileSize(box) <= 0) {
+      buildBoxTemplate(box, length);
+    }
+    std::string key = stepKey("solvate", "solvate " + bt + " "
+                              + std::to_string(boxsize),
+                              {processed, box, workDir + "/topol.top"});
+    if (stepDone("solvate", key)) {
+      info->infoMsg("(GMX, " + ligand + ") solvate done already");
+      return;
+    }
+    startStep("solvate", {"topol.top"}, {"solv_ions.gro"});
+    GroSystem system = insertSolute(solute, readGro(box), kSolventOverlap);
+    // Counterions only, like genion -neutral
+    std::string top = workDir + "/topol.top";
+    int charge = topologyCharge(top);
+    std::string ion = (charge > 0) ? "CL" : "NA";
+    unsigned int ions = std::abs(charge);
+    unsigned int solvent = replaceWithIons(system, solute.atoms.size(), ion,
+                                           ions, kIonDistance);
+    writeGro(workDir + "/solv_ions.gro", system);
+    setMolecules(top, solvent, ion, ions);
+    finishStep("solvate", key, {"solv_ions.gro"});
+  } catch (SolventBoxException & e) {
+    info->errorMsg(e.what(), false);
+    throw GMXException("Could not solvate for MD", ligand);
+  }
+}
+
+void GMXInstance::buildBoxTemplate(const std::string & file, float length) {
+  info->infoMsg("(GMX, " + ligand + ") Building water box "  + file);
+  mkdir(boxCache.c_str(), 0777);
+  // Built next to the cache under a name of its own and moved there when
+  // done, other ligands may be building the same box
+  std::stringstream tmp;
+  tmp << file << ".tmp" << getpid() << "."
+      << std::hash<std::thread::id>()(std::this_thread::get_id());
+  std::string dir = tmp.str();
+  mkdir(dir.c_str(), 0777);
+  // One dummy atom at the center, where the solute will go
+  GroSystem dummy;
+  dummy.title = "Water box template";
+  boxVectors(bt, length, dummy.box);
+  GroAtom atom;
+  atom.resnr = 1;
+  atom.resname = "DUM";
+  atom.name = "C";
+  // Half of v1 + v2 + v3, v1 and v2 lying in the xy-plane
+  atom.x[0] = (dummy.box[0] + dummy.box[7]) / 2.0;
+  atom.x[1] = (dummy.box[1] + dummy.box[8]) / 2.0;
+  atom.x[2] = dummy.box[2] / 2.0;
+  dummy.atoms.push_back(atom);
+  writeGro(dir + "/dummy.gro", dummy);
+  std::string command;
+  command.append("cd ");
+  command.append(dir);
+  command.append("; ");
+  command.append(gromacsPath);
+  command.append(" solvate");
+  command.append(" -cp ");
+  command.append("dummy.gro");
+  command.append(" -cs ");
+  command.append("spc216.gro");
+  command.append(" -o ");
+  command.append("water.gro");
+  command.append(logStr());
+  int success = runCommand(command, NULL, STAGESETUP);
+  if (success == 0) {
+    GroSystem water = readGro(dir + "/water.gro");
+    water.atoms.erase(water.atoms.begin());
+    writeGro(dir + "/water.gro", water);
+    success = std::rename((dir + "/water.gro").c_str(), file.c_str());
+  }
+  runCommand("rm -rf " + dir);
+  if (success != 0) {
+    throw GMXException("Could not build water box " + file, ligand);
+  }
+}
+
+void GMXInstance::equilibrate() {
+  std::string command;
+  int success;
   // Energy minimization
   info->infoMsg("(GMX, " + ligand + ") Minimzing energy...");
   // Prepare
@@ -386,7 +765,10 @@ void GMXInstance::preparePDB() {
   command.append(" -po ");
   command.append("mdout.mdp");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("grompp_em", command,
+                    {mdpPath + "/minim.mdp", workDir + "/solv_ions.gro",
+                     workDir + "/topol.top", workDir + "/posre.itp"},
+                    {"em.tpr"});
   if (success != 0) {
     throw GMXException("Could not prepare energy minimzation", ligand);
   }
@@ -410,7 +792,7 @@ void GMXInstance::preparePDB() {
   command.append(" -g ");
   command.append("em.log");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("mdrun_em", command, {workDir + "/em.tpr"}, {"em.gro"});
   if (success != 0) {
     throw GMXException("Could not do energy minimzation", ligand);
   }
@@ -418,14 +800,14 @@ void GMXInstance::preparePDB() {
   // Temperature Equilibrium
   info->infoMsg("(GMX, " + ligand + ") Equilibriating temperature...");
   // Preparation
+  std::string nvtMdp = mdpFile("nvt.mdp");
   command.append("cd ");
   command.append(workDir);
   command.append("; ");
   command.append(gromacsPath);
   command.append(" grompp");
   command.append(" -f ");
-  command.append(mdpPath);
-  command.append("/nvt.mdp");
+  command.append(nvtMdp);
   command.append(" -c ");
   command.append("em.gro");
   command.append(" -r ");
@@ -437,7 +819,9 @@ void GMXInstance::preparePDB() {
   command.append(" -po ");
   command.append("mdout.mdp");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("grompp_nvt", command,
+                    {nvtMdp, workDir + "/em.gro", workDir + "/topol.top",
+                     workDir + "/posre.itp"}, {"nvt.tpr"});
   if (success != 0) {
     throw GMXException("Could not prepare establishing of equilibrium", ligand);
   }
@@ -460,10 +844,13 @@ void GMXInstance::preparePDB() {
   command.append("nvt.trr");
   command.append(" -cpo ");
   command.append("nvt.cpt");
+  command.append(" -cpi ");
+  command.append("nvt.cpt");
   command.append(" -g ");
   command.append("nvt.log");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("mdrun_nvt", command, {workDir + "/nvt.tpr"},
+                    {"nvt.gro", "nvt.cpt"});
   if (success != 0) {
     throw GMXException("Could not establish equilibrim", ligand);
   }
@@ -471,14 +858,14 @@ void GMXInstance::preparePDB() {
   // Pressure Equilibrium
   info->infoMsg("(GMX, " + ligand + ") Equilibriating pressure...");
   // Preparation
+  std::string nptMdp = mdpFile("npt.mdp");
   command.append("cd ");
   command.append(workDir);
   command.append("; ");
   command.append(gromacsPath);
   command.append(" grompp");
   command.append(" -f ");
-  command.append(mdpPath);
-  command.append("/npt.mdp");
+  command.append(nptMdp);
   command.append(" -c ");
   command.append("nvt.gro");
   command.append(" -r ");
@@ -492,7 +879,10 @@ void GMXInstance::preparePDB() {
   command.append(" -po ");
   command.append("mdout.mdp");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("grompp_npt", command,
+                    {nptMdp, workDir + "/nvt.gro", workDir + "/nvt.cpt",
+                     workDir + "/topol.top", workDir + "/posre.itp"},
+                    {"npt.tpr"});
   if (success != 0) {
     throw GMXException("Could not prepare establishing of equilibrium", ligand);
   }
@@ -517,22 +907,25 @@ void GMXInstance::preparePDB() {
   command.append("npt.log");
   command.append(" -cpo ");
   command.append("npt.cpt");
+  command.append(" -cpi ");
+  command.append("npt.cpt");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("mdrun_npt", command, {workDir + "/npt.tpr"},
+                    {"npt.gro", "npt.cpt"});
   if (success != 0) {
     throw GMXException("Could not establish equilibrim", ligand);
   }
   command.clear();
   // Final preparation
   info->infoMsg("(GMX, " + ligand + ") Final preparation for MD...");
+  std::string mdMdp = mdpFile("md.mdp");
   command.append("cd ");
   command.append(workDir);
   command.append("; ");
   command.append(gromacsPath);
   command.append(" grompp");
   command.append(" -f ");
-  command.append(mdpPath);
-  command.append("/md.mdp");
+  command.append(mdMdp);
   command.append(" -c ");
   command.append("npt.gro");
   command.append(" -t ");
@@ -544,7 +937,10 @@ void GMXInstance::preparePDB() {
   command.append(" -po ");
   command.append("mdout.mdp");
   command.append(logStr());
-  success = system(command.c_str());
+  success = runStep("grompp_md", command,
+                    {mdMdp, workDir + "/npt.gro", workDir + "/npt.cpt",
+                     workDir + "/topol.top", workDir + "/posre.itp"},
+                    {"md_0_1.tpr"});
   if (success != 0) {
     throw GMXException("Could not prepare MD tpr file", ligand);
   }
@@ -552,37 +948,166 @@ void GMXInstance::preparePDB() {
 }
 
 void GMXInstance::runMD() {
+  simulate();
+  processTrajectory();
+}
+
+void GMXInstance::simulate() {
   // Run MD
   info->infoMsg("(GMX, " + ligand + ") Running the MD...");
+  auto mdrun = [this](const std::string & tpr) {
+    std::string command;
+    command.append("cd ");
+    command.append(workDir);
+    command.append("; ");
+    command.append(gromacsPath);
+    command.append(" mdrun");
+    command.append(" -nt 1");
+    command.append(" -deffnm md_0_1");
+    command.append(" -s ");
+    command.append(tpr);
+    command.append(" -c ");
+    command.append("md_0_1.gro");
+    command.append(" -e ");
+    command.append("md_0_1.edr");
+    command.append(" -o ");
+    command.append("md_0_1.trr");
+    command.append(" -g ");
+    command.append("md_0_1.log");
+    command.append(" -cpo ");
+    command.append("md_0_1.cpt");
+    command.append(" -cpi ");
+    command.append("md_0_1.cpt");
+    command.append(" -x ");
+    command.append("md_0_1.xtc");
+    command.append(logStr());
+    return command;
+  };
+  std::vector<std::string> outputs = {"md_0_1.gro", "md_0_1.xtc"};
+  long nsteps = mdpSteps(mdpPath + "/md.mdp");
+  if (mdChunks <= 1 || nsteps <= 0) {
+    int success = runStep("mdrun_md", mdrun("md_0_1.tpr"),
+                          {workDir + "/md_0_1.tpr"}, outputs);
+    if (success != 0) {
+      throw GMXException("Could not run the MD", ligand);
+    }
+    info->infoMsg("(GMX, " + ligand + ") MD successful!");
+    return;
+  }
+  // In chunks, continuing from the checkpoint, until the backbone RMSD
+  // has reached a plateau
+  std::string key = stepKey("mdrun_md", mdrun("md_0_1.tpr") + " chunks "
+                            + std::to_string(mdChunks) + " tolerance "
+                            + std::to_string(rmsdTolerance),
+                            {workDir + "/md_0_1.tpr"});
+  if (stepDone("mdrun_md", key)) {
+    info->infoMsg("(GMX, " + ligand + ") mdrun_md done already");
+    return;
+  }
+  startStep("mdrun_md", {}, outputs);
+  // A run cut off carries on after the last chunk it finished, so the
+  // frames so far are always k whole chunks
+  unsigned int done = completedChunks(checkpointStep(), nsteps, mdChunks);
+  if (done > 0) {
+    info->infoMsg("(GMX, " + ligand + ") Resuming MD after "
+                  + std::to_string(done) + " of " + std::to_string(mdChunks)
+                  + " chunks");
+  }
+  for (unsigned int k = done + 1; k <= mdChunks; k++) {
+    std::string command;
+    command.append("cd ");
+    command.append(workDir);
+    command.append("; ");
+    command.append(gromacsPath);
+    command.append(" convert-tpr");
+    command.append(" -s ");
+    command.append("md_0_1.tpr");
+    command.append(" -nsteps ");
+    command.append(std::to_string(nsteps * k / mdChunks));
+    command.append(" -o ");
+    command.append("md_0_1_chunk.tpr");
+    command.append(logStr());
+    if (runCommand(command, NULL, STAGEMD) != 0
+        || runCommand(mdrun("md_0_1_chunk.tpr"), NULL, STAGEMD) != 0) {
+      throw GMXException("Could not run the MD", ligand);
+    }
+    if (k < mdChunks && rmsdPlateau(backboneRMSD(), k, rmsdTolerance)) {
+      info->infoMsg("(GMX, " + ligand + ") MD converged after "
+                    + std::to_string(k) + " of " + std::to_string(mdChunks)
+                    + " chunks");
+      break;
+    }
+  }
+  finishStep("mdrun_md", key, outputs);
+  info->infoMsg("(GMX, " + ligand + ") MD successful!");
+}
+
+void GMXInstance::setAdaptiveMD(unsigned int chunks, float tolerance) {
+  mdChunks = chunks;
+  rmsdTolerance = tolerance;
+}
+
+void GMXInstance::setSeed(unsigned int seed1) {
+  seed = seed1;
+}
+
+std::string GMXInstance::mdpFile(const std::string & name) {
+  if (seed == 0) {return mdpPath + "/" + name;}
+  std::string seeded = workDir + "/seeded_" + name;
+  if (!seedMdp(mdpPath + "/" + name, seeded, deriveSeed(seed, name))) {
+    throw GMXException("Could not write seeded " + name, ligand);
+  }
+  return seeded;
+}
+
+long GMXInstance::checkpointStep() {
+  std::string checkpoint = workDir + "/md_0_1.cpt";
+  if (!std::ifstream(checkpoint)) {return -1;}
+  std::string command;
+  command.append(gromacsPath);
+  command.append(" dump");
+  command.append(" -cp ");
+  command.append(checkpoint);
+  command.append(" 2>/dev/null");
+  std::string output;
+  if (runCommand(command, &output, STAGEMD) != 0) {return -1;}
+  std::regex stepRegEx("\\bstep = ([0-9]+)");
+  std::smatch stepMatch;
+  if (!std::regex_search(output, stepMatch, stepRegEx)) {return -1;}
+  return std::stol(stepMatch.str(1));
+}
+
+std::vector<float> GMXInstance::backboneRMSD() {
   std::string command;
   command.append("cd ");
   command.append(workDir);
   command.append("; ");
   command.append(gromacsPath);
-  command.append(" mdrun");
-  command.append(" -nt 1");
-  command.append(" -deffnm md_0_1");
+  command.append(" rms");
   command.append(" -s ");
   command.append("md_0_1.tpr");
-  command.append(" -c ");
-  command.append("md_0_1.gro");
-  command.append(" -e ");
-  command.append("md_0_1.edr");
-  command.append(" -o ");
-  command.append("md_0_1.trr");
-  command.append(" -g ");
-  command.append("md_0_1.log");
-  command.append(" -cpo ");
-  command.append("md_0_1.cpt");
-  command.append(" -x ");
+  command.append(" -f ");
   command.append("md_0_1.xtc");
+  command.append(" -o ");
+  command.append("rmsd.xvg");
   command.append(logStr());
-  int success = system(command.c_str());
-  if (success != 0) {
-    throw GMXException("Could not run the MD", ligand);
+  command.append(" <<eof\n4\n4\neof");  // Backbone for fit and RMSD
+  std::vector<float> rmsd;
+  if (runCommand(command, NULL, STAGEMD) != 0) {return rmsd;}
+  std::ifstream xvg(workDir + "/rmsd.xvg");
+  std::string line;
+  while (std::getline(xvg, line)) {
+    if (line.empty() || line[0] == '#' || line[0] == '@') {continue;}
+    std::istringstream values(line);
+    float time, value;
+    if (values >> time >> value) {rmsd.push_back(value);}
   }
-  command.clear();
-  info->infoMsg("(GMX, " + ligand + ") MD successful!");
+  return rmsd;
+}
+
+void GMXInstance::processTrajectory() {
+  std::string command;
+  int success;
   // Generate .pdb file
   // Step one
   info->infoMsg("(GMX, " + ligand + ") Generating PDB file...");
@@ -602,7 +1127,9 @@ void GMXInstance::runMD() {
   command.append(logStr());
   command.append(" ");
   command.append("<<eof\n1\n0\neof");
-  success = system(command.c_str());
+  success = runStep("trjconv_nopbc", command,
+                    {workDir + "/md_0_1.tpr", workDir + "/md_0_1.xtc"},
+                    {"md_0_1_noPBC.xtc"});
   if (success != 0) {
     throw GMXException("Could not generate PDB from MD", ligand);
   }
@@ -622,7 +1149,9 @@ void GMXInstance::runMD() {
   command.append(logStr());
   command.append(" ");
   command.append(" <<eof\n1\neof");
-  success = system(command.c_str());
+  success = runStep("trjconv_pdb", command,
+                    {workDir + "/md_0_1.tpr", workDir + "/md_0_1_noPBC.xtc"},
+                    {"MD.pdb"});
   if (success != 0) {
     throw GMXException("Could not generate PDB from MD", ligand);
   }
@@ -656,7 +1185,9 @@ void GMXInstance::clusterMD() {
   command.append(" ");
   command.append(logStr());
   command.append(" <<eof\n1\n1\neof");
-  int success = system(command.c_str());
+  int success = runStep("cluster", command,
+                        {workDir + "/MD.pdb", workDir + "/md_0_1.tpr"},
+                        {"clusters.pdb"});
   if (success != 0) {
     throw GMXException("Could not cluster the MD", ligand);
   }
@@ -717,9 +1248,21 @@ void GMXInstance::extractTopCluster() {
   command.append(std::to_string(maxNo));
   command.append("\"");
   command.append(logStr());
-  int success = system(command.c_str());
+  int success = runCommand(command, NULL, STAGEANALYSIS);
   if (success != 0) {
     throw GMXException("Could not extract top cluster from clustered MD",
                        ligand);
   }
 }
+
+unsigned int GMXInstance::atomCount() {
+  // Second line of a .gro file is the number of atoms
+  std::ifstream gro(workDir + "/solv_ions.gro");
+  std::string line;
+  if (!std::getline(gro, line) || !std::getline(gro, line)) {return 0;}
+  try {
+    return std::stoul(line);
+  } catch (...) {
+    return 0;
+  }
+}
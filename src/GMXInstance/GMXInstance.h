@@ -9,6 +9,15 @@
  * "Lysozyme in Water" by Justin A. Lemkuhl, Ph.D.
  * http://www.mdtutorials.com/gmx/lysozyme/index.html
  *
+ * Every step records a manifest (hash of its command and input files,
+ * sizes of its outputs) in workDir/manifests and is skipped when run again
+ * with valid outputs. mdrun steps continue from their checkpoint, so an
+ * interrupted simulation resumes where it stopped.
+ *
+ * With a box cache, the solute is inserted into a cached water box and
+ * neutralized natively (SolventBox) instead of running editconf, solvate,
+ * grompp and genion.
+ *
 */
 #ifndef SRC_GMXINSTANCE_GMXINSTANCE_H_
 #define SRC_GMXINSTANCE_GMXINSTANCE_H_
@@ -18,8 +27,23 @@
 #include <fstream>
 #include <sstream>
 #include <regex>
+#include <limits>
 #include <exception>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
 #include "../Info.h"
+#include "../Process/Process.h"
+#include "../SolventBox/SolventBox.h"
+#include "../Seed/Seed.h"
 class GMXException : public std::exception {
  public:
     std::string type;
@@ -90,8 +114,34 @@ class GMXInstance {
       forcefieldPath = forcefieldPath1;
       pymolPath = pymolPath1;
       info = info1;
+      mdChunks = 1;
+      rmsdTolerance = 0.0;
+      seed = 0;
     }
 
+    /* setBoxCache(dir):
+     * Directory of the water box templates, shared by all ligands. Boxes
+     * missing are built there on first use. Empty (default) or box types
+     * without templates run the GROMACS tools instead
+    */
+    void setBoxCache(const std::string &);
+
+    /* setAdaptiveMD(chunks, tolerance):
+     * Runs the MD of simulate() in up to chunks parts and stops early once
+     * the mean backbone RMSD (nm) of the last part differs by less than
+     * tolerance from the one before. 1 chunk runs all of nsteps at once
+    */
+    void setAdaptiveMD(unsigned int, float);
+
+    /* setSeed(seed):
+     * Runs grompp of the equilibration and the MD with gen_seed and ld_seed
+     * derived from seed (copies of the .mdp files in workDir) and genion
+     * with -seed derived from it, so ion placement, velocities and
+     * thermostat noise are the same every time. 0 (default): as set in the
+     * .mdp files, genion picks its own
+    */
+    void setSeed(unsigned int);
+
     /* preparePDB():
      * Prepares the ligand for molecular dynamics simulation by performing:
      * 1) Cleansing from crystal water
@@ -105,6 +155,13 @@ class GMXInstance {
      * Relevant output: md_0_1.tpr
     */
     void preparePDB();
+    /* buildSystem() / equilibrate():
+     * The two halves of preparePDB(), building the solvated and ionized
+     * system (steps 1-4, short single-threaded tools) and the energy
+     * minimization and equilibration (steps 5-6, mdrun)
+    */
+    void buildSystem();
+    void equilibrate();
     /* runMD():
      * Runs a molecular dynamics simulation using the settings specified in
      * MD.mdp using the prepared PDB file from preparePDB()
@@ -112,6 +169,12 @@ class GMXInstance {
      * Relevant output: MD.pdb
     */
     void runMD();
+    /* simulate() / processTrajectory():
+     * The two halves of runMD(), mdrun itself and the conversion of the
+     * trajectory (trjconv)
+    */
+    void simulate();
+    void processTrajectory();
     /* clusterMD():
      * Clusters the result of molecular dynamics simulation using gmx cluster
      *
@@ -130,6 +193,11 @@ class GMXInstance {
      * Relevant output: em.pdb
     */
     void energyMinim();
+    /* atomCount():
+     * Returns number of atoms of the solvated and ionized system, 0 if not
+     * prepared yet
+    */
+    unsigned int atomCount();
 
  private:
     std::string ligand;
@@ -144,11 +212,91 @@ class GMXInstance {
     float boxsize;
     float clustercutoff;
     Info * info;
+    unsigned int mdChunks;
+    float rmsdTolerance;
+    std::string boxCache;
+    unsigned int seed;
 
     /* logStr():
      * Returns command-line string to redirect stdout and stderr to log file
      */
     std::string logStr();
+    /* mdpFile(name):
+     * Returns the .mdp file name of mdpPath to use, its seeded copy if a
+     * seed is set
+    */
+    std::string mdpFile(const std::string &);
+    /* runStep(step, command, inputs, outputs, inPlace):
+     * Runs command of step unless its manifest shows it ran with the same
+     * command and input files and its outputs are unchanged, returns exit
+     * code (0 if skipped). Running a step invalidates all later ones.
+     * inPlace files are modified by the command and restored first
+    */
+    int runStep(const std::string &, const std::string &,
+                const std::vector<std::string> &,
+                const std::vector<std::string> &,
+                const std::vector<std::string> & = {});
+    /* stepKey(step, command, inputs):
+     * Returns hash of command (relative to workDir) and input contents. An
+     * input in workDir that step or a later one modifies in place counts as
+     * it was before, i.e. the snapshot of the first of them
+    */
+    std::string stepKey(const std::string &, const std::string &,
+                        const std::vector<std::string> &);
+    /* stepDone(step, key):
+     * Returns true if manifest of step has key and its outputs are intact
+    */
+    bool stepDone(const std::string &, const std::string &);
+    std::string manifestPath(const std::string &);
+    /* startStep(step, inPlace, outputs) / finishStep(step, key, outputs):
+     * The parts of runStep() before and after running the command
+    */
+    void startStep(const std::string &, const std::vector<std::string> &,
+                   const std::vector<std::string> &);
+    void finishStep(const std::string &, const std::string &,
+                    const std::vector<std::string> &);
+    /* solvateWithGMX() / solvateFromCache():
+     * Steps 3 and 4 of preparePDB(), with editconf, solvate, grompp and
+     * genion or natively from a cached water box
+    */
+    void solvateWithGMX();
+    void solvateFromCache();
+    /* buildBoxTemplate(file, length):
+     * Fills a box of image distance length with water (gmx solvate) and
+     * stores it as file
+    */
+    void buildBoxTemplate(const std::string &, float);
+    /* backboneRMSD():
+     * Returns backbone RMSD of every frame of the MD so far (gmx rms)
+    */
+    std::vector<float> backboneRMSD();
+    /* checkpointStep():
+     * Returns the step md_0_1.cpt was written at (gmx dump), -1 if there
+     * is none
+    */
+    long checkpointStep();
 };
 
+/* mdpSteps(mdp):
+ * Returns nsteps of a .mdp file, -1 if not set
+*/
+long mdpSteps(const std::string &);
+/* seedMdp(from, to, seed):
+ * Writes .mdp file from to to with gen_seed and ld_seed set to seed, left
+ * untouched if it has that content already. Returns false if from can not
+ * be read or to not be written
+*/
+bool seedMdp(const std::string &, const std::string &, unsigned int);
+/* rmsdPlateau(rmsd, chunks, tolerance):
+ * Returns true if the mean RMSD of the last of chunks equal parts of rmsd
+ * (one value per frame) differs by less than tolerance from the one before,
+ * the first chunk never counts so false for less than three chunks
+*/
+bool rmsdPlateau(const std::vector<float> &, unsigned int, float);
+/* completedChunks(step, nsteps, chunks):
+ * Returns how many of chunks equal parts of nsteps a run checkpointed at
+ * step has finished
+*/
+unsigned int completedChunks(long, long, unsigned int);
+
 #endif  // SRC_GMXINSTANCE_GMXINSTANCE_H_
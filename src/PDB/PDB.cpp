@@ -0,0 +1,231 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "PDB.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
+// Columns (0-based) of a ATOM/HETATM record
+static const size_t kNameCol = 12;
+static const size_t kResNameCol = 17;
+static const size_t kChainCol = 21;
+static const size_t kResSeqCol = 22;
+static const size_t kXCol = 30;
+static const size_t kCoordWidth = 8;
+static const size_t kMinRecord = kXCol + 3 * kCoordWidth;
+// Files smaller than this are read instead, mapping costs more than copying
+static const size_t kMapThreshold = 1 << 16;
+// Length of a PDB line, to reserve the table up front
+static const size_t kRecordLength = 81;
+
+MappedFile::MappedFile(const std::string & file) {
+  bytes = NULL;
+  length = 0;
+  mapped = false;
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw PDBException("Could not open file", file);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw PDBException("Could not stat file", file);
+  }
+  length = st.st_size;
+  if (length >= kMapThreshold) {
+    void * memory = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (memory == MAP_FAILED) {
+      close(fd);
+      throw PDBException("Could not map file", file);
+    }
+    bytes = static_cast<const char *>(memory);
+    mapped = true;
+    madvise(memory, length, MADV_SEQUENTIAL);
+  } else if (length > 0) {
+    buffer.resize(length);
+    size_t done = 0;
+    while (done < length) {
+      ssize_t n = read(fd, &buffer[done], length - done);
+      if (n <= 0) {break;}
+      done += n;
+    }
+    length = done;
+    bytes = buffer.data();
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (mapped) {
+    munmap(const_cast<char *>(bytes), length);
+  }
+}
+
+std::string AtomTable::name(size_t i) const {
+  std::string n(&names[4 * i], 4);
+  size_t begin = n.find_first_not_of(' ');
+  if (begin == std::string::npos) {return "";}
+  return n.substr(begin, n.find_last_not_of(' ') - begin + 1);
+}
+
+std::string AtomTable::resName(size_t i) const {
+  std::string n(&resNames[3 * i], 3);
+  size_t begin = n.find_first_not_of(' ');
+  if (begin == std::string::npos) {return "";}
+  return n.substr(begin, n.find_last_not_of(' ') - begin + 1);
+}
+
+// Fixed-width decimal like "  -1.234", surrounding blanks allowed
+static bool parseFloat(const char * s, size_t width, float & value) {
+  size_t i = 0;
+  while (i < width && s[i] == ' ') {i++;}
+  bool negative = (i < width && s[i] == '-');
+  if (i < width && (s[i] == '-' || s[i] == '+')) {i++;}
+  double v = 0.0;
+  bool digits = false;
+  while (i < width && s[i] >= '0' && s[i] <= '9') {
+    v = v * 10 + (s[i++] - '0');
+    digits = true;
+  }
+  if (i < width && s[i] == '.') {
+    i++;
+    double scale = 0.1;
+    while (i < width && s[i] >= '0' && s[i] <= '9') {
+      v += (s[i++] - '0') * scale;
+      scale *= 0.1;
+      digits = true;
+    }
+  }
+  while (i < width && s[i] == ' ') {i++;}
+  value = negative ? -v : v;
+  return digits && i == width;
+}
+
+static bool parseInt(const char * s, size_t width, int & value) {
+  size_t i = 0;
+  while (i < width && s[i] == ' ') {i++;}
+  bool negative = (i < width && s[i] == '-');
+  if (negative) {i++;}
+  int v = 0;
+  bool digits = false;
+  while (i < width && s[i] >= '0' && s[i] <= '9') {
+    v = v * 10 + (s[i++] - '0');
+    digits = true;
+  }
+  while (i < width && s[i] == ' ') {i++;}
+  value = negative ? -v : v;
+  return digits && i == width;
+}
+
+AtomTable parsePDB(const char * data, size_t size, const std::string & file) {
+  AtomTable atoms;
+  size_t expected = size / kRecordLength + 1;
+  atoms.offset.reserve(expected);
+  atoms.x.reserve(expected);
+  atoms.y.reserve(expected);
+  atoms.z.reserve(expected);
+  atoms.resSeq.reserve(expected);
+  atoms.chain.reserve(expected);
+  atoms.names.reserve(4 * expected);
+  atoms.resNames.reserve(3 * expected);
+  const char * end = data + size;
+  for (const char * line = data; line < end;) {
+    const char * next = static_cast<const char *>(
+                          memchr(line, '\n', end - line));
+    if (next == NULL) {next = end;}
+    size_t length = next - line;
+    if (length > 0 && line[length - 1] == '\r') {length--;}
+    bool record = (length >= 4 && memcmp(line, "ATOM", 4) == 0)
+                  || (length >= 6 && memcmp(line, "HETATM", 6) == 0);
+    if (record && length >= kMinRecord) {
+      float c[3];
+      int resSeq;
+      bool valid = parseInt(line + kResSeqCol, 4, resSeq);
+      for (int k = 0; k < 3; k++) {
+        valid = valid && parseFloat(line + kXCol + k * kCoordWidth,
+                                    kCoordWidth, c[k]);
+      }
+      if (!valid) {
+        throw PDBException("Malformed atom record: "
+                           + std::string(line, length), file);
+      }
+      atoms.offset.push_back(line - data);
+      atoms.x.push_back(c[0]);
+      atoms.y.push_back(c[1]);
+      atoms.z.push_back(c[2]);
+      atoms.resSeq.push_back(resSeq);
+      atoms.chain.push_back(line[kChainCol]);
+      atoms.names.insert(atoms.names.end(), line + kNameCol,
+                         line + kNameCol + 4);
+      atoms.resNames.insert(atoms.resNames.end(), line + kResNameCol,
+                            line + kResNameCol + 3);
+    }
+    line = next + 1;
+  }
+  return atoms;
+}
+
+AtomTable readPDB(const std::string & file) {
+  MappedFile mapped(file);
+  return parsePDB(mapped.data(), mapped.size(), file);
+}
+
+char oneLetterCode(const char * r) {
+  // By first letter, no lookup table built per call
+  switch (r[0]) {
+    case 'A':
+      if (r[1] == 'L' && r[2] == 'A') {return 'A';}
+      if (r[1] == 'R' && r[2] == 'G') {return 'R';}
+      if (r[1] == 'S' && r[2] == 'N') {return 'N';}
+      if (r[1] == 'S' && r[2] == 'P') {return 'D';}
+      break;
+    case 'C':
+      if (r[1] == 'Y' && r[2] == 'S') {return 'C';}
+      break;
+    case 'G':
+      if (r[1] == 'L' && r[2] == 'U') {return 'E';}
+      if (r[1] == 'L' && r[2] == 'N') {return 'Q';}
+      if (r[1] == 'L' && r[2] == 'Y') {return 'G';}
+      break;
+    case 'H':
+      if (r[1] == 'I' && r[2] == 'S') {return 'H';}
+      break;
+    case 'I':
+      if (r[1] == 'L' && r[2] == 'E') {return 'I';}
+      break;
+    case 'L':
+      if (r[1] == 'E' && r[2] == 'U') {return 'L';}
+      if (r[1] == 'Y' && r[2] == 'S') {return 'K';}
+      break;
+    case 'M':
+      if (r[1] == 'E' && r[2] == 'T') {return 'M';}
+      break;
+    case 'P':
+      if (r[1] == 'H' && r[2] == 'E') {return 'F';}
+      if (r[1] == 'R' && r[2] == 'O') {return 'P';}
+      break;
+    case 'S':
+      if (r[1] == 'E' && r[2] == 'R') {return 'S';}
+      break;
+    case 'T':
+      if (r[1] == 'H' && r[2] == 'R') {return 'T';}
+      if (r[1] == 'R' && r[2] == 'P') {return 'W';}
+      if (r[1] == 'Y' && r[2] == 'R') {return 'Y';}
+      break;
+    case 'V':
+      if (r[1] == 'A' && r[2] == 'L') {return 'V';}
+      break;
+  }
+  return 0;
+}
+
+std::string sequence(const AtomTable & atoms) {
+  std::string fasta;
+  for (size_t i = 0; i < atoms.size(); i++) {
+    if (i > 0 && atoms.resSeq[i] == atoms.resSeq[i - 1]) {continue;}
+    char code = oneLetterCode(&atoms.resNames[3 * i]);
+    if (code != 0) {fasta.push_back(code);}
+  }
+  return fasta;
+}
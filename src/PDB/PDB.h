@@ -0,0 +1,100 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * PDB
+ *
+ * Reader of the ATOM/HETATM records of PDB files, shared by everything
+ * needing coordinates or residues of a structure (FASTA sequences, docking
+ * boxes, mirror images). Files are mapped into memory (small ones read in
+ * one go) and parsed in place into an atom table holding one array per
+ * column, without a string per line or field, so large receptors and
+ * thousands of ligands read fast.
+*/
+#ifndef SRC_PDB_PDB_H_
+#define SRC_PDB_PDB_H_
+#include <string>
+#include <vector>
+#include <exception>
+
+class PDBException : virtual public std::exception {
+ public:
+    PDBException(const std::string msg1, const std::string file1) {
+      errorMsg = "Error in PDB!\nFile: " + file1 + "\nMessage: " + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+/* File mapped read-only into memory for its lifetime, small files are read
+ * into a buffer instead */
+class MappedFile {
+ public:
+    MappedFile(const std::string &);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    const char * data() const {return bytes;}
+    size_t size() const {return length;}
+
+ private:
+    const char * bytes;
+    size_t length;
+    bool mapped;
+    std::vector<char> buffer;
+};
+
+/* One entry per ATOM/HETATM record, in file order:
+ *  offset:   position of the record in the file
+ *  x, y, z:  coordinates (Angstrom)
+ *  resSeq:   residue number
+ *  chain:    chain identifier
+ *  names:    atom names, 4 characters per atom as in the file
+ *  resNames: residue names, 3 characters per atom
+*/
+struct AtomTable {
+  std::vector<size_t> offset;
+  std::vector<float> x, y, z;
+  std::vector<int> resSeq;
+  std::vector<char> chain;
+  std::vector<char> names;
+  std::vector<char> resNames;
+
+  size_t size() const {return x.size();}
+  /* name(i) / resName(i):
+   *
+   * Atom and residue name of atom i without padding
+  */
+  std::string name(size_t) const;
+  std::string resName(size_t) const;
+};
+
+/* parsePDB(data, size, file):
+ *
+ * Returns atom table of PDB text, records too short for coordinates are
+ * skipped. Throws PDBException naming file on malformed numbers
+*/
+AtomTable parsePDB(const char *, size_t, const std::string & = "");
+/* readPDB(file):
+ *
+ * Returns atom table of a PDB file
+*/
+AtomTable readPDB(const std::string &);
+/* oneLetterCode(resName):
+ *
+ * Returns one-letter code of the 20 standard amino acids (3 characters),
+ * 0 for anything else
+*/
+char oneLetterCode(const char *);
+/* sequence(atoms):
+ *
+ * Returns one-letter sequence with a letter per residue number change,
+ * non-standard residues left out
+*/
+std::string sequence(const AtomTable &);
+
+#endif  // SRC_PDB_PDB_H_
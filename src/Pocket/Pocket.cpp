@@ -0,0 +1,281 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Pocket.h"
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// Grid points closer than this to an atom are occupied by the receptor
+static const float kOccupiedRadius = 3.0;
+// Rays longer than this do not count as hitting the receptor
+static const float kRayLength = 10.0;
+// Of the 7 lines through a grid point, this many have to hit the receptor
+// on both sides for the point to be buried
+static const int kMinBuriedness = 5;
+
+std::vector<PocketAtom> readAtoms(const std::string & file) {
+  AtomTable table;
+  try {
+    table = readPDB(file);
+  } catch (PDBException & e) {
+    throw PocketException(e.what());
+  }
+  std::vector<PocketAtom> atoms(table.size());
+  for (size_t i = 0; i < table.size(); i++) {
+    atoms[i] = {table.x[i], table.y[i], table.z[i], table.chain[i],
+                table.resSeq[i]};
+  }
+  if (atoms.empty()) {
+    throw PocketException("No atoms in " + file);
+  }
+  return atoms;
+}
+
+// Box around points given as min and max per axis
+static DockingBox extentBox(const float min[3], const float max[3],
+                            float padding) {
+  DockingBox box;
+  for (int k = 0; k < 3; k++) {
+    box.center[k] = (min[k] + max[k]) / 2.0;
+    box.size[k] = max[k] - min[k] + 2 * padding;
+  }
+  box.points = 0;
+  return box;
+}
+
+DockingBox boundingBox(const std::vector<PocketAtom> & atoms, float padding) {
+  float min[3], max[3];
+  std::fill(min, min + 3, std::numeric_limits<float>::infinity());
+  std::fill(max, max + 3, - std::numeric_limits<float>::infinity());
+  for (auto & a : atoms) {
+    float c[3] = {a.x, a.y, a.z};
+    for (int k = 0; k < 3; k++) {
+      min[k] = std::min(min[k], c[k]);
+      max[k] = std::max(max[k], c[k]);
+    }
+  }
+  return extentBox(min, max, padding);
+}
+
+std::vector<DockingBox> detectPockets(const std::vector<PocketAtom> & atoms,
+                                      float spacing, unsigned int maxPockets,
+                                      float padding, unsigned int minPoints) {
+  if (!(spacing > 0)) {
+    throw PocketException("Grid spacing has to be positive");
+  }
+  DockingBox all = boundingBox(atoms, 0.0);
+  float origin[3];
+  int n[3];
+  for (int k = 0; k < 3; k++) {
+    origin[k] = all.center[k] - all.size[k] / 2.0;
+    n[k] = static_cast<int>(std::ceil(all.size[k] / spacing)) + 1;
+  }
+  auto index = [&](int i, int j, int l) {
+    return (static_cast<size_t>(i) * n[1] + j) * n[2] + l;
+  };
+  // Mark grid points occupied by the receptor
+  std::vector<char> occupied(static_cast<size_t>(n[0]) * n[1] * n[2], 0);
+  int reach = static_cast<int>(std::ceil(kOccupiedRadius / spacing));
+  float r2 = kOccupiedRadius * kOccupiedRadius;
+  for (auto & a : atoms) {
+    int ci = std::lround((a.x - origin[0]) / spacing);
+    int cj = std::lround((a.y - origin[1]) / spacing);
+    int cl = std::lround((a.z - origin[2]) / spacing);
+    for (int i = std::max(0, ci - reach); i <= std::min(n[0] - 1, ci + reach);
+         i++) {
+      float dx = origin[0] + i * spacing - a.x;
+      for (int j = std::max(0, cj - reach);
+           j <= std::min(n[1] - 1, cj + reach); j++) {
+        float dy = origin[1] + j * spacing - a.y;
+        for (int l = std::max(0, cl - reach);
+             l <= std::min(n[2] - 1, cl + reach); l++) {
+          float dz = origin[2] + l * spacing - a.z;
+          if (dx * dx + dy * dy + dz * dz <= r2) {
+            occupied[index(i, j, l)] = 1;
+          }
+        }
+      }
+    }
+  }
+  // Buriedness: count lines hitting the receptor in both directions
+  static const int lines[7][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+                                  {1, 1, 1}, {1, 1, -1}, {1, -1, 1},
+                                  {-1, 1, 1}};
+  auto hits = [&](int i, int j, int l, const int * d, int sign) {
+    float step = spacing * std::sqrt(static_cast<float>(d[0] * d[0]
+                                                        + d[1] * d[1]
+                                                        + d[2] * d[2]));
+    int steps = static_cast<int>(kRayLength / step);
+    for (int s = 1; s <= steps; s++) {
+      int a = i + sign * s * d[0];
+      int b = j + sign * s * d[1];
+      int c = l + sign * s * d[2];
+      if (a < 0 || b < 0 || c < 0 || a >= n[0] || b >= n[1] || c >= n[2]) {
+        return false;
+      }
+      if (occupied[index(a, b, c)]) {return true;}
+    }
+    return false;
+  };
+  std::vector<char> buried(occupied.size(), 0);
+  for (int i = 0; i < n[0]; i++) {
+    for (int j = 0; j < n[1]; j++) {
+      for (int l = 0; l < n[2]; l++) {
+        if (occupied[index(i, j, l)]) {continue;}
+        int buriedness = 0;
+        for (int d = 0; d < 7; d++) {
+          if (hits(i, j, l, lines[d], 1) && hits(i, j, l, lines[d], -1)) {
+            buriedness++;
+          }
+        }
+        buried[index(i, j, l)] = (buriedness >= kMinBuriedness);
+      }
+    }
+  }
+  // Connected buried points (26-neighbourhood) form a pocket
+  std::vector<DockingBox> pockets;
+  std::vector<int> stack;
+  for (int i = 0; i < n[0]; i++) {
+    for (int j = 0; j < n[1]; j++) {
+      for (int l = 0; l < n[2]; l++) {
+        if (!buried[index(i, j, l)]) {continue;}
+        int min[3] = {i, j, l};
+        int max[3] = {i, j, l};
+        unsigned int points = 0;
+        buried[index(i, j, l)] = 0;
+        stack.insert(stack.end(), {i, j, l});
+        while (!stack.empty()) {
+          int c = stack.back(); stack.pop_back();
+          int b = stack.back(); stack.pop_back();
+          int a = stack.back(); stack.pop_back();
+          points++;
+          int p[3] = {a, b, c};
+          for (int k = 0; k < 3; k++) {
+            min[k] = std::min(min[k], p[k]);
+            max[k] = std::max(max[k], p[k]);
+          }
+          for (int da = -1; da <= 1; da++) {
+            for (int db = -1; db <= 1; db++) {
+              for (int dc = -1; dc <= 1; dc++) {
+                int x = a + da, y = b + db, z = c + dc;
+                if (x < 0 || y < 0 || z < 0 || x >= n[0] || y >= n[1]
+                    || z >= n[2] || !buried[index(x, y, z)]) {
+                  continue;
+                }
+                buried[index(x, y, z)] = 0;
+                stack.insert(stack.end(), {x, y, z});
+              }
+            }
+          }
+        }
+        if (points < minPoints) {continue;}
+        float fmin[3], fmax[3];
+        for (int k = 0; k < 3; k++) {
+          fmin[k] = origin[k] + min[k] * spacing;
+          fmax[k] = origin[k] + max[k] * spacing;
+        }
+        DockingBox box = extentBox(fmin, fmax, padding);
+        box.points = points;
+        pockets.push_back(box);
+      }
+    }
+  }
+  std::stable_sort(pockets.begin(), pockets.end(),
+                   [](const DockingBox & a, const DockingBox & b) {
+                     return a.points > b.points;
+                   });
+  if (pockets.size() > maxPockets) {
+    pockets.resize(maxPockets);
+  }
+  return pockets;
+}
+
+std::vector<std::pair<char, int>> parseResidues(const std::string & list) {
+  std::vector<std::pair<char, int>> residues;
+  std::string item;
+  std::stringstream listStream(list);
+  while (std::getline(listStream, item, ',')) {
+    item.erase(std::remove(item.begin(), item.end(), ' '), item.end());
+    if (item.empty()) {continue;}
+    char chain = ' ';
+    size_t colon = item.find(':');
+    if (colon != std::string::npos) {
+      if (colon != 1) {
+        throw PocketException("Invalid residue \"" + item
+                              + "\", use CHAIN:NUMBER or NUMBER");
+      }
+      chain = item[0];
+      item = item.substr(2);
+    }
+    try {
+      residues.push_back(std::make_pair(chain, std::stoi(item)));
+    } catch (...) {
+      throw PocketException("Invalid residue number \"" + item + "\"");
+    }
+  }
+  return residues;
+}
+
+DockingBox residueBox(const std::vector<PocketAtom> & atoms,
+                      const std::vector<std::pair<char, int>> & residues,
+                      float padding) {
+  std::vector<PocketAtom> selected;
+  for (auto & a : atoms) {
+    for (auto & r : residues) {
+      if (a.resSeq == r.second && (r.first == ' ' || a.chain == r.first)) {
+        selected.push_back(a);
+        break;
+      }
+    }
+  }
+  if (selected.empty()) {
+    throw PocketException("None of the pocket residues found in receptor");
+  }
+  return boundingBox(selected, padding);
+}
+
+void writeConf(const std::string & file, const DockingBox & box) {
+  std::ofstream confFile;
+  confFile.open(file.c_str(), std::ios::trunc);
+  if (!confFile) {
+    throw PocketException("Could not open config file " + file);
+  }
+  confFile << "center_x = " << box.center[0] << std::endl;
+  confFile << "center_y = " << box.center[1] << std::endl;
+  confFile << "center_z = " << box.center[2] << std::endl;
+  confFile << std::endl;
+  confFile << "size_x = " << box.size[0] << std::endl;
+  confFile << "size_y = " << box.size[1] << std::endl;
+  confFile << "size_z = " << box.size[2] << std::endl;
+  confFile.close();
+}
+
+DockingBox readConf(const std::string & file) {
+  std::ifstream confFile(file.c_str());
+  if (!confFile) {
+    throw PocketException("Could not open config file " + file);
+  }
+  DockingBox box = {{0, 0, 0}, {0, 0, 0}, 0};
+  const std::string keys[6] = {"center_x", "center_y", "center_z",
+                               "size_x", "size_y", "size_z"};
+  bool found[6] = {false, false, false, false, false, false};
+  std::string line;
+  while (std::getline(confFile, line)) {
+    std::stringstream ss(line);
+    std::string key, eq;
+    float value;
+    if (!(ss >> key >> eq >> value) || eq != "=") {continue;}
+    for (int k = 0; k < 6; k++) {
+      if (key != keys[k]) {continue;}
+      (k < 3 ? box.center[k] : box.size[k - 3]) = value;
+      found[k] = true;
+    }
+  }
+  for (int k = 0; k < 6; k++) {
+    if (!found[k]) {
+      throw PocketException("No " + keys[k] + " in config file " + file);
+    }
+  }
+  return box;
+}
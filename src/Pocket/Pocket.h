@@ -0,0 +1,105 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Pocket
+ *
+ * Docking boxes around the binding site(s) of a receptor instead of the whole
+ * receptor, the search cost of Vina grows with the box volume:
+ *  - grid: cavities found by grid-based buriedness (LIGSITE-like). Grid
+ *          points not occupied by the receptor count as buried if rays in
+ *          both directions of a line hit the receptor; clusters of buried
+ *          points are pockets, largest first.
+ *  - residues: box around a user-specified list of residues
+*/
+#ifndef SRC_POCKET_POCKET_H_
+#define SRC_POCKET_POCKET_H_
+#include <string>
+#include <vector>
+#include <utility>
+#include <exception>
+#include "../PDB/PDB.h"
+
+class PocketException : virtual public std::exception {
+ public:
+    PocketException(const std::string msg1) {
+      errorMsg = "Error in Pocket!\nMessage: " + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+struct PocketAtom {
+  float x, y, z;
+  char chain;
+  int resSeq;
+};
+
+/* Vina search space, points is the number of grid points of a pocket */
+struct DockingBox {
+  float center[3];
+  float size[3];
+  unsigned int points;
+};
+
+/* Settings read from [VINA] in config.ini:
+ *  mode:      none (whole receptor), grid or residues
+ *  residues:  residue list for mode residues, see parseResidues
+ *  maxPockets: number of pockets docked against per receptor (grid)
+ *  padding:   added to every side of a pocket box (Angstrom)
+ *  spacing:   grid spacing (Angstrom)
+ *  minPoints: minimum number of grid points of a pocket
+*/
+struct PocketSettings {
+  std::string mode = "none";
+  std::string residues;
+  unsigned int maxPockets = 1;
+  float padding = 8.0;
+  float spacing = 1.0;
+  unsigned int minPoints = 30;
+};
+
+/* readAtoms(file):
+ *
+ * Returns coordinates, chain and residue number of ATOM/HETATM records
+*/
+std::vector<PocketAtom> readAtoms(const std::string &);
+/* boundingBox(atoms, padding):
+ *
+ * Returns box around all atoms with padding (Angstrom) added on every side
+*/
+DockingBox boundingBox(const std::vector<PocketAtom> &, float);
+/* detectPockets(atoms, spacing, maxPockets, padding, minPoints):
+ *
+ * Returns boxes of the maxPockets largest cavities with at least minPoints
+ * buried grid points, grid spacing in Angstrom
+*/
+std::vector<DockingBox> detectPockets(const std::vector<PocketAtom> &, float,
+                                      unsigned int, float, unsigned int);
+/* parseResidues(list):
+ *
+ * Parses comma-separated residues like "A:45,A:67,101" (chain optional)
+ * into (chain, number) pairs, chain ' ' matching every chain
+*/
+std::vector<std::pair<char, int>> parseResidues(const std::string &);
+/* residueBox(atoms, residues, padding):
+ *
+ * Returns box around the atoms of the given residues
+*/
+DockingBox residueBox(const std::vector<PocketAtom> &,
+                      const std::vector<std::pair<char, int>> &, float);
+/* writeConf(file, box):
+ *
+ * Writes box as Vina config file
+*/
+void writeConf(const std::string &, const DockingBox &);
+/* readConf(file):
+ *
+ * Returns box of a Vina config file (points 0)
+*/
+DockingBox readConf(const std::string &);
+
+#endif  // SRC_POCKET_POCKET_H_
@@ -1,6 +1,12 @@
 /* Copyright 2019 iGEM Team Freiburg 2019 */
 #include "PoolManager.h"
 
+// Seconds on a monotonic clock, also usable without MPI
+static double wallTime() {
+  return std::chrono::duration<double>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void PoolMGR::preparePDBQT(std::string ligand) {
   info->infoMsg("(POOLMGR) Preparing PDBQT of ligand: " + ligand);
   // Generate a PDBQT
@@ -23,43 +29,22 @@ void PoolMGR::preparePDBQT(std::string ligand) {
 
 std::string PoolMGR::PDBtoFASTA(std::string filename) {
   info->infoMsg("(POOLMGR) Getting FASTA from PDB: " + filename);
-  std::ifstream file(filename);
-  if (!file.is_open()) {
+  try {
+    return sequence(readPDB(filename));
+  } catch (PDBException & e) {
     throw PoolManagerException(
-          "Could not open PDB file to convert to FASTA sequence",
-          filename);
+          "Could not read PDB file to convert to FASTA sequence\n"
+          + std::string(e.what()), filename);
   }
-  std::unordered_map<std::string, std::string> AA({
-    {"ALA", "A"}, {"ARG", "R"}, {"ASN", "N"}, {"ASP", "D"}, {"CYS", "C"},
-    {"GLU", "E"}, {"GLN", "Q"}, {"GLY", "G"}, {"HIS", "H"}, {"ILE", "I"},
-    {"LEU", "L"}, {"LYS", "K"}, {"MET", "M"}, {"PHE", "F"}, {"PRO", "P"},
-    {"SER", "S"}, {"THR", "T"}, {"TRP", "W"}, {"TYR", "Y"}, {"VAL", "V"}
-  });
-
-  std::string FASTA;
-  std::string line;
-  int previd = -1;
-  while (getline(file, line)) {
-    if (line.substr(0, 4) == "ATOM" || line.substr(0, 6) == "HETATM") {
-      std::string aa = line.substr(17, 3);
-      int id = stoi(line.substr(22, 4));
-      if (id != previd) {
-        FASTA.append(AA[aa]);
-      }
-      previd = id;
-    }
-  }
-  return FASTA;
 }
 
-std::vector<unsigned int> distributeJobs(int * threads, int world_size) {
-  // threads ~ number of avail threads per worker_i, i in (1, world_size - 1)
-  // Simple approach: every computer gets as many as threads as possible
-  std::vector<unsigned int> jobDistr;
-  for (int j = 0; j < world_size - 1; j++) {
-    jobDistr.push_back(threads[j]);
-  }
-  return jobDistr;
+// FASTA sequence from path workDir/FASTA/file
+static std::string fastaFromPath(const std::string & path) {
+  size_t lastSlash = path.find_last_of("/");
+  std::string prePath = path.substr(0, lastSlash);
+  size_t secondToLastSlash = prePath.find_last_of("/");
+  return prePath.substr(secondToLastSlash + 1,
+                        prePath.size() - secondToLastSlash);
 }
 
 std::vector<std::string> PoolMGR::getFASTAS(std::vector<std::string> &files) {
@@ -75,126 +60,453 @@ std::vector<std::string> PoolMGR::addElementsFromFiles(std::vector<std::string>
                                                        int world_size) {
   info->infoMsg("Total number of affinities to be calculated: "
                  + std::to_string(files.size()));
-  int kArrSize = world_size - 1;
-  // Do MD and get docking results from PoolWorker
-  int threadsPerWorker[kArrSize];
-  // Get the number of available threads for each worker to distribute
-  // accordingly
-  unsigned int allThreads = 0;
-  for (int i = 1; i < world_size; i++) {
-    unsigned int availThreads = 0;
-    MPI_Recv(&availThreads, 1, MPI_INT, i,
-             SENDNMTHREADS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-    threadsPerWorker[i - 1] = availThreads;
-    allThreads += availThreads;
-  }
-  info->infoMsg("Total number of available threads: "
-                + std::to_string(allThreads));
-  jobDistribution = distributeJobs(threadsPerWorker, world_size);
-  std::vector<std::vector<std::string>> buckets;
-  unsigned int vecPos = 0;
-  for (int i = 0; i < world_size - 1; i++) {
-    std::vector<std::string> bucket;
-
-    for (unsigned int j = 0; j < jobDistribution.at(i); j++) {
-      if (vecPos < files.size()) {
-        bucket.push_back(files.at(vecPos++));
-      } else {
-        break;
-      }
+  // Workers report their number of threads once, after startup
+  if (!workersRegistered) {
+    unsigned int allThreads = (localCore != NULL) ? localCore->threads() : 0;
+    for (int i = 1; i < world_size; i++) {
+      unsigned int availThreads = 0;
+      MPI_Recv(&availThreads, 1, MPI_INT, i,
+               SENDNMTHREADS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      scheduler.addWorker(i, availThreads);
+      allThreads += availThreads;
     }
-    buckets.push_back(bucket);
+    workersRegistered = true;
+    info->infoMsg("Total number of available threads: "
+                  + std::to_string(allThreads));
+  }
+  // Workers were not listened to while the master was breeding
+  for (auto rank : scheduler.aliveWorkers()) {
+    lastSeen[rank] = wallTime();
+  }
+  // Queue jobs, longest expected first
+  generationBound = dockingBound();
+  std::vector<std::string> returnVal;
+  unsigned int dockOnly = 0;
+  for (auto file : files) {
+    std::string fasta = fastaFromPath(file);
+    std::vector<float> known = knownAffinities(fasta);
+    unsigned int missing = std::count_if(known.begin(), known.end(),
+                                         [](float a) {return std::isnan(a);});
+    if (missing == 0) {
+      // Docked against every receptor in an earlier run
+      setAffinities(fasta, known);
+      returnVal.push_back(fasta);
+      continue;
+    }
+    Job job;
+    job.id = nextJobId++;
+    job.file = file;
+    job.length = fasta.size();
+    if (missing < known.size()) {job.known = known;}
+    job.dockOnly = std::ifstream(workDir + "/" + fasta
+                                 + "/topcluster.pdbqt").good();
+    dockOnly += job.dockOnly ? 1 : 0;
+    // By sequence, not job id, so it does not depend on what ran before
+    job.seed = (seed != 0) ? deriveSeed(seed, fasta) : 0;
+    job.cost = costModel.predict(job.length, missing, !job.dockOnly);
+    scheduler.push(job);
+  }
+  if (!returnVal.empty() || dockOnly > 0) {
+    info->infoMsg("Scores known for " + std::to_string(returnVal.size())
+                  + " ligands, " + std::to_string(dockOnly)
+                  + " only need docking");
   }
-  // Send buckets to subprocesses
+  // Hand out jobs whenever a worker has a free slot, collect the results
   info->infoMsg("Master is sending his work...");
-  MPI_Request requests[kArrSize];
-  unsigned int bucketSizes[kArrSize];
-  char * bucketBin[kArrSize];
-  // Send size in bytes
-  for (int i = 1; i < world_size; i++) {
-    bucketBin[i - 1] = serialize(buckets.at(i - 1), &bucketSizes[i - 1]);
-    MPI_Isend(&bucketSizes[i - 1], 1, MPI_INT, i,
-              SENDFILESSIZE, MPI_COMM_WORLD, &requests[i - 1]);
+  double start = wallTime();
+  std::vector<JobResult> results;
+  bool hookCalled = false;
+  while (scheduler.pending() > 0) {
+    Job job;
+    int rank;
+    while (scheduler.dispatch(job, rank, wallTime())) {
+      if (job.attempt > 0) {
+        info->infoMsg("Job " + std::to_string(job.id) + " (" + job.file
+                      + "), starting copy #" + std::to_string(job.attempt)
+                      + " on Worker #" + std::to_string(rank));
+      }
+      if (rank == 0) {
+        localCore->submit(job, generationBound);
+        continue;
+      }
+      std::vector<std::pair<std::string, std::vector<float>>> packed =
+                                              packJob(job, generationBound);
+      unsigned int jobSize;
+      char * jobBin = serialize(packed, &jobSize);
+      int error = MPI_Send(&jobBin[0], jobSize, MPI_BYTE, peerOf(rank),
+                           SENDJOB, commOf(rank));
+      delete[] jobBin;
+      if (error != MPI_SUCCESS) {workerFailed(rank);}
+    }
+    // Only the last jobs are running, the master is free until they finish
+    if (idleHook && !hookCalled && scheduler.queued() == 0) {
+      hookCalled = true;
+      idleHook();
+    }
+    // Poll, stragglers and failed workers are only noticed while waiting
+    receiveHeartbeats(world_size);
+    detectFailures();
+    spawnWorkers();
+    retireWorkers();
+    if (scheduler.aliveWorkers().empty()) {
+      throw PoolManagerException("All workers failed, can not continue",
+                                 workDir);
+    }
+    bool received = false;
+    if (localCore != NULL) {
+      for (auto & result : localCore->collect()) {
+        handleResult(result, 0, results);
+        received = true;
+      }
+    }
+    int source;
+    MPI_Status status;
+    if (probe(SENDRESULT, world_size, source, status)) {
+      int resultSize;
+      MPI_Get_count(&status, MPI_BYTE, &resultSize);
+      char * resultBin = new char[resultSize];
+      MPI_Recv(&resultBin[0], resultSize, MPI_BYTE, status.MPI_SOURCE,
+               SENDRESULT, commOf(source), MPI_STATUS_IGNORE);
+      std::vector<std::pair<std::string, std::vector<float>>> packed;
+      deserialize(packed, resultBin, resultSize);
+      delete[] resultBin;
+      // Late message of a worker declared failed, its jobs run elsewhere
+      if (lastSeen.count(source) != 0) {
+        lastSeen[source] = wallTime();
+        handleResult(unpackResult(packed), source, results);
+      }
+      received = true;
+    }
+    if (!received) {
+      usleep(50000);
+    }
   }
-  MPI_Waitall(world_size - 1, requests, MPI_STATUS_IGNORE);
-  // Send binary data
-  for (int i = 1; i < world_size; i++) {
-    MPI_Isend(&bucketBin[i - 1][0], bucketSizes[i - 1], MPI_BYTE, i,
-              SENDFILESCONT, MPI_COMM_WORLD, &requests[i - 1]);
+  if (jobTimes.is_open()) {jobTimes.flush();}
+  info->infoMsg("Master got all results, makespan "
+                + std::to_string(wallTime() - start) + " s");
+  if (scoreFile.is_open()) {scoreFile.flush();}
+  // Return FASTA sequences of added results, in the order they were given
+  // rather than the order they finished in
+  std::sort(results.begin(), results.end(),
+            [](const JobResult & a, const JobResult & b) {
+              return a.id < b.id;
+            });
+  for (auto & result : results) {
+    returnVal.push_back(fastaFromPath(result.file));
   }
-  MPI_Waitall(world_size - 1, requests, MPI_STATUS_IGNORE);
-  // Free memory
-  for (int i = 1; i < world_size; i++) {
-    free(bucketBin[i - 1]);
+  return returnVal;
+}
+
+void PoolMGR::handleResult(const JobResult & result, int rank,
+                           std::vector<JobResult> & results) {
+  Completion completion = scheduler.complete(result.id, rank, wallTime(),
+                                              result.affinities.empty());
+  // Keep whichever copy finished first, kill the others
+  for (auto other : completion.cancel) {
+    info->infoMsg("Cancelling job " + std::to_string(result.id)
+                  + " on Worker #" + std::to_string(other));
+    if (other == 0) {
+      localCore->cancel(result.id);
+    } else if (MPI_Send(&result.id, 1, MPI_UNSIGNED, peerOf(other), CANCEL,
+                        commOf(other)) != MPI_SUCCESS) {
+      workerFailed(other);
+    }
   }
-  // Get results of each bucket
-  std::vector<std::vector<std::pair<std::string, float>>> bucketResults;
-  info->infoMsg("Master waiting for all results...");
-  // Get filesize from each
-  unsigned int resSize[world_size - 1];
-  for (int i = 1; i < world_size; i++) {
-    MPI_Irecv(&resSize[i - 1], 1, MPI_INT, i,
-              SENDAFFINSIZE, MPI_COMM_WORLD, &requests[i - 1]);
+  if (!completion.first) {return;}
+  Job done = completion.job;
+  costModel.addSample(done.length, result);
+  if (jobTimes.is_open()) {
+    jobTimes << result.id << "\t" << fastaFromPath(result.file) << "\t"
+             << rank << "\t" << done.cost << "\t"
+             << result.atoms << "\t" << result.mdSeconds << "\t"
+             << result.dockSeconds << "\n";
   }
-  MPI_Waitall(world_size - 1, requests, MPI_STATUS_IGNORE);
-  info->infoMsg("Master got all filesizes");
-  // Get contents from each
-  char * resBin[world_size - 1];
-  for (int i = 1; i < world_size; i++) {
-    resBin[i - 1] = new char[resSize[i - 1]];
-    MPI_Irecv(&resBin[i - 1][0], resSize[i - 1], MPI_BYTE, i, SENDAFFINCONT,
-              MPI_COMM_WORLD, &requests[i - 1]);
+  std::cout << "Master got result from Worker #" << rank
+            << ": " << result.file << ":";
+  for (auto aff : result.affinities) {
+    std::cout << " " << aff;
   }
-  MPI_Waitall(world_size - 1, requests, MPI_STATUS_IGNORE);
-  info->infoMsg("Master got all binary data");
-  // Deserialize binary messages
-  for (int i = 1; i < world_size; i++) {
-    std::vector<std::pair<std::string, float>> results;
-    deserialize(results, resBin[i - 1], resSize[i - 1]);
-    bucketResults.push_back(results);
-    free(resBin[i - 1]);
+  std::cout << std::endl;
+  if (!result.affinities.empty()) {
+    // In the map right away, e.g. for breeding ahead while others still run
+    // Merged with the affinities known before, which were not docked again
+    std::string fasta = fastaFromPath(result.file);
+    storeScores(fasta, result.affinities, result.rescored);
+    setAffinities(fasta, knownAffinities(fasta));
+    results.push_back(result);
   }
-  info->infoMsg("Master deserialized everything");
-  std::cout << "Master got following results:" << std::endl;
-  for (int i = 1; i < world_size; i++) {
-    std::cout << "From Worker #" << i << ":" << std::endl;
-    for (auto j : bucketResults.at(i - 1)) {
-      std::cout << j.first << ": " << j.second << std::endl;
+}
+
+void PoolMGR::loadScores() {
+  std::ifstream in(workDir + "/scores");
+  std::string line;
+  while (std::getline(in, line)) {
+    std::stringstream ss(line);
+    std::string fasta, receptor;
+    float affinity;
+    if (ss >> fasta >> receptor >> affinity) {
+      scores[fasta][receptor] = affinity;
     }
   }
-  // Add the results to map and return FASTA sequences of added results
-  std::vector<std::string> returnVal;
+}
+
+std::vector<float> PoolMGR::knownAffinities(const std::string & FASTASEQ) {
+  std::vector<float> known(nReceptors,
+                           std::numeric_limits<float>::quiet_NaN());
+  auto it = scores.find(FASTASEQ);
+  if (it == scores.end()) {return known;}
+  for (int k = 0; k < nReceptors; k++) {
+    auto score = it->second.find(receptors[k]);
+    if (score != it->second.end()) {known[k] = score->second;}
+  }
+  return known;
+}
+
+void PoolMGR::storeScores(const std::string & FASTASEQ,
+                          const std::vector<float> & affinities,
+                          const std::vector<unsigned int> & rescored) {
+  for (size_t k = 0; k < affinities.size() && k < receptors.size(); k++) {
+    if (std::isnan(affinities[k])) {continue;}
+    scores[FASTASEQ][receptors[k]] = affinities[k];
+    if (scoreFile.is_open()
+        && std::find(rescored.begin(), rescored.end(), k) == rescored.end()) {
+      scoreFile << FASTASEQ << "\t" << receptors[k] << "\t" << affinities[k]
+                << "\n";
+    }
+  }
+}
+
+void PoolMGR::setAffinities(const std::string & FASTASEQ,
+                            const std::vector<float> & affinities) {
+  float aff = aggregate(affinities, aggregation, kT, weights);
+  // Docking stopped early: the receptors docked alone may aggregate below
+  // the elite cut (mean, boltzmann), keep the optimistic value it was
+  // ruled out with instead
+  if (cannotMakeCut(affinities, generationBound, aggregation, kT)) {
+    aff = aggregate(optimisticAffinities(affinities, generationBound),
+                    aggregation, kT, generationBound.weights);
+  }
+  if (std::isnan(aff)) { aff = 10.0f; }
+  std::get<2>(internalMap[FASTASEQ]) = aff;
+  std::get<4>(internalMap[FASTASEQ]) = affinities;
+}
+
+void PoolMGR::setLocalCore(WorkerCore * core) {
+  localCore = core;
+  if (localCore != NULL) {
+    scheduler.addWorker(0, localCore->threads());
+  }
+}
+
+void PoolMGR::setSpeculation(float factor) {
+  scheduler.setSpeculation(factor);
+}
+
+void PoolMGR::shutdownWorkers(int world_size) {
   for (int i = 1; i < world_size; i++) {
-    for (unsigned int j = 0; j < bucketResults.at(i - 1).size(); j++) {
-      std::string path = bucketResults.at(i - 1).at(j).first;
-      size_t lastSlash = path.find_last_of("/");
-      std::string prePath = path.substr(0, lastSlash);
-      size_t secondToLastSlash = prePath.find_last_of("/");
-      std::string fasta = prePath.substr(secondToLastSlash + 1,
-                                         prePath.size() - secondToLastSlash);
-      returnVal.push_back(fasta);
-      float aff = bucketResults.at(i - 1).at(j).second;
-      std::get<2>(internalMap[fasta]) = aff;
+    if (workersRegistered && lastSeen.count(i) == 0) {
+      // Declared failed, but possibly only slow and still waiting for
+      // messages. Told as well, without waiting for a rank that may be gone
+      MPI_Request request;
+      if (MPI_Isend(NULL, 0, MPI_BYTE, i, SHUTDOWN, MPI_COMM_WORLD, &request)
+          == MPI_SUCCESS) {
+        MPI_Request_free(&request);
+      }
+      continue;
     }
+    MPI_Send(NULL, 0, MPI_BYTE, i, SHUTDOWN, MPI_COMM_WORLD);
+  }
+  while (!spawned.empty()) {
+    disconnect(spawned.begin()->first);
+  }
+  while (!joining.empty()) {
+    disconnect(joining.begin()->first);
   }
-  return returnVal;
 }
 
-std::vector<std::string> PoolMGR::addElementsFromPDBs(std::vector<std::string>
-                                                      &files,
-                                                      int world_size) {
+void PoolMGR::setElastic(const std::string & binary, unsigned int maxSpawn1,
+                         float backlog, float retireIdle1, int world_size) {
+  workerBinary = binary;
+  maxSpawn = maxSpawn1;
+  spawnBacklog = backlog;
+  retireIdle = retireIdle1;
+  nextSpawnRank = world_size;
+}
+
+MPI_Comm PoolMGR::commOf(int rank) {
+  if (spawned.count(rank) != 0) {return spawned[rank];}
+  if (joining.count(rank) != 0) {return joining[rank];}
+  return MPI_COMM_WORLD;
+}
+
+int PoolMGR::peerOf(int rank) {
+  // The remote group of a spawned worker's intercommunicator is only it
+  if (spawned.count(rank) != 0 || joining.count(rank) != 0) {return 0;}
+  return rank;
+}
+
+bool PoolMGR::probe(int tag, int world_size, int & rank,
+                    MPI_Status & status) {
+  int flag = 0;
+  if (world_size > 1
+      && MPI_Iprobe(MPI_ANY_SOURCE, tag, MPI_COMM_WORLD, &flag,
+                    &status) == MPI_SUCCESS && flag) {
+    rank = status.MPI_SOURCE;
+    return true;
+  }
+  for (auto & s : spawned) {
+    if (MPI_Iprobe(0, tag, s.second, &flag, &status) == MPI_SUCCESS
+        && flag) {
+      rank = s.first;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PoolMGR::spawnWorkers() {
+  // Joining workers send their number of threads once they are ready
+  for (auto it = joining.begin(); it != joining.end();) {
+    int flag = 0;
+    MPI_Iprobe(0, SENDNMTHREADS, it->second, &flag, MPI_STATUS_IGNORE);
+    if (!flag) {
+      ++it;
+      continue;
+    }
+    unsigned int availThreads = 0;
+    MPI_Recv(&availThreads, 1, MPI_INT, 0, SENDNMTHREADS, it->second,
+             MPI_STATUS_IGNORE);
+    scheduler.addWorker(it->first, availThreads);
+    lastSeen[it->first] = wallTime();
+    spawned[it->first] = it->second;
+    info->infoMsg("Spawned Worker #" + std::to_string(it->first)
+                  + " joined with " + std::to_string(availThreads)
+                  + " threads");
+    it = joining.erase(it);
+  }
+  // One at a time, the backlog is checked again once it has joined
+  if (!joining.empty() || spawned.size() >= maxSpawn) {return;}
+  if (scheduler.queued() <= spawnBacklog * scheduler.slots()) {return;}
+  MPI_Comm comm;
+  int error;
+  if (MPI_Comm_spawn(workerBinary.c_str(), MPI_ARGV_NULL, 1, MPI_INFO_NULL, 0,
+                     MPI_COMM_SELF, &comm, &error) != MPI_SUCCESS
+      || error != MPI_SUCCESS) {
+    info->errorMsg("Could not spawn " + workerBinary + ", continuing with "
+                   "the current workers", false);
+    maxSpawn = 0;
+    return;
+  }
+  MPI_Comm_set_errhandler(comm, MPI_ERRORS_RETURN);
+  int rank = nextSpawnRank++;
+  joining[rank] = comm;
+  unsigned int size;
+  char * bin = serialize(receptors, &size);
+  MPI_Send(&bin[0], size, MPI_BYTE, 0, SENDRECEPTORS, comm);
+  delete[] bin;
+  info->infoMsg("Spawned Worker #" + std::to_string(rank) + ", "
+                + std::to_string(scheduler.queued()) + " jobs queued for "
+                + std::to_string(scheduler.slots()) + " threads");
+}
+
+void PoolMGR::retireWorkers() {
+  // Idle since the last job, also across generations (breeding)
+  double now = wallTime();
+  std::vector<int> retire;
+  for (auto & s : spawned) {
+    if (scheduler.runningOn(s.first) > 0) {
+      idleSince.erase(s.first);
+    } else if (idleSince.count(s.first) == 0) {
+      idleSince[s.first] = now;
+    } else if (scheduler.queued() == 0
+               && now - idleSince[s.first] > retireIdle
+               && scheduler.retireWorker(s.first)) {
+      retire.push_back(s.first);
+    }
+  }
+  for (auto rank : retire) {
+    info->infoMsg("Retiring idle spawned Worker #" + std::to_string(rank));
+    disconnect(rank);
+  }
+}
+
+void PoolMGR::disconnect(int rank) {
+  MPI_Comm comm = commOf(rank);
+  MPI_Send(NULL, 0, MPI_BYTE, 0, SHUTDOWN, comm);
+  // Drop heartbeats still on their way
+  int flag;
+  while (MPI_Iprobe(0, HEARTBEAT, comm, &flag, MPI_STATUS_IGNORE)
+         == MPI_SUCCESS && flag) {
+    MPI_Recv(NULL, 0, MPI_BYTE, 0, HEARTBEAT, comm, MPI_STATUS_IGNORE);
+  }
+  MPI_Comm_disconnect(&comm);
+  spawned.erase(rank);
+  joining.erase(rank);
+  lastSeen.erase(rank);
+  idleSince.erase(rank);
+}
+
+void PoolMGR::setWorkerTimeout(float seconds) {
+  workerTimeout = seconds;
+  // Errors in communication with a failed worker must not abort the master
+  MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+}
+
+void PoolMGR::receiveHeartbeats(int world_size) {
+  int rank;
+  MPI_Status status;
+  while (probe(HEARTBEAT, world_size, rank, status)) {
+    MPI_Recv(NULL, 0, MPI_BYTE, status.MPI_SOURCE, HEARTBEAT, commOf(rank),
+             MPI_STATUS_IGNORE);
+    if (lastSeen.count(rank) != 0) {
+      lastSeen[rank] = wallTime();
+    }
+  }
+}
+
+void PoolMGR::detectFailures() {
+  if (workerTimeout <= 0) {return;}
+  double now = wallTime();
+  for (auto rank : scheduler.aliveWorkers()) {
+    // The master's own threads do not send heartbeats
+    if (rank != 0 && now - lastSeen[rank] > workerTimeout) {
+      workerFailed(rank);
+    }
+  }
+}
+
+void PoolMGR::workerFailed(int rank) {
+  if (lastSeen.count(rank) == 0) {return;}
+  lastSeen.erase(rank);
+  // A dead spawned worker can not take part in a disconnect, its
+  // intercommunicator is just abandoned
+  spawned.erase(rank);
+  idleSince.erase(rank);
+  unsigned int requeued = scheduler.failWorker(rank);
+  info->errorMsg("Worker #" + std::to_string(rank) + " failed, re-queued "
+                 + std::to_string(requeued) + " jobs, "
+                 + std::to_string(scheduler.aliveWorkers().size())
+                 + " workers left", false);
+}
+
+std::vector<std::string> PoolMGR::addElementsFromPDBs(
+                                  std::vector<std::string> &files,
+                                  int world_size,
+                                  const std::vector<std::string> & sequences) {
   // Prepare internal map and directory structure
   std::vector<std::string> newFiles;
-  for (auto file : files) {
+  for (size_t i = 0; i < files.size(); i++) {
+    std::string file = files[i];
     // Get FASTA sequence
-    std::string FASTASEQ = PDBtoFASTA(file);
+    std::string FASTASEQ = (i < sequences.size()) ? sequences[i]
+                                                  : PDBtoFASTA(file);
     // If error in FASTA generation or already in pool, continue
     if (FASTASEQ.empty() || internalMap.count(FASTASEQ) != 0) {continue;}
     internalMap[FASTASEQ] = std::make_tuple(workDir + "/" + FASTASEQ + "/" +
                                             FASTASEQ + ".pdb",
                                             workDir + "/" + FASTASEQ + "/" +
                                             FASTASEQ + ".pdb",
-                                            10.0f, 0);
+                                            10.0f, 0, std::vector<float>());
     // Make required directory
     std::string command = "mkdir -p ";
     command.append(workDir);
@@ -230,19 +542,87 @@ std::vector<std::string> PoolMGR::addElementsFromPDBs(std::vector<std::string>
 std::vector<std::string> PoolMGR::addElementsFromFASTAs(
                                     std::vector<std::string> &fastas,
                                     int world_size) {
-  // Prepare files
+  // Prepare files, generated in parallel unless prefetched already
   info->infoMsg("Fastas: " + std::to_string(fastas.size()));
+  pdbPool->wait();
   std::vector<std::string> newFiles;
+  unsigned int reused = 0;
   for (auto i : fastas) {
-    if (internalMap.count(i) == 0) {
-      internalMap[i] = std::make_tuple("", "", 10.0f, 0);
-      genPDB(i);
-      newFiles.push_back(std::get<1>(internalMap[i]));
+    if (internalMap.count(i) != 0) {continue;}
+    std::string pdb = workDir + "/" + i + "/" + i + ".pdb";
+    internalMap[i] = std::make_tuple(pdb, pdb, 10.0f, 0,
+                                     std::vector<float>());
+    newFiles.push_back(pdb);
+    if (prefetched.erase(i) != 0 && std::ifstream(pdb).good()) {
+      reused++;
+      continue;
+    }
+    // No structure needed if there is only docking left, or nothing at all
+    std::vector<float> known = knownAffinities(i);
+    if (std::none_of(known.begin(), known.end(),
+                     [](float a) {return std::isnan(a);})
+        || std::ifstream(workDir + "/" + i + "/topcluster.pdbqt").good()) {
+      continue;
     }
+    pdbPool->submit([this, i]() {
+      try {
+        genPDB(i);
+      } catch (std::exception & e) {
+        std::unique_lock<std::mutex> lock(pdbMutex);
+        pdbFailures.push_back(i);
+      }
+    });
+  }
+  pdbPool->wait();
+  if (reused > 0) {
+    info->infoMsg("Reused " + std::to_string(reused) + " prefetched PDBs");
+  }
+  // Speculative structures of sequences not bred after all, the directory
+  // did not exist before and goes again if nothing else was put there
+  for (auto & i : prefetched) {
+    std::remove((workDir + "/" + i + "/" + i + ".pdb").c_str());
+    rmdir((workDir + "/" + i).c_str());
+  }
+  prefetched.clear();
+  if (!pdbFailures.empty()) {
+    std::string failed = pdbFailures.front();
+    pdbFailures.clear();
+    throw PoolManagerException("Could not create PDB file", failed);
   }
   return addElementsFromFiles(newFiles, world_size);
 }
 
+void PoolMGR::setPDBThreads(unsigned int threads) {
+  pdbPool->wait();
+  pdbPool.reset(new ThreadPool((threads > 0) ? threads : 1));
+}
+
+void PoolMGR::setIdleHook(std::function<void()> hook) {
+  idleHook = hook;
+}
+
+void PoolMGR::prefetch(const std::vector<std::string> & fastas) {
+  for (auto i : fastas) {
+    if (internalMap.count(i) != 0 || prefetched.count(i) != 0) {continue;}
+    // Sequences of earlier runs keep what they have, also no structure if
+    // there is only docking left or nothing at all
+    struct stat st;
+    if (stat((workDir + "/" + i).c_str(), &st) == 0) {continue;}
+    std::vector<float> known = knownAffinities(i);
+    if (std::none_of(known.begin(), known.end(),
+                     [](float a) {return std::isnan(a);})) {
+      continue;
+    }
+    prefetched.insert(i);
+    // Failures show up again when the sequence is really added
+    pdbPool->submit([this, i]() {
+      try {
+        genPDB(i);
+      } catch (std::exception & e) {}
+    });
+  }
+}
+
 std::string PoolMGR::toStr() {
   std::string returnStr;
   returnStr.append("[");
@@ -262,6 +642,82 @@ float PoolMGR::getAffinity(std::string FASTASEQ) {
   return std::get<2>(internalMap.at(FASTASEQ));
 }
 
+std::vector<float> PoolMGR::getAffinities(std::string FASTASEQ) {
+  return std::get<4>(internalMap.at(FASTASEQ));
+}
+
+void PoolMGR::setAggregation(AggregationType aggregation1, float kT1,
+                             const std::vector<float> & weights1) {
+  aggregation = aggregation1;
+  kT = kT1;
+  weights = weights1;
+}
+
+void PoolMGR::setBound(float bound1, float abortMargin1) {
+  bound = bound1;
+  abortMargin = abortMargin1;
+}
+
+void PoolMGR::setCutoff(float cutoff1) {
+  cutoff = cutoff1;
+}
+
+void PoolMGR::setSeed(unsigned int seed1) {
+  seed = seed1;
+}
+
+DockingBound PoolMGR::dockingBound() {
+  DockingBound b;
+  b.bound = bound;
+  b.cutoff = cutoff;
+  b.weights = weights;
+  std::vector<float> sd(nReceptors, 0.0f);
+  for (int k = 0; k < nReceptors; k++) {
+    b.order.push_back(k);
+  }
+  if (std::isinf(bound)) {return b;}
+  b.floors.assign(nReceptors, std::numeric_limits<float>::quiet_NaN());
+  for (int k = 0; k < nReceptors; k++) {
+    double sum = 0.0, sumsq = 0.0;
+    unsigned int n = 0;
+    for (auto it = internalMap.begin(); it != internalMap.end(); it++) {
+      std::vector<float> & affs = std::get<4>(it->second);
+      if (affs.size() != static_cast<size_t>(nReceptors)
+          || std::isnan(affs.at(k))) {continue;}
+      float a = affs.at(k);
+      sum += a; sumsq += a * a; n++;
+      if (std::isnan(b.floors.at(k)) || a - abortMargin < b.floors.at(k)) {
+        b.floors.at(k) = a - abortMargin;
+      }
+    }
+    if (n > 1) {
+      double var = (sumsq - sum * sum / n) / (n - 1);
+      sd.at(k) = (var > 0.0) ? std::sqrt(var) : 0.0;
+    }
+  }
+  std::stable_sort(b.order.begin(), b.order.end(),
+                   [&sd](unsigned int i, unsigned int j) {
+                     return sd[i] > sd[j];});
+  return b;
+}
+
+int PoolMGR::getNumReceptors() {
+  return nReceptors;
+}
+
+void PoolMGR::sendReceptors(int world_size) {
+  unsigned int size;
+  char * bin = serialize(receptors, &size);
+  for (int i = 1; i < world_size; i++) {
+    MPI_Send(&bin[0], size, MPI_BYTE, i, SENDRECEPTORS, MPI_COMM_WORLD);
+  }
+  delete[] bin;
+}
+
+bool PoolMGR::contains(const std::string & FASTASEQ) {
+  return internalMap.count(FASTASEQ) != 0;
+}
+
 void PoolMGR::genPDB(std::string FASTASEQ) {
   // Create directory
   std::string command = "mkdir -p ";
@@ -269,7 +725,7 @@ void PoolMGR::genPDB(std::string FASTASEQ) {
   command.append("/");
   command.append(FASTASEQ);
   command.append(" 2>/dev/null 1>&2");
-  int success = system(command.c_str());
+  int success = runCommand(command);
   if (success != 0) {
     throw PoolManagerException("Could not create directory for PDB file",
                                FASTASEQ);
@@ -290,16 +746,10 @@ void PoolMGR::genPDB(std::string FASTASEQ) {
   command.append(FASTASEQ);
   command.append(".pdb\"");
   command.append(" >/dev/null 2>&1");
-  success = system(command.c_str());
+  success = runCommand(command);
   if (success != 0) {
     throw PoolManagerException("Could not create PDB file", FASTASEQ);
   }
-  // Add path to map
-  std::get<0>(internalMap[FASTASEQ]) =
-                          workDir + "/" + FASTASEQ + "/" + FASTASEQ + ".pdb";
-  // This will later be overwritten with MD'ed file
-  std::get<1>(internalMap[FASTASEQ]) =
-                          workDir + "/" + FASTASEQ + "/" + FASTASEQ + ".pdb";
 }
 
 
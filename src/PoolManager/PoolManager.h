@@ -5,6 +5,12 @@
  * Manages the gene pool, i.e. all FASTA sequences, their PDB files
  * and their MD as well as docking results.
  *
+ * Docking scores are kept per (sequence, receptor) in workDir/scores across
+ * runs, apart from the MD results in workDir/FASTA. A sequence docked
+ * against every receptor before is not evaluated again, one whose MD is
+ * done (topcluster.pdbqt) is only docked against the receptors missing,
+ * e.g. after adding a receptor.
+ *
  * Can automatically delete unused files after certain number of generations
  * of non-usage.
 */
@@ -12,16 +18,33 @@
 #define SRC_POOLMANAGER_POOLMANAGER_H_
 #include <mpi.h>
 #include <math.h>
+#include <unistd.h>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
 #include <tuple>
 #include <vector>
 #include <exception>
 #include <string>
 #include <utility>
+#include <algorithm>
+#include <limits>
 #include "../VinaInstance/VinaInstance.h"
 #include "../GMXInstance/GMXInstance.h"
 #include "../Serialization/Serialization.h"
+#include "../Aggregation/Aggregation.h"
+#include "../Scheduler/Scheduler.h"
+#include "../PDB/PDB.h"
+#include "../ThreadPool/ThreadPool.h"
+#include "../Seed/Seed.h"
+#include "WorkerCore.h"
 #include "../Communication.h"
 class PoolManagerException : virtual public std::exception {
  public:
@@ -87,6 +110,34 @@ class PoolMGR {
       clustercutoff = clustercutoff1;
       info = info1;
       pymolgen = pymolgen1;
+      aggregation = AGGMIN;
+      kT = 0.593;
+      bound = std::numeric_limits<float>::infinity();
+      cutoff = std::numeric_limits<float>::infinity();
+      abortMargin = 1.0;
+      seed = 0;
+      nextJobId = 0;
+      workerTimeout = 0.0;
+      workersRegistered = false;
+      localCore = NULL;
+      maxSpawn = 0;
+      spawnBacklog = 0.0;
+      retireIdle = 0.0;
+      nextSpawnRank = 0;
+      pdbPool.reset(new ThreadPool(1));
+      if (!workDir.empty()) {
+        jobTimes.open(workDir + "/jobtimes", std::ios::out | std::ios::app);
+        if (jobTimes.tellp() == 0) {
+          jobTimes << "job\tfasta\tworker\tpredicted\tatoms\tmd\tdock\n";
+        }
+        loadScores();
+        scoreFile.open(workDir + "/scores", std::ios::out | std::ios::app);
+      }
+    }
+
+    ~PoolMGR() {
+      if (jobTimes.is_open()) {jobTimes.close();}
+      if (scoreFile.is_open()) {scoreFile.close();}
     }
 
     /* addElementPDB(path):
@@ -109,6 +160,111 @@ class PoolMGR {
      * Returns the calculated affinity
     */
     float getAffinity(std::string);
+    /* getAffinities(FASTA):
+     *
+     * Returns the affinity to each receptor, in order of the receptors
+     * passed to the constructor
+    */
+    std::vector<float> getAffinities(std::string);
+    /* setAggregation(type, kT, weights):
+     *
+     * Sets how the affinities to each receptor are combined into one,
+     * kT (kcal/mol) is used for Boltzmann weighting. weights: one per
+     * receptor (sent to the workers with the bound), empty: all equal
+    */
+    void setAggregation(AggregationType, float,
+                        const std::vector<float> & = std::vector<float>());
+    /* setBound(bound, margin):
+     *
+     * Sets the aggregated affinity required to make the elite cut for the
+     * next evaluations, workers stop docking a ligand as soon as it can not
+     * reach it anymore. Receptors are expected to give affinities at least
+     * margin above the best seen so far. Infinity disables early abort.
+    */
+    void setBound(float, float);
+    /* setCutoff(cutoff):
+     *
+     * Sets the aggregated affinity of the elite cut, used by workers to
+     * decide whether a rescored pose is good enough (see WorkerCore).
+     * Infinity: unknown
+    */
+    void setCutoff(float);
+    /* setSeed(seed):
+     *
+     * Sets the campaign seed, every job gets a seed derived from it and its
+     * sequence. 0 (default): the tools pick their own
+    */
+    void setSeed(unsigned int);
+    /* getNumReceptors():
+     *
+     * Returns the number of receptors docked against
+    */
+    int getNumReceptors();
+    /* sendReceptors(world_size):
+     *
+     * Sends the receptor list to all workers, which dock against them in
+     * this order
+    */
+    void sendReceptors(int);
+    /* setLocalCore(core):
+     *
+     * Lets the master run jobs on its own threads too, pulled from the same
+     * queue as the remote workers (as rank 0). core has to outlive the
+     * manager's use of it.
+    */
+    void setLocalCore(WorkerCore *);
+    /* setSpeculation(factor):
+     *
+     * Starts backup copies of jobs running longer than factor times the
+     * median job duration once workers are idle, 0 disables it
+    */
+    void setSpeculation(float);
+    /* setWorkerTimeout(seconds):
+     *
+     * Workers not heard from (heartbeat or result) for this long are
+     * considered failed and their jobs are re-queued, 0 disables it
+    */
+    void setWorkerTimeout(float);
+    /* setElastic(binary, maxSpawn, backlog, retireIdle, world_size):
+     *
+     * Lets the master spawn up to maxSpawn extra workers running binary
+     * while more than backlog jobs per slot are queued, and retire spawned
+     * workers idle for retireIdle seconds. maxSpawn 0 disables it.
+    */
+    void setElastic(const std::string &, unsigned int, float, float, int);
+    /* shutdownWorkers(world_size):
+     *
+     * Tells all workers to finish, spawned ones are disconnected. Workers
+     * declared failed are told too (non-blocking), they may only be slow
+    */
+    void shutdownWorkers(int);
+    /* setPDBThreads(threads):
+     *
+     * Number of threads generating the PDBs of new sequences
+    */
+    void setPDBThreads(unsigned int);
+    /* setIdleHook(hook):
+     *
+     * hook is called once per evaluation as soon as every job has been
+     * dispatched and only the last ones are still running, e.g. to breed
+     * the likely next generation and prefetch it. Results are in the
+     * manager as soon as they arrive. Empty function disables it.
+    */
+    void setIdleHook(std::function<void()>);
+    /* prefetch(FASTAs):
+     *
+     * Generates the PDBs of sequences likely to be added next in the
+     * background, without adding them. Sequences with a directory in
+     * workDir already or known scores only are skipped. PDBs not added with
+     * the next addElementsFromFASTAs are deleted again.
+    */
+    void prefetch(const std::vector<std::string> &);
+    /* contains(FASTA):
+     *
+     * Returns true if sequence is already in the gene pool, i.e. has been
+     * or is being evaluated
+    */
+    bool contains(const std::string &);
     /* update(vector of FASTAs):
      *
      * Updates number of rounds unused for internal gene pool
@@ -138,17 +294,19 @@ class PoolMGR {
     /* addElementsFromFASTAs(FASTAs, world_size):
      *
      * Adds elements to the pool from FASTA sequences, distributing amongst
-     * nodes according to available threads
+     * nodes according to available threads and expected cost
     */
     std::vector<std::string> addElementsFromFASTAs(std::vector<std::string>&,
                                                    int);
-    /* addElementsFromPDBs(PDB paths, world_size):
+    /* addElementsFromPDBs(PDB paths, world_size, sequences):
      *
      * Adds elements to the pool from PDB file paths, distributing amongst
-     * nodes according to available threads
+     * nodes according to available threads and expected cost. Sequences of
+     * the files, if known already, save parsing them
     */
-    std::vector<std::string> addElementsFromPDBs(std::vector<std::string>&,
-                                                 int);
+    std::vector<std::string> addElementsFromPDBs(
+                          std::vector<std::string>&, int,
+                          const std::vector<std::string> & = {});
     /* getFASTAS(PDB paths):
      *
      * Collect FASTA sequences for given PDB file path vector
@@ -159,7 +317,6 @@ class PoolMGR {
     int exhaustiveness;
     int energy_range;
     std::vector<std::string> receptors;
-    std::vector<unsigned int> jobDistribution;
     int nReceptors;
     std::string workDir;
     std::string vinaPath;
@@ -176,16 +333,144 @@ class PoolMGR {
     std::string boundingboxtype;
     float boxsize;
     float clustercutoff;
+    // FASTA -> (PDB, MD'ed PDB, best affinity, rounds unused,
+    //           affinity per receptor)
     std::unordered_map<std::string,
                        std::tuple<std::string,
                                   std::string,
                                   float,
-                                  int> > internalMap;
+                                  int,
+                                  std::vector<float>> > internalMap;
     bool pymolgen;
+    AggregationType aggregation;
+    float kT;
+    std::vector<float> weights;
+    float bound;
+    float cutoff;
+    float abortMargin;
+    // Bound the jobs of the current addElementsFromFiles() were sent with
+    DockingBound generationBound;
+    unsigned int seed;
+    Scheduler scheduler;
+    CostModel costModel;
+    unsigned int nextJobId;
+    float workerTimeout;
+    bool workersRegistered;
+    WorkerCore * localCore;
+    // Last time each worker not declared failed was heard from
+    std::unordered_map<int, double> lastSeen;
+    // Spawned workers (ranks from world_size on) and their
+    // intercommunicators, joining ones have not reported their threads yet
+    std::string workerBinary;
+    unsigned int maxSpawn;
+    float spawnBacklog;
+    float retireIdle;
+    int nextSpawnRank;
+    std::map<int, MPI_Comm> spawned;
+    std::map<int, MPI_Comm> joining;
+    std::unordered_map<int, double> idleSince;
+    std::function<void()> idleHook;
+    // Sequences whose PDB is generated speculatively, and sequences whose
+    // PDB could not be generated
+    std::unordered_set<std::string> prefetched;
+    std::vector<std::string> pdbFailures;
+    std::mutex pdbMutex;
+    // Last, so its threads are joined before anything they use is gone
+    std::unique_ptr<ThreadPool> pdbPool;
+    // Timings of every job, for the cost model
+    std::ofstream jobTimes;
+    // FASTA -> receptor -> affinity of every docking so far, this and
+    // earlier runs
+    std::unordered_map<std::string,
+                       std::unordered_map<std::string, float>> scores;
+    std::ofstream scoreFile;
+
+    /* loadScores():
+     *
+     * Reads workDir/scores, lines "FASTA receptor affinity"
+    */
+    void loadScores();
+    /* knownAffinities(FASTA):
+     *
+     * Returns score for each receptor, NaN if not docked yet
+    */
+    std::vector<float> knownAffinities(const std::string &);
+    /* storeScores(FASTA, affinities, rescored):
+     *
+     * Adds the affinities docked (not NaN) to scores and workDir/scores.
+     * Those of the rescored receptors are estimates for this run only and
+     * not written, a later run docks them
+    */
+    void storeScores(const std::string &, const std::vector<float> &,
+                     const std::vector<unsigned int> &);
+    /* setAffinities(FASTA, affinities):
+     *
+     * Sets affinity per receptor and aggregated affinity of FASTA. If
+     * docking was stopped early (see cannotMakeCut), the aggregate with the
+     * receptors not docked at their floors
+    */
+    void setAffinities(const std::string &, const std::vector<float> &);
 
+    /* dockingBound():
+     *
+     * Returns bound to broadcast: receptors ordered by their standard
+     * deviation over all results (most discriminative first), floors
+     * being the best affinity seen per receptor minus abortMargin
+    */
+    DockingBound dockingBound();
+    /* handleResult(result, rank, results):
+     *
+     * Books result of a job copy run by rank, cancels the other copies and
+     * adds it to results if it is the one to use
+    */
+    void handleResult(const JobResult &, int, std::vector<JobResult> &);
+    /* receiveHeartbeats(world_size):
+     *
+     * Receives all pending heartbeats of the workers
+    */
+    void receiveHeartbeats(int);
+    /* commOf(rank) / peerOf(rank):
+     *
+     * Communicator and rank in it to reach worker rank
+    */
+    MPI_Comm commOf(int);
+    int peerOf(int);
+    /* probe(tag, world_size, rank, status):
+     *
+     * Checks for a message with tag from any worker, fills its rank
+    */
+    bool probe(int, int, int &, MPI_Status &);
+    /* spawnWorkers():
+     *
+     * Registers spawned workers which reported their threads and spawns
+     * another one if the backlog is too long
+    */
+    void spawnWorkers();
+    /* retireWorkers():
+     *
+     * Shuts down spawned workers idle for too long
+    */
+    void retireWorkers();
+    /* disconnect(rank):
+     *
+     * Tells spawned worker to finish and disconnects from it
+    */
+    void disconnect(int);
+    /* detectFailures():
+     *
+     * Declares workers failed which have not been heard from for too long
+    */
+    void detectFailures();
+    /* workerFailed(rank):
+     *
+     * Stops using worker and re-queues its jobs
+    */
+    void workerFailed(int);
     /* genPDB(FASTA):
      *
-     * Generates a PDB in alpha helical structure using pymol fab
+     * Generates a PDB in alpha helical structure using pymol fab, in the
+     * directory of FASTA. Does not touch the internal map, so it can run
+     * on the PDB threads
     */
     void genPDB(std::string);
     /* genMD(FASTA):
@@ -211,7 +496,9 @@ class PoolMGR {
     /* addElementsFromFiles(File paths, world_size):
      *
      * Used by addElementsFromPDBs and addElementsFromFASTAs to distribute
-     * docking and MD to computing nodes and collect the results
+     * docking and MD to computing nodes and collect the results. One job
+     * per file, dispatched by the scheduler longest expected first whenever
+     * a worker has a free thread
      *
     */
     std::vector<std::string> addElementsFromFiles(std::vector<std::string>&,
@@ -1,8 +1,9 @@
 /* Copyright 2019 iGEM Team Freiburg 2019
  *
- * Receives vector of FILES to perform Docking and MD on,
- * using OpenMP calculates affinities on available threads, returns
- * vector of <file, affinity> pairs
+ * Receives jobs (one ligand file each) to perform MD and Docking on,
+ * calculates affinities on a pool of as many threads as OpenMP reports
+ * available (see WorkerCore), sends back affinity per receptor and timings
+ * of every job as soon as it is done.
 */
 #ifndef SRC_POOLMANAGER_POOLWORKER_H_
 #define SRC_POOLMANAGER_POOLWORKER_H_
@@ -11,30 +12,16 @@
 #include <vector>
 #include <string>
 #include <utility>
+#include <chrono>
+#include <thread>
 #include "PoolManager.h"
+#include "WorkerCore.h"
 #include "../Serialization/Serialization.h"
-#include "../GMXInstance/GMXInstance.h"
 #include "../Communication.h"
 #include "../inih/INIReader.h"
-#include "../VinaInstance/VinaInstance.h"
-std::string pymolPath;
-std::string gromacsPath;
-std::string forcefield;
-std::string forcefieldPath;
-std::string water;
-std::string boundingboxtype;
-std::string mdpPath;
-std::string vinaPath;
-std::string pythonShPath;
-std::string mgltoolstilitiesPath;
-std::vector<std::string> receptors;
-
-float boxsize;
-float clustercutoff;
-int exhaustiveness;
-int energy_range;
-
+#include "../ReceptorPrep/ReceptorPrep.h"
 Info * info;
+
 int world_size, world_rank;
 
 #endif  //  SRC_POOLMANAGER_POOLWORKER_H_
@@ -0,0 +1,440 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "WorkerCore.h"
+
+PipelineSettings readPipelineSettings(INIReader & reader) {
+  PipelineSettings settings;
+  settings.pymolPath = reader.Get("finDrGA", "pymol", "pymol");
+  settings.pythonShPath = reader.Get("finDrGA", "pythonsh", "pythonsh");
+  settings.mgltoolstilitiesPath = reader.Get("finDrGA", "MGLToolsUtilities",
+                                             "");
+  settings.gromacsPath = reader.Get("GROMACS", "gromacs", "gmx");
+  settings.forcefield = reader.Get("GROMACS", "forcefield", "");
+  settings.forcefieldPath = reader.Get("GROMACS", "forcefieldpath", "");
+  settings.water = reader.Get("GROMACS", "water", "");
+  settings.boundingboxtype = reader.Get("GROMACS", "bt", "");
+  settings.boxsize = reader.GetReal("GROMACS", "boxsize", 1.0);
+  settings.clustercutoff = reader.GetReal("GROMACS", "clustercutoff", 0.12);
+  settings.mdpPath = reader.Get("GROMACS", "settings", "");
+  settings.mdChunks = reader.GetInteger("GROMACS", "mdchunks", 1);
+  settings.rmsdTolerance = reader.GetReal("GROMACS", "rmsdtolerance", 0.02);
+  settings.boxCache = reader.Get("GROMACS", "boxcache", "");
+  settings.exhaustiveness = reader.GetInteger("VINA", "exhaustiveness", 1);
+  settings.energy_range = reader.GetInteger("VINA", "energy_range", 5);
+  settings.vinaPath = reader.Get("VINA", "vina", "vina");
+  settings.aggregation = aggregationFromString(reader.Get("VINA",
+                                                          "aggregation",
+                                                          "min"));
+  settings.kT = reader.GetReal("VINA", "boltzmannkt", 0.593);
+  settings.rescore = reader.Get("VINA", "rescore", "none");
+  if (settings.rescore != "none" && settings.rescore != "score"
+      && settings.rescore != "local") {
+    throw VinaException("Unknown rescore mode \"" + settings.rescore
+                        + "\", use none, score or local", "config.ini");
+  }
+  settings.rescoreMargin = reader.GetReal("VINA", "rescoremargin", 1.0);
+  settings.ioThreads = reader.GetInteger("finDrGA", "iothreads", -1);
+  // One limit for all stages unless set per stage
+  float timeout = reader.GetReal("finDrGA", "stagetimeout", 0.0);
+  setStageTimeout(timeout);
+  setStageTimeout(STAGESETUP, reader.GetReal("finDrGA", "stagetimeout_setup",
+                                             timeout));
+  setStageTimeout(STAGEMD, reader.GetReal("finDrGA", "stagetimeout_md",
+                                          timeout));
+  setStageTimeout(STAGEANALYSIS, reader.GetReal("finDrGA",
+                                                "stagetimeout_analysis",
+                                                timeout));
+  setStageTimeout(STAGEDOCK, reader.GetReal("finDrGA", "stagetimeout_dock",
+                                            timeout));
+  return settings;
+}
+
+static std::string stripDir(std::string str) {
+  size_t pos = str.find_last_of("/");
+  return str.substr(0, pos);
+}
+
+void WorkerCore::preparePDBQT(std::string ligand) {
+  info->infoMsg("(POOLMGR) Preparing PDBQT of ligand: " + ligand);
+  // Generate a PDBQT
+  std::string command;
+  command.append(settings.pythonShPath);
+  command.append(" ");
+  command.append(settings.mgltoolstilitiesPath);
+  command.append("/prepare_ligand4.py -l ");
+  command.append(ligand);
+  command.append(" -Z -A bonds_hydrogens -U nphs -o ");
+  command.append(ligand);
+  command.append("qt >/dev/null");
+  int success = runCommand(command, NULL, STAGEANALYSIS);
+  if (success != 0) {
+    throw VinaException("Could not generate pdbqt file for ligand",
+                        ligand,
+                        "PQT");
+  }
+}
+
+void WorkerCore::prepareLigand(std::string file) {
+  std::string fileCluster = stripDir(file) + "/topcluster.pdb";
+  // std::string fileCluster = stripDir(file) + "/em.pdb";
+  preparePDBQT(fileCluster);
+}
+
+float WorkerCore::dockReceptor(std::string file, unsigned int receptor,
+                               unsigned int seed) {
+  std::string fileCluster = stripDir(file) + "/topcluster.pdb";
+  VinaInstance vinaInstance(settings.vinaPath.c_str(),
+                            receptors.at(receptor).c_str(),
+                            fileCluster.c_str(),
+                            info);
+  // By receptor name, the same whichever receptors are docked against
+  std::string name = receptors.at(receptor);
+  name = name.substr(name.find_last_of("/") + 1);
+  if (seed != 0) {vinaInstance.setSeed(deriveSeed(seed, name));}
+  return vinaInstance.calculateBindingAffinity(settings.exhaustiveness,
+                                               settings.energy_range);
+}
+
+bool WorkerCore::rescoreReceptor(std::shared_ptr<LigandDocking> ligand,
+                                 unsigned int receptor, float & affinity) {
+  if (settings.rescore != "score" && settings.rescore != "local") {
+    return false;
+  }
+  std::string fileCluster = stripDir(ligand->file) + "/topcluster.pdb";
+  // Best pose so far, from this job or an earlier run
+  std::string pose;
+  float cutoff;
+  {
+    std::unique_lock<std::mutex> lock(ligand->mtx);
+    cutoff = ligand->bound.cutoff;
+    float best = std::numeric_limits<float>::infinity();
+    for (unsigned int k = 0; k < ligand->affinities.size(); k++) {
+      float a = ligand->affinities[k];
+      if (k == receptor || std::isnan(a) || a >= best) {continue;}
+      std::string file = VinaInstance(settings.vinaPath.c_str(),
+                                      receptors.at(k).c_str(),
+                                      fileCluster.c_str(), info).poseFile();
+      if (!std::ifstream(file)) {continue;}
+      pose = file;
+      best = a;
+    }
+  }
+  // Without a cutoff there is no telling whether the pose is good enough
+  if (pose.empty() || std::isinf(cutoff)) {return false;}
+  VinaInstance vinaInstance(settings.vinaPath.c_str(),
+                            receptors.at(receptor).c_str(),
+                            fileCluster.c_str(),
+                            info);
+  float rescored;
+  try {
+    rescored = vinaInstance.rescore(pose, settings.rescore == "local");
+  } catch (VinaException & e) {
+    info->errorMsg("Rescoring " + pose + " failed, docking instead", false);
+    return false;
+  }
+  if (std::fabs(rescored - cutoff) <= settings.rescoreMargin) {
+    info->infoMsg("(VINA) Rescored " + std::to_string(rescored)
+                  + " too close to the cutoff, docking " + ligand->file);
+    return false;
+  }
+  affinity = rescored;
+  return true;
+}
+
+void WorkerCore::dockTask(std::shared_ptr<LigandDocking> ligand,
+                          unsigned int receptor) {
+  setCurrentJob(ligand->id);
+  bool skip;
+  {
+    std::unique_lock<std::mutex> lock(ligand->mtx);
+    skip = ligand->failed || ligand->stopped;
+  }
+  if (!skip) {
+    try {
+      auto start = std::chrono::steady_clock::now();
+      float recaffinity;
+      bool rescored = rescoreReceptor(ligand, receptor, recaffinity);
+      if (!rescored) {
+        recaffinity = dockReceptor(ligand->file, receptor, ligand->seed);
+      }
+      std::chrono::duration<float> took = std::chrono::steady_clock::now()
+                                          - start;
+      std::unique_lock<std::mutex> lock(ligand->mtx);
+      ligand->affinities.at(receptor) = recaffinity;
+      if (rescored) {ligand->rescored.push_back(receptor);}
+      ligand->docked++;
+      ligand->dockSeconds += took.count();
+      // Stop docking once the ligand can not make the elite cut anymore
+      if (!ligand->stopped && ligand->docked < receptors.size()
+          && cannotMakeCut(ligand->affinities, ligand->bound,
+                           settings.aggregation, settings.kT)) {
+        ligand->stopped = true;
+        info->infoMsg("Docking of " + ligand->file + " stopped after "
+                      + std::to_string(ligand->docked) + " of "
+                      + std::to_string(receptors.size())
+                      + " receptors, can not make the cut");
+      }
+    } catch (...) {
+      info->errorMsg("Docking for " + ligand->file + " against "
+                     + receptors.at(receptor) + " failed, skipping...", false);
+      std::unique_lock<std::mutex> lock(ligand->mtx);
+      ligand->failed = true;
+    }
+  }
+  submitDeferred(ligand);
+  // Last task of this ligand reduces the result
+  bool last;
+  {
+    std::unique_lock<std::mutex> lock(ligand->mtx);
+    last = (--ligand->remaining == 0);
+  }
+  if (last) {
+    finished(*ligand);
+  }
+}
+
+GMXInstance WorkerCore::gmxInstance(std::string file, unsigned int seed) {
+  GMXInstance gmx(file.c_str(),
+                  settings.gromacsPath.c_str(),
+                  settings.pymolPath.c_str(),
+                  stripDir(file).c_str(),
+                  settings.forcefield.c_str(),
+                  settings.forcefieldPath.c_str(),
+                  settings.water.c_str(),
+                  settings.boundingboxtype.c_str(),
+                  settings.clustercutoff,
+                  settings.boxsize,
+                  settings.mdpPath.c_str(),
+                  info);
+  gmx.setAdaptiveMD(settings.mdChunks, settings.rmsdTolerance);
+  gmx.setBoxCache(settings.boxCache);
+  gmx.setSeed(seed);
+  return gmx;
+}
+
+void WorkerCore::genEM(std::string file) {
+  gmxInstance(file, 0).energyMinim();
+}
+
+// Copies the regular files of directory from whose name starts with
+// prefix into directory to
+static void copyFiles(const std::string & from, const std::string & to,
+                      const std::string & prefix = "") {
+  DIR * d = opendir(from.c_str());
+  if (d == NULL) {return;}
+  while (struct dirent * entry = readdir(d)) {
+    std::string name = from + "/" + entry->d_name;
+    struct stat st;
+    if (std::string(entry->d_name).compare(0, prefix.size(), prefix) != 0
+        || stat(name.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    std::ifstream src(name, std::ios::binary);
+    std::ofstream dst(to + "/" + entry->d_name,
+                      std::ios::binary | std::ios::trunc);
+    dst << src.rdbuf();
+  }
+  closedir(d);
+}
+
+void WorkerCore::prepareBackup(std::string jobFile,
+                               std::string file) {
+  // Backup copies run in their own directory next to the original one.
+  // It starts with everything the original got done (manifests, outputs,
+  // checkpoints), so GMXInstance skips finished steps and resumes mdrun.
+  std::string from = stripDir(jobFile);
+  std::string to = stripDir(file);
+  mkdir(to.c_str(), 0777);
+  mkdir((to + "/manifests").c_str(), 0777);
+  copyFiles(from, to);
+  copyFiles(from + "/manifests", to + "/manifests");
+  if (!std::ifstream(file)) {
+    throw VinaException("Could not copy ligand for backup", jobFile, "BAK");
+  }
+}
+
+void WorkerCore::runStage(std::shared_ptr<LigandDocking> ligand,
+                          ThreadPool & pool, bool first,
+                          std::function<void()> work,
+                          std::function<void()> next) {
+  pool.submit([this, ligand, work, next]() {
+    setCurrentJob(ligand->id);
+    try {
+      auto start = std::chrono::steady_clock::now();
+      work();
+      std::chrono::duration<float> took = std::chrono::steady_clock::now()
+                                          - start;
+      ligand->mdSeconds += took.count();
+    } catch (...) {
+      info->errorMsg("MD for " + ligand->file + " failed, skipping...",
+                     false);
+      ligand->failed = true;
+      finished(*ligand);
+      return;
+    }
+    next();
+  }, first);
+}
+
+void WorkerCore::setupStage(std::shared_ptr<LigandDocking> ligand) {
+  runStage(ligand, ioPool, false, [this, ligand]() {
+    if (ligand->file != ligand->jobFile) {
+      prepareBackup(ligand->jobFile, ligand->file);
+    }
+    gmxInstance(ligand->file, ligand->seed).buildSystem();
+  }, [this, ligand]() { mdStage(ligand); });
+}
+
+void WorkerCore::mdStage(std::shared_ptr<LigandDocking> ligand) {
+  runStage(ligand, cpuPool, false, [this, ligand]() {
+    GMXInstance gmx = gmxInstance(ligand->file, ligand->seed);
+    gmx.equilibrate();
+    gmx.simulate();
+    ligand->atoms = gmx.atomCount();
+  }, [this, ligand]() { analysisStage(ligand); });
+}
+
+void WorkerCore::analysisStage(std::shared_ptr<LigandDocking> ligand) {
+  runStage(ligand, ioPool, true, [this, ligand]() {
+    GMXInstance gmx = gmxInstance(ligand->file, ligand->seed);
+    gmx.processTrajectory();
+    gmx.clusterMD();
+    gmx.extractTopCluster();
+    prepareLigand(ligand->file);
+  }, [this, ligand]() { dockStage(ligand); });
+}
+
+void WorkerCore::dockStage(std::shared_ptr<LigandDocking> ligand) {
+  ligand->affinities.assign(receptors.size(),
+                            std::numeric_limits<float>::quiet_NaN());
+  // Known affinities count for early abort, only the others are docked
+  std::vector<unsigned int> order;
+  for (auto receptor : ligand->bound.order) {
+    if (receptor < ligand->known.size()
+        && !std::isnan(ligand->known[receptor])) {
+      ligand->affinities.at(receptor) = ligand->known[receptor];
+      ligand->docked++;
+    } else {
+      order.push_back(receptor);
+    }
+  }
+  ligand->remaining = order.size();
+  if (ligand->remaining == 0) {
+    finished(*ligand);
+    return;
+  }
+  if ((settings.rescore == "score" || settings.rescore == "local")
+      && ligand->docked == 0) {
+    ligand->deferred.assign(order.begin() + 1, order.end());
+    order.resize(1);
+  }
+  // Each goes in front of the queue, reversed to keep the bound's order
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    unsigned int receptor = *it;
+    cpuPool.submit([this, ligand, receptor]() {
+      dockTask(ligand, receptor);
+    }, true);
+  }
+}
+
+void WorkerCore::submitDeferred(std::shared_ptr<LigandDocking> ligand) {
+  std::vector<unsigned int> deferred;
+  {
+    std::unique_lock<std::mutex> lock(ligand->mtx);
+    deferred.swap(ligand->deferred);
+  }
+  for (auto it = deferred.rbegin(); it != deferred.rend(); ++it) {
+    unsigned int receptor = *it;
+    cpuPool.submit([this, ligand, receptor]() {
+      dockTask(ligand, receptor);
+    }, true);
+  }
+}
+
+void WorkerCore::finished(LigandDocking & ligand) {
+  JobResult result;
+  result.id = ligand.id;
+  result.file = ligand.jobFile;
+  if (!ligand.failed && ligand.file != ligand.jobFile) {
+    // A backup copy that made it, its cluster and poses go where the
+    // master (and later runs) look for them
+    copyFiles(stripDir(ligand.file), stripDir(ligand.jobFile), "topcluster.");
+  }
+  if (!ligand.failed) {
+    // Only what was docked here, the master has the rest
+    result.affinities = ligand.affinities;
+    for (unsigned int i = 0; i < ligand.known.size()
+                             && i < result.affinities.size(); i++) {
+      if (!std::isnan(ligand.known[i])) {
+        result.affinities[i] = std::numeric_limits<float>::quiet_NaN();
+      }
+    }
+    result.rescored = ligand.rescored;
+  }
+  result.mdSeconds = ligand.mdSeconds;
+  result.dockSeconds = ligand.dockSeconds;
+  result.atoms = ligand.atoms;
+  std::unique_lock<std::mutex> lock(outboxMutex);
+  outbox.push_back(result);
+  // Handled, the id may come again (e.g. as a backup copy)
+  activeIds.erase(activeIds.find(ligand.id));
+  if (activeIds.count(ligand.id) == 0) {forgetJob(ligand.id);}
+  if (--active == 0) {
+    idle.notify_all();
+  }
+}
+
+void WorkerCore::submit(const Job & job, const DockingBound & bound) {
+  std::shared_ptr<LigandDocking> ligand(new LigandDocking);
+  ligand->id = job.id;
+  ligand->jobFile = job.file;
+  ligand->file = job.file;
+  ligand->bound = bound;
+  ligand->known = job.known;
+  ligand->seed = job.seed;
+  if (job.attempt > 0) {
+    ligand->file = stripDir(job.file) + "/backup"
+                   + std::to_string(job.attempt)
+                   + job.file.substr(job.file.find_last_of("/"));
+  }
+  {
+    std::unique_lock<std::mutex> lock(outboxMutex);
+    active++;
+    activeIds.insert(job.id);
+  }
+  if (!job.dockOnly) {
+    setupStage(ligand);
+  } else if (ligand->file != ligand->jobFile) {
+    runStage(ligand, ioPool, false, [this, ligand]() {
+      prepareBackup(ligand->jobFile, ligand->file);
+    }, [this, ligand]() { dockStage(ligand); });
+  } else {
+    dockStage(ligand);
+  }
+}
+
+void WorkerCore::cancel(unsigned int id) {
+  // Under the lock, so the job can not finish (and forget it) in between
+  std::unique_lock<std::mutex> lock(outboxMutex);
+  if (activeIds.count(id) == 0) {return;}
+  cancelJob(id);
+}
+
+std::vector<JobResult> WorkerCore::collect() {
+  std::vector<JobResult> done;
+  std::unique_lock<std::mutex> lock(outboxMutex);
+  done.swap(outbox);
+  return done;
+}
+
+unsigned int WorkerCore::threads() {
+  return cpuPool.size() + ioPool.size();
+}
+
+void WorkerCore::wait() {
+  {
+    std::unique_lock<std::mutex> lock(outboxMutex);
+    idle.wait(lock, [this]() { return active == 0; });
+  }
+  cpuPool.wait();
+  ioPool.wait();
+}
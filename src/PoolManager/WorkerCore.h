@@ -0,0 +1,230 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * WorkerCore
+ *
+ * Ligand pipeline of a worker, each ligand going through stages of
+ * different resource classes:
+ *  1. setup (I/O): pdb2gmx, solvation and ions
+ *  2. MD (CPU): energy minimization, equilibration, mdrun
+ *  3. analysis (I/O): trjconv, cluster, extraction, PDBQT preparation
+ *  4. docking (CPU): one task per receptor, run in parallel
+ * CPU stages run on one thread per core, I/O stages on a few extra threads,
+ * so the short single-threaded tools of one ligand overlap with the mdrun
+ * of others instead of taking their cores. Later stages of started ligands
+ * go before new ones.
+ *
+ * Used by the PoolWorker ranks as well as by the master, which runs jobs on
+ * its own cores too. Communication is left to the caller: jobs go in with
+ * submit(), results come out with collect().
+*/
+#ifndef SRC_POOLMANAGER_WORKERCORE_H_
+#define SRC_POOLMANAGER_WORKERCORE_H_
+#include <sys/stat.h>
+#include <dirent.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <algorithm>
+#include "../ThreadPool/ThreadPool.h"
+#include "../GMXInstance/GMXInstance.h"
+#include "../VinaInstance/VinaInstance.h"
+#include "../Aggregation/Aggregation.h"
+#include "../Scheduler/Scheduler.h"
+#include "../Process/Process.h"
+#include "../inih/INIReader.h"
+#include "../Info.h"
+
+/* Programs and parameters of the pipeline, see config.ini */
+struct PipelineSettings {
+  std::string pymolPath;
+  std::string gromacsPath;
+  std::string forcefield;
+  std::string forcefieldPath;
+  std::string water;
+  std::string boundingboxtype;
+  std::string mdpPath;
+  std::string vinaPath;
+  std::string pythonShPath;
+  std::string mgltoolstilitiesPath;
+  float boxsize;
+  float clustercutoff;
+  int exhaustiveness;
+  int energy_range;
+  AggregationType aggregation;
+  float kT;
+  // Threads for I/O stages, -1: a quarter of the CPU threads, at least 1
+  int ioThreads = -1;
+  // Adaptive MD length, see GMXInstance::setAdaptiveMD
+  unsigned int mdChunks = 1;
+  float rmsdTolerance = 0.0;
+  // Water box templates, see GMXInstance::setBoxCache
+  std::string boxCache;
+  // Poses docked against another receptor rescored first: none, score
+  // (--score_only) or local (--local_only), see WorkerCore::rescoreReceptor
+  std::string rescore = "none";
+  float rescoreMargin = 1.0;
+};
+
+/* readPipelineSettings(reader):
+ *
+ * Reads settings from config.ini, also sets the stage timeout of Process
+*/
+PipelineSettings readPipelineSettings(INIReader &);
+
+// Docking progress of one ligand, shared by its per-receptor tasks
+struct LigandDocking {
+  unsigned int id = 0;
+  // Ligand as sent by the master and the one worked on (differs for backups)
+  std::string jobFile;
+  std::string file;
+  DockingBound bound;
+  // Affinities known beforehand (NaN: to dock, empty: none), see Job
+  std::vector<float> known;
+  std::vector<float> affinities;
+  // Seed of the job, see Seed
+  unsigned int seed = 0;
+  // Receptors docked once the first one is done, its pose seeds rescoring
+  std::vector<unsigned int> deferred;
+  // Receptors whose affinity is a rescored pose, see JobResult
+  std::vector<unsigned int> rescored;
+  unsigned int remaining = 0;
+  unsigned int docked = 0;
+  bool failed = false;
+  bool stopped = false;
+  float mdSeconds = 0.0;
+  float dockSeconds = 0.0;
+  float atoms = 0.0;
+  std::mutex mtx;
+};
+
+class WorkerCore {
+ public:
+    WorkerCore(const PipelineSettings & settings1,
+               std::vector<std::string> receptors1,
+               unsigned int threads1,
+               Info * info1)
+        : cpuPool(threads1),
+          ioPool((settings1.ioThreads >= 0) ? settings1.ioThreads
+                                            : std::max(1u, threads1 / 4)) {
+      settings = settings1;
+      receptors = receptors1;
+      info = info1;
+      active = 0;
+    }
+
+    ~WorkerCore() {
+      wait();
+    }
+
+    /* submit(job, bound):
+     *
+     * Starts MD and docking of job (docking only for dockOnly jobs,
+     * receptors with known affinities skipped), backup copies (attempt > 0)
+     * run in their own directory next to the ligand, starting from what the
+     * original copy got done so far. A backup that succeeds copies its
+     * topcluster.* files (cluster and poses) back to the ligand's directory
+    */
+    void submit(const Job &, const DockingBound &);
+    /* cancel(id):
+     *
+     * Kills all commands of job id, it finishes as failed. Ignored if the
+     * job is not running here (anymore)
+    */
+    void cancel(unsigned int);
+    /* collect():
+     *
+     * Returns results of the jobs finished since the last call
+    */
+    std::vector<JobResult> collect();
+    /* threads():
+     *
+     * Returns number of threads, CPU and I/O, i.e. the number of jobs to
+     * give it at once so that stages of different jobs overlap
+    */
+    unsigned int threads();
+    /* wait():
+     *
+     * Blocks until all submitted jobs are finished
+    */
+    void wait();
+
+ private:
+    PipelineSettings settings;
+    std::vector<std::string> receptors;
+    Info * info;
+    std::vector<JobResult> outbox;
+    // Ligands submitted and not finished yet, and their job ids
+    unsigned int active;
+    std::multiset<unsigned int> activeIds;
+    std::mutex outboxMutex;
+    std::condition_variable idle;
+    // Last members, their threads are joined before the rest is destroyed
+    ThreadPool cpuPool;
+    ThreadPool ioPool;
+
+    void preparePDBQT(std::string);
+    void prepareLigand(std::string);
+    void prepareBackup(std::string, std::string);
+    /* gmxInstance(file, seed) / dockReceptor(file, receptor, seed):
+     *
+     * GROMACS and Vina of a ligand, their seeds derived from the one of its
+     * job (0: unseeded)
+    */
+    GMXInstance gmxInstance(std::string, unsigned int);
+    void genEM(std::string);
+    float dockReceptor(std::string, unsigned int, unsigned int);
+    /* rescoreReceptor(ligand, receptor, affinity):
+     *
+     * Rescores the pose of the ligand against the receptor docked best so
+     * far (settings.rescore), sets affinity and returns true if it is
+     * further than settings.rescoreMargin from the elite cut. Otherwise, or
+     * without pose or cutoff, a full docking is needed
+    */
+    bool rescoreReceptor(std::shared_ptr<LigandDocking>, unsigned int,
+                         float &);
+    /* runStage(ligand, pool, first, work, next):
+     *
+     * Runs work for ligand on pool and calls next afterwards; if work
+     * throws, the ligand is finished as failed. Its run time counts as MD
+     * time of the ligand
+    */
+    void runStage(std::shared_ptr<LigandDocking>, ThreadPool &, bool,
+                  std::function<void()>, std::function<void()>);
+    /* setupStage(ligand) / mdStage(ligand) / analysisStage(ligand):
+     *
+     * Queue stages 1-3 of ligand, each queues the next one when done
+    */
+    void setupStage(std::shared_ptr<LigandDocking>);
+    void mdStage(std::shared_ptr<LigandDocking>);
+    void analysisStage(std::shared_ptr<LigandDocking>);
+    /* dockStage(ligand):
+     *
+     * Queues a docking task per receptor
+    */
+    void dockStage(std::shared_ptr<LigandDocking>);
+    /* submitDeferred(ligand):
+     *
+     * Queues the receptors of ligand held back until one was docked
+    */
+    void submitDeferred(std::shared_ptr<LigandDocking>);
+    /* dockTask(ligand, receptor):
+     *
+     * Docking against one receptor unless the ligand can not make the cut
+     * anymore, last task of a ligand reports its result
+    */
+    void dockTask(std::shared_ptr<LigandDocking>, unsigned int);
+    /* finished(ligand):
+     *
+     * Moves result of ligand into the outbox
+    */
+    void finished(LigandDocking &);
+};
+
+#endif  // SRC_POOLMANAGER_WORKERCORE_H_
@@ -0,0 +1,144 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Process.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+std::mutex registryMutex;
+// Process groups of the running commands per job
+std::unordered_map<unsigned int, std::set<pid_t>> running;
+std::unordered_set<unsigned int> cancelled;
+// By Stage
+float stageTimeouts[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+thread_local unsigned int currentJob = kNoJob;
+
+bool isCancelled(unsigned int job) {
+  std::unique_lock<std::mutex> lock(registryMutex);
+  return job != kNoJob && cancelled.count(job) != 0;
+}
+}  // namespace
+
+void setStageTimeout(float seconds) {
+  for (auto & timeout : stageTimeouts) {timeout = seconds;}
+}
+
+void setStageTimeout(Stage stage, float seconds) {
+  stageTimeouts[stage] = seconds;
+}
+
+void setCurrentJob(unsigned int job) {
+  currentJob = job;
+}
+
+void cancelJob(unsigned int job) {
+  std::unique_lock<std::mutex> lock(registryMutex);
+  cancelled.insert(job);
+  auto it = running.find(job);
+  if (it == running.end()) {return;}
+  for (auto pgid : it->second) {
+    kill(-pgid, SIGKILL);
+  }
+}
+
+void forgetJob(unsigned int job) {
+  std::unique_lock<std::mutex> lock(registryMutex);
+  cancelled.erase(job);
+}
+
+int runCommand(const std::string & command, std::string * output,
+               Stage stage) {
+  unsigned int job = currentJob;
+  float stageTimeout = stageTimeouts[stage];
+  if (isCancelled(job)) {
+    throw ProcessException("Job was cancelled", command);
+  }
+  int fds[2] = {-1, -1};
+  if (output != NULL && pipe2(fds, O_CLOEXEC) != 0) {
+    throw ProcessException("Could not create pipe", command);
+  }
+  const char * cmd = command.c_str();
+  pid_t pid;
+  {
+    // Registered before a concurrent cancelJob can miss it
+    std::unique_lock<std::mutex> lock(registryMutex);
+    pid = fork();
+    if (pid == 0) {
+      // Child: own process group, only async-signal-safe calls
+      setpgid(0, 0);
+      if (fds[1] >= 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+      }
+      execl("/bin/sh", "sh", "-c", cmd, static_cast<char *>(NULL));
+      _exit(127);
+    }
+    if (pid < 0) {
+      if (fds[0] >= 0) {close(fds[0]); close(fds[1]);}
+      throw ProcessException("Could not fork", command);
+    }
+    setpgid(pid, pid);
+    running[job].insert(pid);
+  }
+  if (fds[1] >= 0) {
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  }
+  auto start = std::chrono::steady_clock::now();
+  bool timedOut = false;
+  int status = 0;
+  while (true) {
+    // Wait for output or 50 ms
+    if (fds[0] >= 0) {
+      struct pollfd p = {fds[0], POLLIN, 0};
+      poll(&p, 1, 50);
+      char buff[1024];
+      ssize_t n;
+      while ((n = read(fds[0], buff, sizeof(buff))) > 0) {
+        output->append(buff, n);
+      }
+    } else {
+      usleep(50000);
+    }
+    pid_t done = waitpid(pid, &status, WNOHANG);
+    if (done == pid || done < 0) {break;}
+    std::chrono::duration<float> took = std::chrono::steady_clock::now()
+                                        - start;
+    if (stageTimeout > 0 && took.count() > stageTimeout && !timedOut) {
+      timedOut = true;
+      kill(-pid, SIGKILL);
+    }
+  }
+  if (fds[0] >= 0) {
+    char buff[1024];
+    ssize_t n;
+    while ((n = read(fds[0], buff, sizeof(buff))) > 0) {
+      output->append(buff, n);
+    }
+    close(fds[0]);
+  }
+  {
+    std::unique_lock<std::mutex> lock(registryMutex);
+    running[job].erase(pid);
+    if (running[job].empty()) {running.erase(job);}
+  }
+  if (timedOut) {
+    throw ProcessException("Timed out after " + std::to_string(stageTimeout)
+                           + " s", command);
+  }
+  if (isCancelled(job)) {
+    throw ProcessException("Job was cancelled", command);
+  }
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  return -1;
+}
@@ -0,0 +1,78 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Process
+ *
+ * Runs shell commands (gmx, vina, pythonsh, ...) like system() / popen(),
+ * but in their own process group so they can be killed as a whole:
+ *  - after the timeout of their stage (seconds per command, 0: none), a
+ *    hung pdb2gmx or vina need not get as long as a whole mdrun
+ *  - when the job they belong to is cancelled, e.g. because a backup copy
+ *    of the job finished first
+ *
+ * The job a command belongs to is set per thread with setCurrentJob().
+*/
+#ifndef SRC_PROCESS_PROCESS_H_
+#define SRC_PROCESS_PROCESS_H_
+#include <string>
+#include <exception>
+
+class ProcessException : virtual public std::exception {
+ public:
+    ProcessException(const std::string msg1, const std::string command1) {
+      errorMsg = "Error in Process!\nCommand: " + command1 + "\nMessage: "
+                 + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+/* Stages of the ligand pipeline, each with a time limit of its own:
+ *  STAGESETUP:    pdb2gmx, solvation and ions
+ *  STAGEMD:       energy minimization, equilibration, mdrun
+ *  STAGEANALYSIS: trjconv, cluster, extraction, PDBQT preparation
+ *  STAGEDOCK:     vina
+ *  STAGEOTHER:    everything else
+*/
+enum Stage {STAGEOTHER, STAGESETUP, STAGEMD, STAGEANALYSIS, STAGEDOCK};
+
+/* runCommand(command, output, stage):
+ *
+ * Runs command of stage with /bin/sh, appends its stdout to output if
+ * given. Returns exit status (non-zero on failure), throws
+ * ProcessException if it timed out or its job was cancelled
+*/
+int runCommand(const std::string &, std::string * output = NULL,
+               Stage stage = STAGEOTHER);
+/* setStageTimeout(seconds) / setStageTimeout(stage, seconds):
+ *
+ * Sets time limit of the commands of every stage / of stage run
+ * afterwards, 0 disables it
+*/
+void setStageTimeout(float);
+void setStageTimeout(Stage, float);
+/* setCurrentJob(job):
+ *
+ * Commands run by the calling thread belong to job from now on
+*/
+void setCurrentJob(unsigned int);
+/* cancelJob(job):
+ *
+ * Kills all running commands of job, later commands of it fail right away
+*/
+void cancelJob(unsigned int);
+/* forgetJob(job):
+ *
+ * Drops the cancellation of job once it is handled, its id may be used
+ * again afterwards
+*/
+void forgetJob(unsigned int);
+
+// Commands of threads without a job
+const unsigned int kNoJob = static_cast<unsigned int>(-1);
+
+#endif  // SRC_PROCESS_PROCESS_H_
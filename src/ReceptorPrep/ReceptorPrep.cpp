@@ -0,0 +1,321 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "ReceptorPrep.h"
+
+// FNV-1a
+static uint64_t fnv1a(const char * data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+ReceptorPrepSettings readReceptorPrepSettings(INIReader & reader) {
+  ReceptorPrepSettings settings;
+  settings.pocket.mode = reader.Get("VINA", "pocket", "none");
+  settings.pocket.residues = reader.Get("VINA", "pocketresidues", "");
+  settings.pocket.maxPockets = reader.GetInteger("VINA", "maxpockets", 1);
+  settings.pocket.padding = reader.GetReal("VINA", "pocketpadding", 8.0);
+  settings.pocket.spacing = reader.GetReal("VINA", "pocketspacing", 1.0);
+  settings.pocket.minPoints = reader.GetInteger("VINA", "pocketminpoints",
+                                                30);
+  settings.pythonShPath = reader.Get("finDrGA", "pythonsh", "pythonsh");
+  settings.mgltoolsPath = reader.Get("finDrGA", "MGLToolsUtilities", "");
+  settings.cacheDir = reader.Get("finDrGA", "workingDir", "")
+                      + "/receptorcache";
+  return settings;
+}
+
+void mImage(const std::string pdb) {
+  // Mirror image: x of every atom inverted in place, the rest of the file
+  // is kept as it is
+  std::string output;
+  {
+    MappedFile receptor(pdb);
+    AtomTable atoms = parsePDB(receptor.data(), receptor.size(), pdb);
+    output.assign(receptor.data(), receptor.size());
+    for (size_t i = 0; i < atoms.size(); i++) {
+      char invertedX[9];  // Null terminating char at the end => 9
+      snprintf(invertedX, sizeof(invertedX), "%8.3f", - atoms.x[i]);
+      output.replace(atoms.offset[i] + 30, 8, invertedX, 8);
+    }
+  }
+
+  std::ofstream outf(pdb, std::ofstream::out | std::ofstream::trunc);
+  outf << output;
+  outf.close();
+}
+
+std::vector<std::string> prepareConfig(std::string receptor,
+                                       const PocketSettings & pocket,
+                                       std::string pocketDir, Info * info) {
+  // Generate conf file(s) for docking, returns the receptor files to dock
+  // against: receptor itself and a link to it per additional pocket
+  std::vector<PocketAtom> atoms = readAtoms(receptor);
+  std::vector<DockingBox> boxes;
+  if (pocket.mode == "grid") {
+    boxes = detectPockets(atoms, pocket.spacing, pocket.maxPockets,
+                          pocket.padding, pocket.minPoints);
+    if (boxes.empty()) {
+      info->errorMsg("No pocket found in " + receptor
+                     + ", docking against the whole receptor", false);
+    }
+  } else if (pocket.mode == "residues") {
+    boxes.push_back(residueBox(atoms, parseResidues(pocket.residues),
+                               pocket.padding));
+  } else if (pocket.mode != "none") {
+    throw PocketException("Unknown pocket mode \"" + pocket.mode
+                          + "\", use none, grid or residues");
+  }
+  if (boxes.empty()) {
+    // Whole receptor with 15 Angstrom on every side
+    boxes.push_back(boundingBox(atoms, 15.0));
+  }
+
+  std::vector<std::string> result;
+  std::string base = receptor.substr(receptor.find_last_of("/") + 1);
+  std::string name = base.substr(0, base.find_last_of("."));
+  // Relative links, so the directory can be moved as a whole
+  std::string target = (receptor.substr(0, receptor.find_last_of("/"))
+                        == pocketDir) ? base : receptor;
+  for (unsigned int i = 0; i < boxes.size(); i++) {
+    std::string file = receptor;
+    if (i > 0) {
+      // Same structure and PDBQT (written by preparePDBQT(receptor)),
+      // only the box differs
+      file = pocketDir + "/" + name + "_pocket" + std::to_string(i) + ".pdb";
+      for (auto suffix : {"", "qt"}) {
+        unlink((file + suffix).c_str());
+        if (symlink((target + suffix).c_str(), (file + suffix).c_str())
+            != 0) {
+          throw PocketException("Could not link " + file + suffix + " to "
+                                + receptor + suffix);
+        }
+      }
+    }
+    writeConf(file + "_conf", boxes.at(i));
+    info->infoMsg("Docking box for " + file + ": "
+                  + std::to_string(boxes.at(i).size[0]) + " x "
+                  + std::to_string(boxes.at(i).size[1]) + " x "
+                  + std::to_string(boxes.at(i).size[2]) + " A");
+    result.push_back(file);
+  }
+  return result;
+}
+
+void preparePDBQT(std::string receptor,
+                  std::string pythonShPath,
+                  std::string mgltoolstilitiesPath) {
+  // Generate a PDBQT
+  std::string command;
+  command.append(pythonShPath);
+  command.append(" ");
+  command.append(mgltoolstilitiesPath);
+  command.append("/prepare_receptor4.py -r ");
+  command.append(receptor);
+  command.append(" -A bonds_hydrogens -U nphs -o ");
+  command.append(receptor);
+  command.append("qt");
+  int success = runCommand(command);
+  if (success != 0) {
+    throw VinaException("Could not generate pdbqt file for receptor", receptor);
+  }
+}
+
+std::string receptorKey(const std::string & receptor,
+                        const ReceptorPrepSettings & settings) {
+  MappedFile file(receptor);
+  uint64_t hash = fnv1a(file.data(), file.size(), 14695981039346656037ULL);
+  // Everything changing the prepared files, paths of the tools do not
+  std::stringstream used;
+  used << settings.mirror << " " << settings.pocket.mode << " "
+       << settings.pocket.residues << " " << settings.pocket.maxPockets << " "
+       << settings.pocket.padding << " " << settings.pocket.spacing << " "
+       << settings.pocket.minPoints;
+  std::string s = used.str();
+  hash = fnv1a(s.data(), s.size(), hash);
+  std::stringstream key;
+  key << std::hex << hash;
+  return key.str();
+}
+
+// Files to dock against of a complete cache entry, false if there is none
+static bool cachedFiles(const std::string & dir,
+                        std::vector<std::string> & files) {
+  files.clear();
+  std::ifstream list(dir + "/files");
+  std::string name;
+  struct stat st;
+  while (list >> name) {
+    std::string file = dir + "/" + name;
+    for (auto suffix : {"", "qt", "_conf"}) {
+      if (stat((file + suffix).c_str(), &st) != 0) {return false;}
+    }
+    files.push_back(file);
+  }
+  return !files.empty();
+}
+
+// Cache entry of receptor
+static std::string cacheEntry(const std::string & receptor,
+                              const ReceptorPrepSettings & settings) {
+  std::string name = receptor.substr(receptor.find_last_of("/") + 1);
+  name = name.substr(0, name.find_last_of("."));
+  return settings.cacheDir + "/" + name + "_" + receptorKey(receptor,
+                                                            settings);
+}
+
+std::vector<std::string> prepareReceptor(const std::string & receptor,
+                                         const ReceptorPrepSettings & settings,
+                                         Info * info) {
+  std::string dir = cacheEntry(receptor, settings);
+  std::vector<std::string> files;
+  if (cachedFiles(dir, files)) {return files;}
+  info->infoMsg("Preparing receptor " + receptor);
+  // Prepared aside and renamed when complete, an interrupted preparation
+  // is never taken for a cached one
+  mkdir(settings.cacheDir.c_str(), 0777);
+  std::string name = dir.substr(settings.cacheDir.size() + 1);
+  name = name.substr(0, name.find_last_of("_"));
+  std::stringstream tmp;
+  tmp << dir << ".tmp" << getpid() << "."
+      << std::hash<std::thread::id>()(std::this_thread::get_id());
+  runCommand("rm -rf " + tmp.str());
+  if (mkdir(tmp.str().c_str(), 0777) != 0) {
+    throw ReceptorPrepException("Could not create " + tmp.str());
+  }
+  try {
+    std::string copy = tmp.str() + "/" + name + ".pdb";
+    if (runCommand("cp " + receptor + " " + copy) != 0) {
+      throw ReceptorPrepException("Could not copy " + receptor);
+    }
+    if (settings.mirror) {
+      mImage(copy);
+    }
+    // One PDBQT, the pockets link to it
+    std::ofstream list(tmp.str() + "/files");
+    for (auto file : prepareConfig(copy, settings.pocket, tmp.str(), info)) {
+      list << file.substr(tmp.str().size() + 1) << "\n";
+    }
+    preparePDBQT(copy, settings.pythonShPath, settings.mgltoolsPath);
+  } catch (...) {
+    runCommand("rm -rf " + tmp.str());
+    throw;
+  }
+  if (std::rename(tmp.str().c_str(), dir.c_str()) != 0) {
+    // Same receptor prepared by someone else in the meantime
+    runCommand("rm -rf " + tmp.str());
+  }
+  if (!cachedFiles(dir, files)) {
+    throw ReceptorPrepException("Could not cache " + receptor + " in "
+                                + dir);
+  }
+  return files;
+}
+
+// Prepares receptors on threads threads, returns error messages
+static std::vector<std::string> prepareShare(
+                                  const std::vector<std::string> & receptors,
+                                  const ReceptorPrepSettings & settings,
+                                  unsigned int threads, Info * info) {
+  std::vector<std::string> errors;
+  if (receptors.empty()) {return errors;}
+  std::mutex mtx;
+  ThreadPool pool(std::max(1u, std::min<unsigned int>(threads,
+                                                      receptors.size())));
+  for (auto & receptor : receptors) {
+    pool.submit([&, receptor]() {
+      try {
+        prepareReceptor(receptor, settings, info);
+      } catch (std::exception & e) {
+        std::unique_lock<std::mutex> lock(mtx);
+        errors.push_back(receptor + ": " + e.what());
+      }
+    });
+  }
+  pool.wait();
+  return errors;
+}
+
+std::vector<std::string> prepareReceptors(
+                                  const std::vector<std::string> & receptors,
+                                  ReceptorPrepSettings settings,
+                                  unsigned int threads, int world_size,
+                                  Info * info) {
+  // Receptors not cached, round robin over this rank (share 0) and workers
+  std::vector<std::vector<std::string>> shares(std::max(world_size, 1));
+  unsigned int pending = 0;
+  for (auto & receptor : receptors) {
+    std::vector<std::string> files;
+    if (cachedFiles(cacheEntry(receptor, settings), files)) {continue;}
+    shares[pending++ % shares.size()].push_back(receptor);
+  }
+  info->infoMsg("Preparing " + std::to_string(pending) + " of "
+                + std::to_string(receptors.size()) + " receptors, "
+                + std::to_string(receptors.size() - pending) + " cached");
+  int busy = 0;
+  for (int rank = 1; rank < world_size; rank++) {
+    if (shares[rank].empty()) {continue;}
+    std::vector<std::string> message = shares[rank];
+    message.insert(message.begin(), settings.mirror ? "1" : "0");
+    unsigned int size;
+    char * tmp = serialize(message, &size);
+    MPI_Send(&tmp[0], size, MPI_BYTE, rank, PREPRECEPTORS, MPI_COMM_WORLD);
+    delete[] tmp;
+    busy++;
+  }
+  std::vector<std::string> errors = prepareShare(shares[0], settings,
+                                                 threads, info);
+  for (; busy > 0; busy--) {
+    MPI_Status status;
+    int size;
+    MPI_Probe(MPI_ANY_SOURCE, PREPDONE, MPI_COMM_WORLD, &status);
+    MPI_Get_count(&status, MPI_BYTE, &size);
+    char * tmp = new char[size];
+    MPI_Recv(&tmp[0], size, MPI_BYTE, status.MPI_SOURCE, PREPDONE,
+             MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    deserialize(errors, tmp, size);
+    delete[] tmp;
+  }
+  if (!errors.empty()) {
+    std::string msg = "Could not prepare " + std::to_string(errors.size())
+                      + " receptor(s)";
+    for (auto & e : errors) {
+      msg.append("\n" + e);
+    }
+    throw ReceptorPrepException(msg);
+  }
+  std::vector<std::string> result;
+  for (auto & receptor : receptors) {
+    for (auto & file : prepareReceptor(receptor, settings, info)) {
+      result.push_back(file);
+    }
+  }
+  return result;
+}
+
+void serveReceptorPrep(MPI_Comm master, ReceptorPrepSettings settings,
+                       unsigned int threads, Info * info) {
+  while (true) {
+    MPI_Status status;
+    MPI_Probe(0, MPI_ANY_TAG, master, &status);
+    if (status.MPI_TAG != PREPRECEPTORS) {return;}
+    int size;
+    MPI_Get_count(&status, MPI_BYTE, &size);
+    char * tmp = new char[size];
+    MPI_Recv(&tmp[0], size, MPI_BYTE, 0, PREPRECEPTORS, master,
+             MPI_STATUS_IGNORE);
+    std::vector<std::string> receptors;
+    deserialize(receptors, tmp, size);
+    delete[] tmp;
+    if (receptors.empty()) {continue;}
+    settings.mirror = (receptors.front() == "1");
+    receptors.erase(receptors.begin());
+    std::vector<std::string> errors = prepareShare(receptors, settings,
+                                                   threads, info);
+    unsigned int errorsSize;
+    tmp = serialize(errors, &errorsSize);
+    MPI_Send(&tmp[0], errorsSize, MPI_BYTE, 0, PREPDONE, master);
+    delete[] tmp;
+  }
+}
@@ -0,0 +1,125 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * ReceptorPrep
+ *
+ * Preparation of the receptors before the GA starts: mirror image (optional),
+ * docking box(es) and PDBQT (MGLTools prepare_receptor4.py). Every receptor
+ * is prepared in a directory of its own under the cache directory, named
+ * after a hash of the receptor file and the settings affecting the result,
+ * so unchanged receptors are never prepared again in later runs. The input
+ * files are left untouched.
+ *
+ * Receptors not cached yet are split between the threads of the master and
+ * the worker ranks, which prepare their share before receiving the final
+ * receptor list (serveReceptorPrep). The cache directory has to be on a
+ * file system shared by all ranks, like the working directory.
+*/
+#ifndef SRC_RECEPTORPREP_RECEPTORPREP_H_
+#define SRC_RECEPTORPREP_RECEPTORPREP_H_
+#include <mpi.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include "../Pocket/Pocket.h"
+#include "../PDB/PDB.h"
+#include "../ThreadPool/ThreadPool.h"
+#include "../Process/Process.h"
+#include "../Serialization/Serialization.h"
+#include "../VinaInstance/VinaInstance.h"
+#include "../inih/INIReader.h"
+#include "../Communication.h"
+#include "../Info.h"
+
+class ReceptorPrepException : virtual public std::exception {
+ public:
+    ReceptorPrepException(const std::string msg1) {
+      errorMsg = "Error in ReceptorPrep!\nMessage: " + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+/* Settings, read from config.ini except for mirror (command line):
+ *  pocket:   docking box settings, see PocketSettings
+ *  mirror:   convert the receptors into their mirror image
+ *  pythonShPath, mgltoolsPath: MGLTools
+ *  cacheDir: prepared receptors, workingDir/receptorcache
+*/
+struct ReceptorPrepSettings {
+  PocketSettings pocket;
+  bool mirror = false;
+  std::string pythonShPath;
+  std::string mgltoolsPath;
+  std::string cacheDir;
+};
+
+/* readReceptorPrepSettings(reader):
+ *
+ * Reads settings from config.ini
+*/
+ReceptorPrepSettings readReceptorPrepSettings(INIReader &);
+/* mImage(pdb):
+ *
+ * Converts pdb into its mirror image in place (x inverted)
+*/
+void mImage(const std::string);
+/* prepareConfig(receptor, pocket, pocketDir, info):
+ *
+ * Writes conf file(s) for docking, returns the receptor files to dock
+ * against: receptor itself and per additional pocket a link in pocketDir
+ * to receptor and its PDBQT (written by preparePDBQT(receptor)), with a
+ * conf file of its own
+*/
+std::vector<std::string> prepareConfig(std::string, const PocketSettings &,
+                                       std::string, Info *);
+/* preparePDBQT(receptor, pythonShPath, mgltoolsPath):
+ *
+ * Writes receptor PDBQT next to it
+*/
+void preparePDBQT(std::string, std::string, std::string);
+/* receptorKey(receptor, settings):
+ *
+ * Returns hash of the receptor file and the settings used to prepare it
+*/
+std::string receptorKey(const std::string &, const ReceptorPrepSettings &);
+/* prepareReceptor(receptor, settings, info):
+ *
+ * Prepares receptor in its cache directory unless done already, returns
+ * the files to dock against
+*/
+std::vector<std::string> prepareReceptor(const std::string &,
+                                         const ReceptorPrepSettings &,
+                                         Info *);
+/* prepareReceptors(receptors, settings, threads, world_size, info):
+ *
+ * Prepares all receptors not cached yet on threads threads of this rank and
+ * on the worker ranks 1 to world_size - 1, returns the files to dock
+ * against in the order of receptors. Throws ReceptorPrepException listing
+ * every receptor that failed
+*/
+std::vector<std::string> prepareReceptors(const std::vector<std::string> &,
+                                          ReceptorPrepSettings, unsigned int,
+                                          int, Info *);
+/* serveReceptorPrep(master, settings, threads, info):
+ *
+ * Worker side of prepareReceptors, prepares the receptors the master sends
+ * until any other message arrives (which is left to the caller)
+*/
+void serveReceptorPrep(MPI_Comm, ReceptorPrepSettings, unsigned int, Info *);
+
+#endif  // SRC_RECEPTORPREP_RECEPTORPREP_H_
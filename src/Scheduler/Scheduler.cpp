@@ -0,0 +1,382 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Scheduler.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+const unsigned int CostModel::kMinSamples;
+const unsigned int Scheduler::kMinDurations;
+
+void RidgeModel::add(const std::vector<double> & x, double y) {
+  for (unsigned int i = 0; i < n; i++) {
+    for (unsigned int j = 0; j < n; j++) {
+      xtx[i * n + j] += x[i] * x[j];
+    }
+    xty[i] += x[i] * y;
+  }
+  samples++;
+}
+
+double RidgeModel::predict(const std::vector<double> & x) {
+  // Solve (X^T X + lambda I) w = X^T y with partial pivoting
+  std::vector<double> a = xtx;
+  std::vector<double> w = xty;
+  for (unsigned int i = 0; i < n; i++) {
+    a[i * n + i] += lambda;
+  }
+  for (unsigned int c = 0; c < n; c++) {
+    unsigned int p = c;
+    for (unsigned int r = c + 1; r < n; r++) {
+      if (std::fabs(a[r * n + c]) > std::fabs(a[p * n + c])) {p = r;}
+    }
+    if (std::fabs(a[p * n + c]) < 1e-12) {continue;}
+    if (p != c) {
+      for (unsigned int k = 0; k < n; k++) {
+        std::swap(a[c * n + k], a[p * n + k]);
+      }
+      std::swap(w[c], w[p]);
+    }
+    for (unsigned int r = c + 1; r < n; r++) {
+      double f = a[r * n + c] / a[c * n + c];
+      for (unsigned int k = c; k < n; k++) {
+        a[r * n + k] -= f * a[c * n + k];
+      }
+      w[r] -= f * w[c];
+    }
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    double s = w[i];
+    for (unsigned int k = i + 1; k < n; k++) {
+      s -= a[i * n + k] * w[k];
+    }
+    w[i] = (std::fabs(a[i * n + i]) < 1e-12) ? 0.0 : s / a[i * n + i];
+  }
+  double y = 0.0;
+  for (unsigned int i = 0; i < n; i++) {
+    y += w[i] * x[i];
+  }
+  return y;
+}
+
+namespace {
+// Quadratic features, scaled to be roughly of order one
+std::vector<double> quadratic(double v) {
+  return {1.0, v, v * v};
+}
+}  // namespace
+
+void CostModel::addSample(unsigned int length, const JobResult & result) {
+  // Dock-only jobs teach the docking part only
+  if (result.mdSeconds <= 0.0 && result.dockSeconds <= 0.0) {return;}
+  double l = length / 10.0;
+  if (result.atoms > 0.0 && result.mdSeconds > 0.0) {
+    atoms.add(quadratic(l), result.atoms);
+    md.add(quadratic(result.atoms / 10000.0), result.mdSeconds);
+  }
+  unsigned int docked = 0;
+  for (auto a : result.affinities) {
+    if (!std::isnan(a)) {docked++;}
+  }
+  if (docked > 0) {
+    dock.add(quadratic(l), result.dockSeconds / docked);
+  }
+}
+
+float CostModel::predict(unsigned int length, unsigned int receptors,
+                         bool withMD) {
+  if (md.samples < kMinSamples || dock.samples < kMinSamples) {
+    // Docking alone is cheaper than any MD, it goes last
+    return withMD ? length : 0.0;
+  }
+  double l = length / 10.0;
+  double dockSeconds = std::max(0.0, dock.predict(quadratic(l)));
+  if (!withMD) {return receptors * dockSeconds;}
+  double a = std::max(0.0, atoms.predict(quadratic(l)));
+  double mdSeconds = std::max(0.0, md.predict(quadratic(a / 10000.0)));
+  return mdSeconds + receptors * dockSeconds;
+}
+
+void Scheduler::addWorker(int rank, unsigned int slots) {
+  WorkerLoad w;
+  w.rank = rank;
+  w.slots = (slots > 0) ? slots : 1;
+  w.running = 0;
+  w.load = 0.0;
+  workers.push_back(w);
+}
+
+std::vector<int> Scheduler::aliveWorkers() {
+  std::vector<int> ranks;
+  for (auto & w : workers) {
+    ranks.push_back(w.rank);
+  }
+  return ranks;
+}
+
+unsigned int Scheduler::failWorker(int rank) {
+  unsigned int requeued = 0;
+  for (unsigned int i = 0; i < workers.size(); i++) {
+    if (workers[i].rank != rank) {continue;}
+    for (auto it = running.begin(); it != running.end();) {
+      RunningJob & r = it->second;
+      auto pos = std::find(r.workers.begin(), r.workers.end(), i);
+      if (pos == r.workers.end()) {
+        ++it;
+        continue;
+      }
+      r.starts.erase(r.starts.begin() + (pos - r.workers.begin()));
+      r.workers.erase(pos);
+      if (!r.workers.empty()) {
+        ++it;
+        continue;
+      }
+      // Last copy lost, run it again unless it already has a result
+      if (!r.done) {
+        Job job = r.job;
+        job.attempt = r.attempts;
+        unfinished--;
+        push(job);
+        requeued++;
+      }
+      it = running.erase(it);
+    }
+    // Dropped, copies on the workers after it move up one index
+    workers.erase(workers.begin() + i);
+    for (auto & r : running) {
+      for (auto & w : r.second.workers) {
+        if (w > i) {w--;}
+      }
+    }
+    break;
+  }
+  return requeued;
+}
+
+bool Scheduler::retireWorker(int rank) {
+  if (runningOn(rank) > 0) {return false;}
+  failWorker(rank);
+  return true;
+}
+
+unsigned int Scheduler::runningOn(int rank) {
+  unsigned int jobs = 0;
+  for (auto & w : workers) {
+    if (w.rank == rank) {jobs += w.running;}
+  }
+  return jobs;
+}
+
+unsigned int Scheduler::slots() {
+  unsigned int total = 0;
+  for (auto & w : workers) {
+    total += w.slots;
+  }
+  return total;
+}
+
+unsigned int Scheduler::numWorkers() {
+  return workers.size();
+}
+
+void Scheduler::push(const Job & job) {
+  auto pos = std::upper_bound(queue.begin(), queue.end(), job,
+                              [](const Job & a, const Job & b) {
+                                return a.cost > b.cost;
+                              });
+  queue.insert(pos, job);
+}
+
+void Scheduler::setSpeculation(float factor) {
+  speculation = factor;
+}
+
+int Scheduler::freeWorker(const Job & job,
+                          const std::vector<unsigned int> & exclude) {
+  int best = -1;
+  float bestFinish = std::numeric_limits<float>::infinity();
+  for (unsigned int i = 0; i < workers.size(); i++) {
+    if (workers[i].running >= workers[i].slots) {
+      continue;
+    }
+    if (std::find(exclude.begin(), exclude.end(), i) != exclude.end()) {
+      continue;
+    }
+    float finish = (workers[i].load + job.cost) / workers[i].slots;
+    if (finish < bestFinish) {
+      bestFinish = finish;
+      best = i;
+    }
+  }
+  return best;
+}
+
+Job Scheduler::start(const Job & job, unsigned int worker, double now) {
+  workers[worker].running++;
+  workers[worker].load += job.cost;
+  RunningJob & r = running[job.id];
+  if (r.workers.empty() && !r.done) {
+    r.job = job;
+    r.attempts = job.attempt;
+    unfinished++;
+  }
+  r.workers.push_back(worker);
+  r.starts.push_back(now);
+  Job copy = job;
+  copy.attempt = r.attempts++;
+  return copy;
+}
+
+bool Scheduler::dispatch(Job & job, int & rank, double now) {
+  if (!queue.empty()) {
+    int best = freeWorker(queue.front(), std::vector<unsigned int>());
+    if (best < 0) {return false;}
+    job = start(queue.front(), best, now);
+    queue.erase(queue.begin());
+    rank = workers[best].rank;
+    return true;
+  }
+  // Backup copy of the straggler running longest
+  if (speculation <= 0 || durations.size() < kMinDurations) {return false;}
+  double limit = speculation * medianDuration();
+  RunningJob * straggler = NULL;
+  double longest = limit;
+  for (auto & r : running) {
+    if (r.second.done || r.second.workers.size() != 1) {continue;}
+    double elapsed = now - r.second.starts.front();
+    if (elapsed > longest) {
+      longest = elapsed;
+      straggler = &r.second;
+    }
+  }
+  if (straggler == NULL) {return false;}
+  int best = freeWorker(straggler->job, straggler->workers);
+  if (best < 0) {return false;}
+  job = start(straggler->job, best, now);
+  rank = workers[best].rank;
+  return true;
+}
+
+Completion Scheduler::complete(unsigned int id, int rank, double now,
+                               bool failed) {
+  Completion c;
+  auto it = running.find(id);
+  if (it == running.end()) {return c;}
+  RunningJob & r = it->second;
+  c.job = r.job;
+  // Free the slot of this copy
+  double started = now;
+  for (unsigned int i = 0; i < r.workers.size(); i++) {
+    WorkerLoad & w = workers[r.workers[i]];
+    if (w.rank != rank) {continue;}
+    w.running--;
+    w.load = std::max(0.0f, w.load - r.job.cost);
+    started = r.starts[i];
+    r.workers.erase(r.workers.begin() + i);
+    r.starts.erase(r.starts.begin() + i);
+    break;
+  }
+  // A failed copy only counts if no other copy can succeed anymore
+  if (!r.done && (!failed || r.workers.empty())) {
+    r.done = true;
+    unfinished--;
+    c.first = true;
+    if (!failed) {durations.push_back(now - started);}
+    for (auto w : r.workers) {
+      c.cancel.push_back(workers[w].rank);
+    }
+  }
+  if (r.workers.empty()) {
+    running.erase(it);
+  }
+  return c;
+}
+
+unsigned int Scheduler::pending() {
+  return queue.size() + unfinished;
+}
+
+unsigned int Scheduler::queued() {
+  return queue.size();
+}
+
+double Scheduler::medianDuration() {
+  if (durations.empty()) {return 0.0;}
+  std::vector<double> sorted = durations;
+  std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+                   sorted.end());
+  return sorted[sorted.size() / 2];
+}
+
+std::vector<std::pair<std::string, std::vector<float>>> packJob(
+                                                  const Job & job,
+                                                  const DockingBound & bound) {
+  std::vector<std::pair<std::string, std::vector<float>>> packed;
+  packed.push_back(std::make_pair(job.file,
+                                  std::vector<float>{
+                                    static_cast<float>(job.id),
+                                    static_cast<float>(job.length),
+                                    job.cost,
+                                    static_cast<float>(job.attempt),
+                                    job.dockOnly ? 1.0f : 0.0f,
+                                    // Halves, floats hold 24 bits exactly
+                                    static_cast<float>(job.seed >> 16),
+                                    static_cast<float>(job.seed & 0xFFFF)}));
+  packed.push_back(std::make_pair("known", job.known));
+  for (auto & p : packBound(bound)) {
+    packed.push_back(p);
+  }
+  return packed;
+}
+
+void unpackJob(
+      const std::vector<std::pair<std::string, std::vector<float>>> & packed,
+      Job & job, DockingBound & bound) {
+  if (packed.size() < 2 || packed.at(0).second.size() < 7) {
+    throw SchedulerException("Malformed job message");
+  }
+  job.file = packed.at(0).first;
+  job.id = static_cast<unsigned int>(packed.at(0).second.at(0));
+  job.length = static_cast<unsigned int>(packed.at(0).second.at(1));
+  job.cost = packed.at(0).second.at(2);
+  job.attempt = static_cast<unsigned int>(packed.at(0).second.at(3));
+  job.dockOnly = packed.at(0).second.at(4) != 0.0f;
+  job.seed = (static_cast<unsigned int>(packed.at(0).second.at(5)) << 16)
+             | static_cast<unsigned int>(packed.at(0).second.at(6));
+  job.known = packed.at(1).second;
+  bound = unpackBound(std::vector<std::pair<std::string, std::vector<float>>>(
+                                            packed.begin() + 2, packed.end()));
+}
+
+std::vector<std::pair<std::string, std::vector<float>>> packResult(
+                                                    const JobResult & result) {
+  std::vector<std::pair<std::string, std::vector<float>>> packed;
+  packed.push_back(std::make_pair(result.file, result.affinities));
+  packed.push_back(std::make_pair("stats", std::vector<float>{
+                                    static_cast<float>(result.id),
+                                    result.mdSeconds, result.dockSeconds,
+                                    result.atoms}));
+  packed.push_back(std::make_pair("rescored", std::vector<float>(
+                                    result.rescored.begin(),
+                                    result.rescored.end())));
+  return packed;
+}
+
+JobResult unpackResult(
+      const std::vector<std::pair<std::string, std::vector<float>>> & packed) {
+  JobResult result;
+  if (packed.size() < 2 || packed.at(1).second.size() < 4) {
+    throw SchedulerException("Malformed job result message");
+  }
+  result.file = packed.at(0).first;
+  result.affinities = packed.at(0).second;
+  result.id = static_cast<unsigned int>(packed.at(1).second.at(0));
+  result.mdSeconds = packed.at(1).second.at(1);
+  result.dockSeconds = packed.at(1).second.at(2);
+  result.atoms = packed.at(1).second.at(3);
+  if (packed.size() > 2) {
+    for (auto receptor : packed.at(2).second) {
+      result.rescored.push_back(static_cast<unsigned int>(receptor));
+    }
+  }
+  return result;
+}
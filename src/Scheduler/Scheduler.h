@@ -0,0 +1,284 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Scheduler
+ *
+ * Dispatches ligand jobs (MD + docking of one peptide) to the workers,
+ * longest expected job first to the worker expected to finish it first
+ * (LPT list scheduling), which keeps the makespan of a generation short.
+ *
+ * Expected runtimes come from CostModel, online ridge regressions on the
+ * timings of completed jobs:
+ *  - atoms after solvation from sequence length
+ *  - MD seconds from atoms
+ *  - docking seconds per receptor from sequence length
+ * Until enough jobs are completed, the sequence length is used as cost.
+ *
+ * Stragglers: once no job is queued anymore but a worker has a free slot,
+ * a backup copy of a job running longer than a multiple of the median job
+ * duration is started on another worker. The first copy to finish wins,
+ * the other ones are cancelled.
+ *
+ * Failed workers: their jobs go back into the queue unless another copy
+ * is still running elsewhere, no further jobs are assigned to them.
+ *
+ * Jobs and results are packed into (name, values) pairs for serialization.
+*/
+#ifndef SRC_SCHEDULER_SCHEDULER_H_
+#define SRC_SCHEDULER_SCHEDULER_H_
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <exception>
+#include "../Aggregation/Aggregation.h"
+
+class SchedulerException : virtual public std::exception {
+ public:
+    SchedulerException(const std::string msg1) {
+      errorMsg = "Error in Scheduler!\nMessage: " + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+/* One ligand to simulate and dock, length of its sequence, expected cost,
+ * attempt > 0 for backup copies. known: affinities from earlier runs, one
+ * per receptor (NaN: dock it) or empty (dock all). dockOnly: the MD result
+ * (topcluster.pdbqt) is there already, only docking is left. seed: the
+ * tools of the job derive theirs from it (see Seed), 0: they pick their own
+*/
+struct Job {
+  unsigned int id = 0;
+  std::string file;
+  unsigned int length = 0;
+  float cost = 0.0;
+  unsigned int attempt = 0;
+  std::vector<float> known;
+  bool dockOnly = false;
+  unsigned int seed = 0;
+};
+
+/* Outcome of a result: whether it is the one to use (first successful
+ * copy, or the last one if all failed) and ranks running other copies of
+ * the job, which should be cancelled
+*/
+struct Completion {
+  bool first = false;
+  Job job;
+  std::vector<int> cancel;
+};
+
+/* Affinities (empty if failed, NaN for receptors not docked by this job),
+ * receptors whose affinity is a rescored pose instead of a docking,
+ * thread-seconds spent and atoms simulated */
+struct JobResult {
+  unsigned int id = 0;
+  std::string file;
+  std::vector<float> affinities;
+  std::vector<unsigned int> rescored;
+  float mdSeconds = 0.0;
+  float dockSeconds = 0.0;
+  float atoms = 0.0;
+};
+
+/* Ridge regression over few features with online normal equations */
+class RidgeModel {
+ public:
+    RidgeModel(unsigned int n1, float lambda1) {
+      n = n1;
+      lambda = lambda1;
+      samples = 0;
+      xtx = std::vector<double>(n * n, 0.0);
+      xty = std::vector<double>(n, 0.0);
+    }
+
+    /* add(x, y):
+     *
+     * Adds a training sample
+    */
+    void add(const std::vector<double> &, double);
+    /* predict(x):
+     *
+     * Returns prediction, solving the normal equations (Gaussian elimination)
+    */
+    double predict(const std::vector<double> &);
+
+    unsigned int samples;
+
+ private:
+    unsigned int n;
+    float lambda;
+    std::vector<double> xtx;
+    std::vector<double> xty;
+};
+
+class CostModel {
+ public:
+    CostModel() : atoms(3, 1e-3), md(3, 1e-3), dock(3, 1e-3) {}
+
+    /* addSample(length, result):
+     *
+     * Learns from the timings of a completed job
+    */
+    void addSample(unsigned int, const JobResult &);
+    /* predict(length, receptors, md):
+     *
+     * Returns expected thread-seconds of a ligand of given sequence length
+     * docked against given number of receptors, simulated first if md
+    */
+    float predict(unsigned int, unsigned int, bool = true);
+
+    static const unsigned int kMinSamples = 5;
+
+ private:
+    RidgeModel atoms;
+    RidgeModel md;
+    RidgeModel dock;
+};
+
+class Scheduler {
+ public:
+    Scheduler() {
+      speculation = 0.0;
+      unfinished = 0;
+    }
+
+    /* addWorker(rank, slots):
+     *
+     * Registers worker running up to slots jobs at a time
+    */
+    void addWorker(int, unsigned int);
+    /* numWorkers():
+     *
+     * Returns number of workers, failed and retired ones are removed
+    */
+    unsigned int numWorkers();
+    /* aliveWorkers():
+     *
+     * Returns ranks of workers not failed
+    */
+    std::vector<int> aliveWorkers();
+    /* failWorker(rank):
+     *
+     * Removes worker and re-queues the jobs it was running, returns number
+     * of re-queued jobs
+    */
+    unsigned int failWorker(int);
+    /* retireWorker(rank):
+     *
+     * Removes worker if it runs no job, returns false if it is busy
+    */
+    bool retireWorker(int);
+    /* runningOn(rank):
+     *
+     * Returns number of jobs running on worker
+    */
+    unsigned int runningOn(int);
+    /* slots():
+     *
+     * Returns number of slots of all workers not failed or retired
+    */
+    unsigned int slots();
+    /* push(job):
+     *
+     * Queues job, queue is kept sorted by expected cost (longest first)
+    */
+    void push(const Job &);
+    /* setSpeculation(factor):
+     *
+     * Backup copies are started for jobs running longer than factor times
+     * the median duration, 0 disables them
+    */
+    void setSpeculation(float);
+    /* dispatch(job, rank, now):
+     *
+     * Pops the longest job and assigns it to the worker with a free slot
+     * which is expected to finish it first. Without queued jobs, returns a
+     * backup copy of a straggler if there is one. Returns false if there is
+     * nothing to do or all slots are busy. now is the time in seconds.
+    */
+    bool dispatch(Job &, int &, double);
+    /* complete(id, rank, now, failed):
+     *
+     * Frees the slot of the copy of job id run by rank and returns whether
+     * its result is to be used
+    */
+    Completion complete(unsigned int, int, double, bool);
+    /* pending():
+     *
+     * Returns number of queued plus running jobs without result yet
+    */
+    unsigned int pending();
+    /* queued():
+     *
+     * Returns number of jobs not dispatched yet
+    */
+    unsigned int queued();
+    /* medianDuration():
+     *
+     * Returns median duration of finished jobs in seconds, 0 if none
+    */
+    double medianDuration();
+
+    // Finished jobs needed before backups are started
+    static const unsigned int kMinDurations = 3;
+
+ private:
+    struct WorkerLoad {
+      int rank;
+      unsigned int slots;
+      unsigned int running;
+      float load;
+    };
+    struct RunningJob {
+      Job job;
+      std::vector<unsigned int> workers;
+      std::vector<double> starts;
+      bool done = false;
+      // Copies started so far, numbers the scratch directories
+      unsigned int attempts = 0;
+    };
+    std::vector<WorkerLoad> workers;
+    std::vector<Job> queue;
+    std::unordered_map<unsigned int, RunningJob> running;
+    std::vector<double> durations;
+    float speculation;
+    unsigned int unfinished;
+
+    /* freeWorker(job, exclude):
+     *
+     * Returns index of worker with a free slot expected to finish job
+     * first, not running any copy in exclude, -1 if there is none
+    */
+    int freeWorker(const Job &, const std::vector<unsigned int> &);
+    /* start(job, worker, now):
+     *
+     * Books a copy of job on worker, returns it with its attempt number
+    */
+    Job start(const Job &, unsigned int, double);
+};
+
+/* packJob(job, bound) / unpackJob(packed, job, bound):
+ *
+ * Conversion of a job and the docking bound of its generation to and from
+ * (name, values) pairs for serialization
+*/
+std::vector<std::pair<std::string, std::vector<float>>> packJob(
+                                          const Job &, const DockingBound &);
+void unpackJob(const std::vector<std::pair<std::string, std::vector<float>>> &,
+               Job &, DockingBound &);
+/* packResult(result) / unpackResult(packed):
+ *
+ * Conversion of a job result to and from (name, values) pairs
+*/
+std::vector<std::pair<std::string, std::vector<float>>> packResult(
+                                                          const JobResult &);
+JobResult unpackResult(
+            const std::vector<std::pair<std::string, std::vector<float>>> &);
+
+#endif  // SRC_SCHEDULER_SCHEDULER_H_
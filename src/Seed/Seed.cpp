@@ -0,0 +1,29 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Seed.h"
+
+// SplitMix64 finalizer, neighbouring inputs give unrelated outputs
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+unsigned int deriveSeed(unsigned int seed, const std::string & key) {
+  // FNV-1a of the key
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  unsigned int derived = static_cast<unsigned int>(
+                           splitmix64(splitmix64(seed) ^ hash) >> 33);
+  return (derived == 0) ? 1 : derived;
+}
+
+unsigned int campaignSeed(unsigned int configured) {
+  std::random_device rd;
+  unsigned int seed = configured;
+  while (seed == 0) {seed = rd();}
+  return seed;
+}
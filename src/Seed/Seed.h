@@ -0,0 +1,33 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Seed
+ *
+ * Every random choice of a run is derived from one campaign seed
+ * ([finDrGA] seed in config.ini):
+ *  - the random engine of the master, reseeded every generation
+ *  - a seed per ligand, sent with its job
+ *  - from that, the seeds of the tools: vina --seed per receptor and
+ *    gen_seed / ld_seed of the grompp steps
+ * The same seed and input give the same peptides, poses and affinities,
+ * no matter which worker a job runs on or whether its steps come from an
+ * earlier run.
+*/
+#ifndef SRC_SEED_SEED_H_
+#define SRC_SEED_SEED_H_
+#include <string>
+#include <random>
+#include <cstdint>
+
+/* deriveSeed(seed, key):
+ *
+ * Returns the seed for key (e.g. a sequence, receptor or step) derived
+ * from seed. In [1, 2^31 - 1], which vina and gromacs take as a fixed seed
+*/
+unsigned int deriveSeed(unsigned int, const std::string &);
+/* campaignSeed(configured):
+ *
+ * Returns configured, or a random seed if it is 0
+*/
+unsigned int campaignSeed(unsigned int);
+
+#endif  // SRC_SEED_SEED_H_
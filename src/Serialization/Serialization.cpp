@@ -108,3 +108,51 @@ void deserialize(vector<pair<string, float>> &restore,
     }
   }
 }
+
+/********************************************/
+char * serialize(vector<pair<string, vector<float>>> &v, unsigned int *size) {
+  // STR1\0N1FL1_1..FL1_N1STR2\0N2...
+  unsigned int totalSize = 0;
+
+  // Length of string, +1 for \0, count, floats
+  for (auto it = v.begin(); it != v.end(); it++) {
+    totalSize += it->first.size() + 1 + sizeof(unsigned int)
+                 + it->second.size() * sizeof(float);
+  }
+
+  char * buffer = new char[totalSize];
+  unsigned int bufpt = 0;
+
+  for (auto it = v.begin(); it != v.end(); it++) {
+    memcpy(&buffer[bufpt], it->first.c_str(), it->first.size() + 1);
+    bufpt += it->first.size() + 1;
+    unsigned int n = it->second.size();
+    memcpy(&buffer[bufpt], &n, sizeof(unsigned int));
+    bufpt += sizeof(unsigned int);
+    if (n > 0) {
+      memcpy(&buffer[bufpt], &it->second[0], n * sizeof(float));
+      bufpt += n * sizeof(float);
+    }
+  }
+
+  * size = totalSize;
+  return buffer;
+}
+
+void deserialize(vector<pair<string, vector<float>>> &restore,
+                 char * buffer, unsigned int size) {
+  unsigned int bufpt = 0;
+  while (bufpt < size) {
+    string curStr(&buffer[bufpt]);
+    bufpt += curStr.size() + 1;
+    unsigned int n;
+    memcpy(&n, &buffer[bufpt], sizeof(unsigned int));
+    bufpt += sizeof(unsigned int);
+    vector<float> values(n);
+    if (n > 0) {
+      memcpy(&values[0], &buffer[bufpt], n * sizeof(float));
+      bufpt += n * sizeof(float);
+    }
+    restore.push_back(make_pair(curStr, values));
+  }
+}
@@ -1,6 +1,7 @@
 /* Copyright 2019 iGEM Team Freiburg 2019
  *
- * String and (string, float) pair serialization required for communication
+ * String, (string, float) and (string, float vector) pair serialization
+ * required for communication
  * between master and workers
  *
 */
@@ -17,4 +18,9 @@ void deserialize(std::vector<std::string> &, char *, unsigned int);
 char * serialize(std::vector<std::pair<std::string, float>> &, unsigned int *);
 void deserialize(std::vector<std::pair<std::string, float>> &,
                  char *, unsigned int);
+// Vector of pairs of strings and float vectors
+char * serialize(std::vector<std::pair<std::string, std::vector<float>>> &,
+                 unsigned int *);
+void deserialize(std::vector<std::pair<std::string, std::vector<float>>> &,
+                 char *, unsigned int);
 #endif  // SRC_SERIALIZATION_SERIALIZATION_H_
@@ -0,0 +1,440 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "SolventBox.h"
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <utility>
+
+// Box vectors from .gro order
+static void toVectors(const float * box, float v[3][3]) {
+  float vectors[3][3] = {{box[0], box[3], box[4]},
+                         {box[5], box[1], box[6]},
+                         {box[7], box[8], box[2]}};
+  std::copy(&vectors[0][0], &vectors[0][0] + 9, &v[0][0]);
+}
+
+// Shortest periodic image of d, the box being lower triangular
+static void minimumImage(const float v[3][3], float d[3]) {
+  for (int k = 2; k >= 0; k--) {
+    if (!(v[k][k] > 0)) {continue;}
+    float shift = std::round(d[k] / v[k][k]);
+    for (int j = 0; j < 3; j++) {
+      d[j] -= shift * v[k][j];
+    }
+  }
+}
+
+// Ranges [begin, end) of the molecules (consecutive atoms of one residue)
+// from atom from onwards
+static std::vector<std::pair<size_t, size_t>> molecules(
+                            const std::vector<GroAtom> & atoms, size_t from) {
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (size_t i = from; i < atoms.size(); i++) {
+    if (ranges.empty() || atoms[i].resnr != atoms[i - 1].resnr
+        || atoms[i].resname != atoms[i - 1].resname) {
+      ranges.push_back(std::make_pair(i, i + 1));
+    } else {
+      ranges.back().second = i + 1;
+    }
+  }
+  return ranges;
+}
+
+// Center of the bounding box of atoms [from, to)
+static void extentCenter(const std::vector<GroAtom> & atoms, size_t from,
+                         size_t to, float center[3]) {
+  for (int k = 0; k < 3; k++) {
+    float min = std::numeric_limits<float>::infinity();
+    float max = - std::numeric_limits<float>::infinity();
+    for (size_t i = from; i < to; i++) {
+      min = std::min(min, atoms[i].x[k]);
+      max = std::max(max, atoms[i].x[k]);
+    }
+    center[k] = (from < to) ? (min + max) / 2.0 : 0.0;
+  }
+}
+
+static std::string trim(const std::string & s) {
+  size_t begin = s.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {return "";}
+  return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+GroSystem readGro(const std::string & file) {
+  std::ifstream in(file);
+  if (!in) {
+    throw SolventBoxException("Could not open " + file);
+  }
+  GroSystem system;
+  std::string line;
+  std::getline(in, system.title);
+  unsigned long count = 0;
+  try {
+    std::getline(in, line);
+    count = std::stoul(line);
+  } catch (...) {
+    throw SolventBoxException("No atom count in " + file);
+  }
+  for (unsigned long i = 0; i < count; i++) {
+    if (!std::getline(in, line) || line.size() < 44) {
+      throw SolventBoxException("Missing atoms in " + file);
+    }
+    GroAtom atom;
+    try {
+      atom.resnr = std::stoi(line.substr(0, 5));
+      atom.resname = trim(line.substr(5, 5));
+      atom.name = trim(line.substr(10, 5));
+      for (int k = 0; k < 3; k++) {
+        atom.x[k] = std::stof(line.substr(20 + 8 * k, 8));
+      }
+    } catch (...) {
+      throw SolventBoxException("Malformed atom in " + file + ": " + line);
+    }
+    system.atoms.push_back(atom);
+  }
+  std::getline(in, line);
+  std::istringstream box(line);
+  int values = 0;
+  while (values < 9 && box >> system.box[values]) {values++;}
+  if (values < 3) {
+    throw SolventBoxException("No box in " + file);
+  }
+  return system;
+}
+
+void writeGro(const std::string & file, const GroSystem & system) {
+  std::ofstream out(file, std::ios::trunc);
+  out << system.title << "\n" << system.atoms.size() << "\n";
+  char line[128];
+  for (size_t i = 0; i < system.atoms.size(); i++) {
+    const GroAtom & a = system.atoms[i];
+    snprintf(line, sizeof(line), "%5d%-5s%5s%5d%8.3f%8.3f%8.3f\n",
+             a.resnr % 100000, a.resname.c_str(), a.name.c_str(),
+             static_cast<int>((i + 1) % 100000), a.x[0], a.x[1], a.x[2]);
+    out << line;
+  }
+  bool triclinic = false;
+  for (int k = 3; k < 9; k++) {
+    triclinic = triclinic || system.box[k] != 0;
+  }
+  for (int k = 0; k < (triclinic ? 9 : 3); k++) {
+    snprintf(line, sizeof(line), "%10.5f", system.box[k]);
+    out << line;
+  }
+  out << "\n";
+  if (!out) {
+    throw SolventBoxException("Could not write " + file);
+  }
+}
+
+bool boxSupported(const std::string & bt) {
+  return bt == "cubic" || bt == "dodecahedron";
+}
+
+void boxVectors(const std::string & bt, float length, float * box) {
+  std::fill(box, box + 9, 0.0f);
+  box[0] = length;
+  box[1] = length;
+  if (bt == "cubic") {
+    box[2] = length;
+  } else if (bt == "dodecahedron") {
+    // Rhombic dodecahedron, xy-square like editconf
+    box[2] = length * std::sqrt(2.0) / 2.0;
+    box[7] = length / 2.0;
+    box[8] = length / 2.0;
+  } else {
+    throw SolventBoxException("No template for box type " + bt);
+  }
+}
+
+float boxLength(const GroSystem & solute, float distance, float bucket) {
+  // Diameter of the solute like editconf, largest distance between two
+  // atoms, so it fits in any orientation
+  float span = 0.0;
+  for (size_t i = 0; i < solute.atoms.size(); i++) {
+    for (size_t j = i + 1; j < solute.atoms.size(); j++) {
+      float d2 = 0.0;
+      for (int k = 0; k < 3; k++) {
+        float d = solute.atoms[i].x[k] - solute.atoms[j].x[k];
+        d2 += d * d;
+      }
+      span = std::max(span, d2);
+    }
+  }
+  float length = std::sqrt(span) + 2 * distance;
+  if (!(bucket > 0)) {return length;}
+  // Tolerance so exact multiples are not rounded up a whole bucket
+  return std::ceil(length / bucket - 1e-4) * bucket;
+}
+
+std::string boxTemplateName(const std::string & bt, float length) {
+  char name[64];
+  snprintf(name, sizeof(name), "_%.2f.gro", length);
+  return bt + name;
+}
+
+GroSystem insertSolute(const GroSystem & solute, const GroSystem & solvent,
+                       float overlap) {
+  if (!(overlap > 0)) {
+    throw SolventBoxException("Overlap distance has to be positive");
+  }
+  GroSystem system;
+  system.title = solute.title;
+  std::copy(solvent.box, solvent.box + 9, system.box);
+  float v[3][3];
+  toVectors(system.box, v);
+  float center[3], soluteCenter[3];
+  for (int k = 0; k < 3; k++) {
+    center[k] = (v[0][k] + v[1][k] + v[2][k]) / 2.0;
+  }
+  extentCenter(solute.atoms, 0, solute.atoms.size(), soluteCenter);
+  float min[3], max[3];
+  std::fill(min, min + 3, std::numeric_limits<float>::infinity());
+  std::fill(max, max + 3, - std::numeric_limits<float>::infinity());
+  for (auto a : solute.atoms) {
+    for (int k = 0; k < 3; k++) {
+      a.x[k] += center[k] - soluteCenter[k];
+      min[k] = std::min(min[k], a.x[k]);
+      max[k] = std::max(max[k], a.x[k]);
+    }
+    system.atoms.push_back(a);
+  }
+  // Cell list of the solute atoms, cells of size overlap
+  int cells[3] = {1, 1, 1};
+  for (int k = 0; k < 3; k++) {
+    if (solute.atoms.empty()) {break;}
+    cells[k] = static_cast<int>((max[k] - min[k]) / overlap) + 1;
+  }
+  std::vector<std::vector<size_t>> grid(cells[0] * cells[1] * cells[2]);
+  auto cellOf = [&](const float * x, int c[3]) {
+    for (int k = 0; k < 3; k++) {
+      c[k] = static_cast<int>(std::floor((x[k] - min[k]) / overlap));
+    }
+  };
+  for (size_t i = 0; i < system.atoms.size(); i++) {
+    int c[3];
+    cellOf(system.atoms[i].x, c);
+    grid[(c[0] * cells[1] + c[1]) * cells[2] + c[2]].push_back(i);
+  }
+  auto overlaps = [&](const float * x) {
+    int c[3];
+    cellOf(x, c);
+    for (int i = std::max(c[0] - 1, 0); i <= std::min(c[0] + 1,
+                                                      cells[0] - 1); i++) {
+      for (int j = std::max(c[1] - 1, 0); j <= std::min(c[1] + 1,
+                                                        cells[1] - 1); j++) {
+        for (int l = std::max(c[2] - 1, 0); l <= std::min(c[2] + 1,
+                                                          cells[2] - 1);
+             l++) {
+          for (auto a : grid[(i * cells[1] + j) * cells[2] + l]) {
+            float d2 = 0.0;
+            for (int k = 0; k < 3; k++) {
+              float d = x[k] - system.atoms[a].x[k];
+              d2 += d * d;
+            }
+            if (d2 < overlap * overlap) {return true;}
+          }
+        }
+      }
+    }
+    return false;
+  };
+  int resnr = solute.atoms.empty() ? 1 : solute.atoms.back().resnr + 1;
+  size_t soluteAtoms = system.atoms.size();
+  for (auto & m : molecules(solvent.atoms, 0)) {
+    // Whole molecule moved to the image of its first atom closest to the
+    // center, i.e. around the solute
+    float d[3], shift[3];
+    for (int k = 0; k < 3; k++) {
+      d[k] = solvent.atoms[m.first].x[k] - center[k];
+    }
+    minimumImage(v, d);
+    for (int k = 0; k < 3; k++) {
+      shift[k] = center[k] + d[k] - solvent.atoms[m.first].x[k];
+    }
+    std::vector<GroAtom> molecule(solvent.atoms.begin() + m.first,
+                                  solvent.atoms.begin() + m.second);
+    bool clash = false;
+    for (auto & a : molecule) {
+      for (int k = 0; k < 3; k++) {a.x[k] += shift[k];}
+      a.resnr = resnr;
+      clash = clash || (soluteAtoms > 0 && overlaps(a.x));
+    }
+    if (clash) {continue;}
+    system.atoms.insert(system.atoms.end(), molecule.begin(), molecule.end());
+    resnr++;
+  }
+  return system;
+}
+
+unsigned int replaceWithIons(GroSystem & system, unsigned int soluteAtoms,
+                             const std::string & ion, unsigned int count,
+                             float minDistance) {
+  std::vector<std::pair<size_t, size_t>> solvent = molecules(system.atoms,
+                                                             soluteAtoms);
+  if (count == 0) {return solvent.size();}
+  float v[3][3], center[3];
+  toVectors(system.box, v);
+  extentCenter(system.atoms, 0, soluteAtoms, center);
+  auto distance = [&](const float * a, const float * b, bool periodic) {
+    float d[3] = {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+    if (periodic) {minimumImage(v, d);}
+    return std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  };
+  // Farthest from the solute first, ties in file order
+  std::vector<size_t> order(solvent.size());
+  for (size_t i = 0; i < order.size(); i++) {order[i] = i;}
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return distance(system.atoms[solvent[a].first].x, center, false)
+           > distance(system.atoms[solvent[b].first].x, center, false);
+  });
+  std::vector<size_t> chosen;
+  std::vector<bool> replaced(solvent.size(), false);
+  for (size_t i = 0; i < order.size() && chosen.size() < count; i++) {
+    const float * x = system.atoms[solvent[order[i]].first].x;
+    bool free = true;
+    for (auto c : chosen) {
+      free = free && distance(x, system.atoms[solvent[c].first].x, true)
+                     >= minDistance;
+    }
+    if (!free) {continue;}
+    chosen.push_back(order[i]);
+    replaced[order[i]] = true;
+  }
+  if (chosen.size() < count) {
+    throw SolventBoxException("Could not place " + std::to_string(count)
+                              + " " + ion + " ions");
+  }
+  std::vector<GroAtom> atoms(system.atoms.begin(),
+                             system.atoms.begin() + soluteAtoms);
+  int resnr = atoms.empty() ? 1 : atoms.back().resnr + 1;
+  for (size_t m = 0; m < solvent.size(); m++) {
+    if (replaced[m]) {continue;}
+    for (size_t i = solvent[m].first; i < solvent[m].second; i++) {
+      atoms.push_back(system.atoms[i]);
+      atoms.back().resnr = resnr;
+    }
+    resnr++;
+  }
+  std::sort(chosen.begin(), chosen.end());
+  for (auto c : chosen) {
+    GroAtom atom = system.atoms[solvent[c].first];
+    atom.resnr = resnr++;
+    atom.resname = ion;
+    atom.name = ion;
+    atoms.push_back(atom);
+  }
+  system.atoms = atoms;
+  return solvent.size() - count;
+}
+
+// Lines of top with the local files it includes inlined, includes not found
+// next to it (force field) are left out
+static void topologyLines(const std::string & top,
+                          std::vector<std::string> & lines, bool required) {
+  std::ifstream in(top);
+  if (!in) {
+    if (required) {throw SolventBoxException("Could not open " + top);}
+    return;
+  }
+  size_t slash = top.find_last_of('/');
+  std::string dir = (slash == std::string::npos) ? ""
+                                                 : top.substr(0, slash + 1);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string t = trim(line);
+    if (t.compare(0, 8, "#include") == 0) {
+      size_t open = t.find('"');
+      size_t close = t.find('"', open + 1);
+      if (open != std::string::npos && close != std::string::npos) {
+        topologyLines(dir + t.substr(open + 1, close - open - 1), lines,
+                      false);
+      }
+      continue;
+    }
+    lines.push_back(line);
+  }
+}
+
+int topologyCharge(const std::string & top) {
+  std::vector<std::string> lines;
+  topologyLines(top, lines, true);
+  std::map<std::string, double> charges;
+  std::string section, molecule;
+  double total = 0.0;
+  for (auto & line : lines) {
+    std::string t = trim(line.substr(0, line.find(';')));
+    if (t.empty() || t[0] == '#') {continue;}
+    if (t[0] == '[') {
+      section = trim(t.substr(1, t.find(']') - 1));
+      if (section == "moleculetype") {molecule.clear();}
+      continue;
+    }
+    std::istringstream fields(t);
+    if (section == "moleculetype" && molecule.empty()) {
+      fields >> molecule;
+      charges[molecule] = 0.0;
+    } else if (section == "atoms") {
+      std::string field;
+      double charge = 0.0;
+      for (int i = 0; i < 7 && fields >> field; i++) {
+        if (i == 6) {charge = std::stod(field);}
+      }
+      charges[molecule] += charge;
+    } else if (section == "molecules") {
+      std::string name;
+      long count = 0;
+      fields >> name >> count;
+      if (charges.count(name)) {total += count * charges[name];}
+    }
+  }
+  return static_cast<int>(std::lround(total));
+}
+
+void setMolecules(const std::string & top, unsigned int solvent,
+                  const std::string & ion, unsigned int ions) {
+  std::ifstream in(top);
+  if (!in) {
+    throw SolventBoxException("Could not open " + top);
+  }
+  std::vector<std::string> lines;
+  std::string line, section;
+  size_t end = std::string::npos;
+  while (std::getline(in, line)) {
+    std::string t = trim(line.substr(0, line.find(';')));
+    if (!t.empty() && t[0] == '[') {
+      section = trim(t.substr(1, t.find(']') - 1));
+    } else if (section == "molecules" && !t.empty()) {
+      std::string name;
+      std::istringstream(t) >> name;
+      if (name == "SOL" || name == "NA" || name == "CL") {continue;}
+    }
+    lines.push_back(line);
+    if (section == "molecules" && !t.empty()) {end = lines.size();}
+  }
+  in.close();
+  if (end == std::string::npos) {
+    throw SolventBoxException("No [ molecules ] in " + top);
+  }
+  auto entry = [](const std::string & name, unsigned int count) {
+    std::string padded = name;
+    padded.resize(std::max<size_t>(name.size() + 1, 20), ' ');
+    return padded + std::to_string(count);
+  };
+  std::vector<std::string> added = {entry("SOL", solvent)};
+  if (ions > 0) {
+    added.push_back(entry(ion, ions));
+  }
+  lines.insert(lines.begin() + end, added.begin(), added.end());
+  std::ofstream out(top, std::ios::trunc);
+  for (auto & l : lines) {
+    out << l << "\n";
+  }
+  if (!out) {
+    throw SolventBoxException("Could not write " + top);
+  }
+}
@@ -0,0 +1,107 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * SolventBox
+ *
+ * Native replacement of editconf, solvate, grompp and genion for building
+ * the solvated and ionized system of a ligand. Peptides of similar size get
+ * the same box, so water boxes are cached as templates per box type and
+ * size (rounded up to a bucket):
+ *  1. the box size follows from the solute diameter like editconf -d
+ *  2. the solute is centered in a copy of the template, waters overlapping
+ *     it are removed
+ *  3. the net charge is read from the topology and neutralized by replacing
+ *     the waters farthest from the solute with ions
+ *
+ * Coordinates are in nm, boxes in .gro order:
+ * v1(x) v2(y) v3(z) v1(y) v1(z) v2(x) v2(z) v3(x) v3(y)
+*/
+#ifndef SRC_SOLVENTBOX_SOLVENTBOX_H_
+#define SRC_SOLVENTBOX_SOLVENTBOX_H_
+#include <string>
+#include <vector>
+#include <exception>
+
+class SolventBoxException : virtual public std::exception {
+ public:
+    SolventBoxException(const std::string msg1) {
+      errorMsg = "Error in SolventBox!\nMessage: " + msg1;
+    }
+
+    virtual const char * what() const throw() {
+      return errorMsg.c_str();
+    }
+
+ private:
+    std::string errorMsg;
+};
+
+struct GroAtom {
+  int resnr;
+  std::string resname;
+  std::string name;
+  float x[3];
+};
+
+struct GroSystem {
+  std::string title;
+  std::vector<GroAtom> atoms;
+  float box[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+};
+
+/* readGro(file) / writeGro(file, system):
+ *
+ * Reads and writes .gro files, velocities are dropped
+*/
+GroSystem readGro(const std::string &);
+void writeGro(const std::string &, const GroSystem &);
+/* boxSupported(bt):
+ *
+ * Returns true for the box types with templates, cubic and dodecahedron
+*/
+bool boxSupported(const std::string &);
+/* boxVectors(bt, length, box):
+ *
+ * Fills box with the vectors of a box of type bt and image distance length
+*/
+void boxVectors(const std::string &, float, float *);
+/* boxLength(solute, distance, bucket):
+ *
+ * Returns image distance of a box with at least distance between the
+ * solute, in any orientation, and the box edge, rounded up to a multiple of
+ * bucket
+*/
+float boxLength(const GroSystem &, float, float);
+/* boxTemplateName(bt, length):
+ *
+ * Returns file name of the cached template of a box
+*/
+std::string boxTemplateName(const std::string &, float);
+/* insertSolute(solute, solvent, overlap):
+ *
+ * Returns solute centered in the box of solvent, followed by all solvent
+ * molecules with no atom closer than overlap to a solute atom
+*/
+GroSystem insertSolute(const GroSystem &, const GroSystem &, float);
+/* replaceWithIons(system, soluteAtoms, ion, count, minDistance):
+ *
+ * Replaces count solvent molecules (all atoms after soluteAtoms) by ions
+ * named ion, farthest from the solute first and at least minDistance apart.
+ * The ions are moved to the end, returns number of solvent molecules left
+*/
+unsigned int replaceWithIons(GroSystem &, unsigned int, const std::string &,
+                             unsigned int, float);
+/* topologyCharge(top):
+ *
+ * Returns net charge of the molecules in top, including the ones defined
+ * in local .itp files it includes
+*/
+int topologyCharge(const std::string &);
+/* setMolecules(top, solvent, ion, ions):
+ *
+ * Replaces the SOL, NA and CL entries of [ molecules ] in top by solvent
+ * SOL and ions ion
+*/
+void setMolecules(const std::string &, unsigned int, const std::string &,
+                  unsigned int);
+
+#endif  // SRC_SOLVENTBOX_SOLVENTBOX_H_
@@ -0,0 +1,139 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "Surrogate.h"
+
+namespace {
+const char kAlphabet[] = "ARNDCQEGHILKMFPSTWYV";
+
+int residueIndex(char c) {
+  for (int i = 0; i < 20; i++) {
+    if (kAlphabet[i] == c) {
+      return i;
+    }
+  }
+  return -1;
+}
+}  // namespace
+
+const unsigned int Surrogate::kFeatures;
+
+std::vector<double> Surrogate::features(const std::string & seq) {
+  std::vector<double> x(kFeatures, 0.0);
+  x[0] = 1.0;
+  x[1] = seq.size() / 10.0;
+  if (seq.empty()) {return x;}
+  for (size_t i = 0; i < seq.size(); i++) {
+    int a = residueIndex(seq[i]);
+    if (a < 0) {continue;}
+    x[2 + a] += 1.0 / seq.size();
+    if (i + 1 < seq.size()) {
+      int b = residueIndex(seq[i + 1]);
+      if (b < 0) {continue;}
+      x[22 + 20 * a + b] += 1.0 / (seq.size() - 1);
+    }
+  }
+  return x;
+}
+
+void Surrogate::addSample(const std::string & seq, float affinity) {
+  std::vector<double> x = features(seq);
+  // Only the non-zero entries contribute, at most 1 + 1 + L + (L - 1)
+  std::vector<unsigned int> nz;
+  for (unsigned int i = 0; i < kFeatures; i++) {
+    if (x[i] != 0.0) {nz.push_back(i);}
+  }
+  for (auto i : nz) {
+    for (auto j : nz) {
+      xtx[i * kFeatures + j] += x[i] * x[j];
+    }
+    xty[i] += x[i] * affinity;
+  }
+  samples++;
+  dirty = true;
+}
+
+bool Surrogate::trained() {
+  return samples >= minSamples;
+}
+
+void Surrogate::fit() {
+  const unsigned int n = kFeatures;
+  std::vector<double> a = xtx;
+  for (unsigned int i = 1; i < n; i++) {
+    a[i * n + i] += lambda;
+  }
+  // Bias gets a tiny ridge so the system stays positive definite without
+  // data
+  a[0] += 1e-9;
+  // Cholesky decomposition, a = L L^T, L stored in lower triangle of a
+  for (unsigned int j = 0; j < n; j++) {
+    double d = a[j * n + j];
+    for (unsigned int k = 0; k < j; k++) {
+      d -= a[j * n + k] * a[j * n + k];
+    }
+    d = std::sqrt(d > 1e-12 ? d : 1e-12);
+    a[j * n + j] = d;
+    for (unsigned int i = j + 1; i < n; i++) {
+      double s = a[i * n + j];
+      for (unsigned int k = 0; k < j; k++) {
+        s -= a[i * n + k] * a[j * n + k];
+      }
+      a[i * n + j] = s / d;
+    }
+  }
+  // Forward substitution L z = X^T y
+  std::vector<double> z(n);
+  for (unsigned int i = 0; i < n; i++) {
+    double s = xty[i];
+    for (unsigned int k = 0; k < i; k++) {
+      s -= a[i * n + k] * z[k];
+    }
+    z[i] = s / a[i * n + i];
+  }
+  // Backward substitution L^T w = z
+  for (int i = n - 1; i >= 0; i--) {
+    double s = z[i];
+    for (unsigned int k = i + 1; k < n; k++) {
+      s -= a[k * n + i] * weights[k];
+    }
+    weights[i] = s / a[i * n + i];
+  }
+  dirty = false;
+}
+
+float Surrogate::predict(const std::string & seq) {
+  if (dirty) {fit();}
+  std::vector<double> x = features(seq);
+  double y = 0.0;
+  for (unsigned int i = 0; i < kFeatures; i++) {
+    y += weights[i] * x[i];
+  }
+  return y;
+}
+
+float Surrogate::logError(unsigned int generation,
+                          const std::vector<std::pair<float, float>> & pairs) {
+  if (pairs.empty()) {return 0.0f;}
+  double mae = 0.0, mse = 0.0;
+  double mp = 0.0, ma = 0.0;
+  for (auto & p : pairs) {
+    mae += std::fabs(p.first - p.second);
+    mse += (p.first - p.second) * (p.first - p.second);
+    mp += p.first;
+    ma += p.second;
+  }
+  mae /= pairs.size(); mse /= pairs.size();
+  mp /= pairs.size(); ma /= pairs.size();
+  double cov = 0.0, vp = 0.0, va = 0.0;
+  for (auto & p : pairs) {
+    cov += (p.first - mp) * (p.second - ma);
+    vp += (p.first - mp) * (p.first - mp);
+    va += (p.second - ma) * (p.second - ma);
+  }
+  double corr = (vp > 0.0 && va > 0.0) ? cov / std::sqrt(vp * va) : 0.0;
+  if (stats.is_open()) {
+    stats << generation << "\t" << samples << "\t" << pairs.size() << "\t"
+          << mae << "\t" << std::sqrt(mse) << "\t" << corr << "\n";
+    stats.flush();
+  }
+  return mae;
+}
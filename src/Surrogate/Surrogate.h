@@ -0,0 +1,96 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Surrogate
+ *
+ * Cheap binding affinity estimate of a peptide, used to pre-screen offspring
+ * before they are sent to MD and docking.
+ *
+ * Ridge regression on sequence features (length, residue composition and
+ * dipeptide (2-mer) frequencies). Training is online: every evaluated
+ * peptide updates the normal equations X^T X and X^T y, the weights are
+ * solved for (Cholesky) lazily on the next prediction.
+ *
+ * Prediction errors against the real affinities are appended to a stats
+ * file, one line per generation.
+*/
+#ifndef SRC_SURROGATE_SURROGATE_H_
+#define SRC_SURROGATE_SURROGATE_H_
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cmath>
+#include <utility>
+
+class Surrogate {
+ public:
+    Surrogate(float lambda1, unsigned int minSamples1,
+              const std::string statsFile1) {
+      lambda = lambda1;
+      minSamples = minSamples1;
+      samples = 0;
+      dirty = false;
+      xtx = std::vector<double>(kFeatures * kFeatures, 0.0);
+      xty = std::vector<double>(kFeatures, 0.0);
+      weights = std::vector<double>(kFeatures, 0.0);
+      if (!statsFile1.empty()) {
+        stats.open(statsFile1, std::ios::out | std::ios::app);
+        if (stats.tellp() == 0) {
+          stats << "generation\tsamples\tn\tmae\trmse\tcorrelation\n";
+        }
+      }
+    }
+
+    ~Surrogate() {
+      if (stats.is_open()) {stats.close();}
+    }
+
+    /* addSample(FASTA, affinity):
+     *
+     * Adds an evaluated peptide to the training data
+    */
+    void addSample(const std::string &, float);
+    /* trained():
+     *
+     * Returns true once enough samples are available for predictions
+     * to be used for screening
+    */
+    bool trained();
+    /* predict(FASTA):
+     *
+     * Returns predicted binding affinity (kcal/mol, lower is better)
+    */
+    float predict(const std::string &);
+    /* logError(generation, (predicted, actual) pairs):
+     *
+     * Appends mean absolute error, RMSE and Pearson correlation of
+     * predictions made for a generation to the stats file and returns MAE
+    */
+    float logError(unsigned int,
+                   const std::vector<std::pair<float, float>> &);
+    /* features(FASTA):
+     *
+     * Returns feature vector: bias, length / 10, 20 residue fractions,
+     * 400 dipeptide fractions
+    */
+    static std::vector<double> features(const std::string &);
+
+    static const unsigned int kFeatures = 1 + 1 + 20 + 400;
+
+ private:
+    float lambda;
+    unsigned int minSamples;
+    unsigned int samples;
+    bool dirty;
+    std::vector<double> xtx;
+    std::vector<double> xty;
+    std::vector<double> weights;
+    std::ofstream stats;
+
+    /* fit():
+     *
+     * Solves (X^T X + lambda I) w = X^T y, bias is not regularized
+    */
+    void fit();
+};
+
+#endif  // SRC_SURROGATE_SURROGATE_H_
@@ -0,0 +1,86 @@
+/* Copyright 2019 iGEM Team Freiburg 2019 */
+#include "ThreadPool.h"
+
+// Pool and index of the pool thread running on, if any
+static thread_local ThreadPool * currentPool = NULL;
+static thread_local unsigned int currentIndex = 0;
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    stop = true;
+  }
+  available.notify_all();
+  for (auto & t : threads) {
+    t.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task, bool first) {
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    std::deque<std::function<void()>> & queue = (currentPool == this)
+                                                ? queues[currentIndex]
+                                                : tasks;
+    if (first) {
+      queue.push_front(task);
+    } else {
+      queue.push_back(task);
+    }
+    queued++;
+  }
+  available.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(mtx);
+  idle.wait(lock, [this]() { return queued == 0 && running == 0; });
+}
+
+unsigned int ThreadPool::size() {
+  return threads.size();
+}
+
+bool ThreadPool::next(unsigned int index, std::function<void()> & task) {
+  if (queued == 0) {return false;}
+  // Own tasks first, then tasks of other threads, then new work
+  for (unsigned int i = 0; i < queues.size(); i++) {
+    auto & queue = queues[(index + i) % queues.size()];
+    if (!queue.empty()) {
+      task = queue.front();
+      queue.pop_front();
+      queued--;
+      return true;
+    }
+  }
+  task = tasks.front();
+  tasks.pop_front();
+  queued--;
+  return true;
+}
+
+void ThreadPool::work(unsigned int index) {
+  currentPool = this;
+  currentIndex = index;
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      available.wait(lock, [this]() { return stop || queued > 0; });
+      if (!next(index, task)) {return;}
+      running++;
+    }
+    // Tasks are expected to handle their own errors, an escaping
+    // exception must not leave the pool waiting forever
+    try {
+      task();
+    } catch (...) {}
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      running--;
+      if (queued == 0 && running == 0) {
+        idle.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,79 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * ThreadPool
+ *
+ * Fixed number of threads executing submitted tasks. Tasks may submit
+ * further tasks, e.g. a MD task submitting one docking task per receptor once
+ * it is done. These go to a queue of the submitting thread and are run before
+ * any new work; a thread without own tasks steals from the other threads.
+ * Started ligands are thus finished first. Each queue is FIFO.
+*/
+#ifndef SRC_THREADPOOL_THREADPOOL_H_
+#define SRC_THREADPOOL_THREADPOOL_H_
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+class ThreadPool {
+ public:
+    ThreadPool(unsigned int threads1) {
+      stop = false;
+      running = 0;
+      queued = 0;
+      queues.resize(threads1);
+      for (unsigned int i = 0; i < threads1; i++) {
+        threads.push_back(std::thread(&ThreadPool::work, this, i));
+      }
+    }
+
+    ~ThreadPool();
+
+    /* submit(task, first):
+     *
+     * Queues task for execution on any thread, called from a task of this
+     * pool it is queued for the calling thread. With first, it is put in
+     * front of the queue, e.g. for the next stage of work already started
+    */
+    void submit(std::function<void()>, bool first = false);
+    /* wait():
+     *
+     * Blocks until no task is queued or running anymore, including tasks
+     * submitted by tasks
+    */
+    void wait();
+    /* size():
+     *
+     * Returns number of threads
+    */
+    unsigned int size();
+
+ private:
+    std::vector<std::thread> threads;
+    // Submitted from outside the pool
+    std::deque<std::function<void()>> tasks;
+    // Submitted by the tasks running on each thread
+    std::vector<std::deque<std::function<void()>>> queues;
+    unsigned int queued;
+    std::mutex mtx;
+    std::condition_variable available;
+    std::condition_variable idle;
+    unsigned int running;
+    bool stop;
+
+    /* next(index, task):
+     *
+     * Takes the next task for thread index, returns false if none is queued.
+     * Requires mtx to be held
+    */
+    bool next(unsigned int, std::function<void()> &);
+    /* work(index):
+     *
+     * Loop of each thread, executes tasks until the pool is destroyed
+    */
+    void work(unsigned int);
+};
+
+#endif  // SRC_THREADPOOL_THREADPOOL_H_
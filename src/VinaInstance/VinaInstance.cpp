@@ -12,36 +12,28 @@ float VinaInstance::calculateBindingAffinity(int exhaustiveness,
   command.append(" --exhaustiveness ");
   command.append(std::to_string(exhaustiveness));
   command.append(" --receptor ");
-  command.append(receptor);
-  // Receptor is already in qt form (in the case of prepared input)
-  if (receptor.substr(receptor.size() - 2, 2) != "qt") {
-    command.append("qt");
-  }
+  command.append(receptorPDBQT());
   command.append(" --ligand ");
   command.append(ligand);
   command.append("qt");
   command.append(" --cpu 1");
   command.append(" --energy_range ");
   command.append(std::to_string(energy_range));
+  if (seed != 0) {
+    command.append(" --seed ");
+    command.append(std::to_string(seed));
+  }
   command.append(" --out ");
-  std::string outName = receptor.substr(receptor.find_last_of("/") + 1,
-                                        receptor.size() -
-                                        receptor.find_last_of("/") - 1);
-  command.append(ligand + outName);
+  command.append(poseFile());
 
   command.append(" --log ");
-  command.append(ligand + outName + "VINALOG");
+  command.append(poseFile() + "VINALOG");
 
   info->infoMsg("(VINA) Docking " + ligand + " against: " + receptor);
 
-  // Execute command and stream using popen
+  // Execute command and collect its output, killed on stage timeout
   std::string vinaOutput;
-  FILE * vinaOutptStream = popen(command.c_str(), "r");
-  char buff[1024];
-  while (fgets(buff, 1024, vinaOutptStream)) {
-    vinaOutput += buff;
-  }
-  pclose(vinaOutptStream);
+  runCommand(command, &vinaOutput, STAGEDOCK);
 
   // Use a regex to find the best affinity
   std::regex affinityRegEx("\n   1[ ]*([-.0-9]+)");
@@ -54,3 +46,70 @@ float VinaInstance::calculateBindingAffinity(int exhaustiveness,
 
   return stof(affinityMatch.str(1));
 }
+
+void VinaInstance::setSeed(unsigned int seed1) {
+  seed = seed1;
+}
+
+std::string VinaInstance::receptorPDBQT() {
+  // Receptor is already in qt form (in the case of prepared input)
+  if (receptor.substr(receptor.size() - 2, 2) != "qt") {
+    return receptor + "qt";
+  }
+  return receptor;
+}
+
+std::string VinaInstance::poseFile() {
+  std::string outName = receptor.substr(receptor.find_last_of("/") + 1,
+                                        receptor.size() -
+                                        receptor.find_last_of("/") - 1);
+  return ligand + outName;
+}
+
+float VinaInstance::rescore(const std::string & pose, bool optimize) {
+  // Vina takes a single model, the first one is the best
+  std::ifstream poses(pose);
+  if (!poses) {
+    throw VinaException("Could not read pose", pose, "RSC");
+  }
+  std::string seed = poseFile() + "seed";
+  std::ofstream seedFile(seed, std::ios::trunc);
+  std::string line;
+  while (std::getline(poses, line)) {
+    if (line.compare(0, 5, "MODEL") == 0) {continue;}
+    if (line.compare(0, 6, "ENDMDL") == 0) {break;}
+    seedFile << line << "\n";
+  }
+  seedFile.close();
+
+  std::string command;
+  command.append(vinaPath);
+  command.append(" --config ");
+  command.append(receptor);
+  command.append("_conf");
+  command.append(" --receptor ");
+  command.append(receptorPDBQT());
+  command.append(" --ligand ");
+  command.append(seed);
+  command.append(" --cpu 1");
+  if (optimize) {
+    command.append(" --local_only --out ");
+    command.append(poseFile());
+  } else {
+    command.append(" --score_only");
+  }
+
+  info->infoMsg("(VINA) " + std::string(optimize ? "Optimizing" : "Scoring")
+                + " pose " + pose + " against: " + receptor);
+
+  std::string vinaOutput;
+  runCommand(command, &vinaOutput, STAGEDOCK);
+
+  std::regex affinityRegEx("Affinity:[ ]*([-.0-9]+)");
+  std::smatch affinityMatch;
+  if (!std::regex_search(vinaOutput, affinityMatch, affinityRegEx)) {
+    throw VinaException("No affinity in Vina output:\n" + vinaOutput, pose,
+                        "RSC");
+  }
+  return stof(affinityMatch.str(1));
+}
@@ -5,6 +5,9 @@
  * Provides functionality to prepare and execute an AutoDock Vina docking
  * using system() calls.
  *
+ * Besides the global search, a pose docked before (e.g. against another
+ * conformation of the receptor) can be rescored as it is (--score_only) or
+ * optimized locally (--local_only), which costs a fraction of a search.
 */
 #ifndef SRC_VINAINSTANCE_VINAINSTANCE_H_
 #define SRC_VINAINSTANCE_VINAINSTANCE_H_
@@ -18,6 +21,7 @@
 #include <fstream>
 #include <exception>
 #include "../Info.h"
+#include "../Process/Process.h"
 class VinaException : virtual public std::exception {
  public:
     std::string type;
@@ -71,8 +75,15 @@ class VinaInstance {
       receptor = receptor1;
       ligand = ligand1;
       info = info1;
+      seed = 0;
     }
 
+    /* setSeed(seed):
+     *
+     * Docks with this random seed (vina --seed), 0 (default): vina picks one
+    */
+    void setSeed(unsigned int);
+
     /* calculateBindingAffinity(exhaustiveness, energy_range):
      *
      * Does a docking with specified receptor and ligand using
@@ -81,12 +92,33 @@ class VinaInstance {
      *
     */
     float calculateBindingAffinity(int, int);
+    /* rescore(pose, optimize):
+     *
+     * Returns affinity of the best pose in pose (PDBQT as written by Vina)
+     * against the receptor, optimized locally first if optimize. The
+     * optimized pose is written where calculateBindingAffinity writes its
+     * poses
+    */
+    float rescore(const std::string &, bool);
+    /* poseFile():
+     *
+     * Returns file the docked poses of the ligand against the receptor are
+     * written to
+    */
+    std::string poseFile();
 
  private:
     std::string vinaPath;
     std::string receptor;
     std::string ligand;
     Info * info;
+    unsigned int seed;
+
+    /* receptorPDBQT():
+     *
+     * Returns PDBQT of the receptor
+    */
+    std::string receptorPDBQT();
 };
 
 #endif  // SRC_VINAINSTANCE_VINAINSTANCE_H_
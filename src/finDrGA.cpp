@@ -1,39 +1,6 @@
 /* Copyright 2019 iGEM Team Freiburg 2019 */
 #include "finDrGA.h"
 
-void mImage(const std::string pdb) {
-  // Read receptor file
-  std::ifstream t(pdb);
-  t.seekg(0, std::ios::end);
-  size_t size = t.tellg();
-  std::string buffer(size, ' ');
-  t.seekg(0);
-  t.read(&buffer[0], size);
-  t.close();
-
-  std::string output;
-  // Read line per line, set min and max accordingly
-  std::string line;
-  std::stringstream receptorStream(buffer);
-  while (std::getline(receptorStream, line, '\n')) {
-    std::string newline = line;
-    if (line.substr(0, 4) == "ATOM" || line.substr(0, 6) == "HETATM") {
-      float x = - stof(line.substr(30, 8));
-      char invertedX[9];  // Null terminating char at the end => 9
-      sprintf(invertedX, "%8.3f", x);
-      for (unsigned int i = 0; i < 8; i++) {
-        newline[30 + i] = invertedX[i];
-      }
-    }
-    output.append(newline + "\n");
-  }
-
-  std::ofstream outf(pdb, std::ofstream::out | std::ofstream::trunc);
-  outf << output;
-  outf.close();
-}
-
-
 void check(const std::string p) {
   struct stat st;
   if (stat(p.c_str(), &st) != 0) {
@@ -77,58 +44,6 @@ std::string genToStr(std::vector<std::string> gen, PoolMGR * poolmgr) {
   return returnStr;
 }
 
-// Get PDBs from initialpop folder
-std::vector<std::string> getInitialPop(std::string dir) {
-  std::string command;
-  command.append("ls ");
-  command.append(dir);
-  command.append(" | cat");
-  std::string output;
-  FILE * lsOutputStream = popen(command.c_str(), "r");
-  char buf[1024];
-  while (fgets(buf, 1024, lsOutputStream)) {
-    output += buf;
-  }
-  pclose(lsOutputStream);
-
-  std::vector<std::string> result;
-  std::string line;
-  std::stringstream outputStream(output);
-  while (std::getline(outputStream, line, '\n')) {
-    result.push_back(line);
-  }
-  return result;
-}
-
-// Get a random sample of PDB filenames from specified folder
-std::vector<std::string> getRandomSample(std::string dir, int amount) {
-  std::string command;
-  command.append("ls ");
-  command.append(dir);
-  command.append(" | shuf -n ");
-  command.append(std::to_string(amount));
-  std::string output;
-  FILE * lsOutputStream = popen(command.c_str(), "r");
-  char buf[1024];
-  while (fgets(buf, 1024, lsOutputStream)) {
-    output += buf;
-  }
-  pclose(lsOutputStream);
-  // Create and return vector
-  std::vector<std::string> result;
-  std::string line;
-  std::stringstream outputStream(output);
-  while (std::getline(outputStream, line, '\n')) {
-    result.push_back(line);
-  }
-  return result;
-}
-
-// Get a single PDB
-std::string getRandomPDB(std::string dir) {
-  return getRandomSample(dir, 1).at(0);
-}
-
 // Get receptor filenames
 std::vector<std::string> getReceptorsM(std::string dir, bool prep = false) {
   // Read all pdb files in a directory
@@ -158,91 +73,6 @@ std::vector<std::string> getReceptorsM(std::string dir, bool prep = false) {
   return result;
 }
 
-void prepareConfig(std::string receptor) {
-  // Generate conf file for docking
-
-  // Read receptor file
-  std::ifstream t(receptor);
-  t.seekg(0, std::ios::end);
-  size_t size = t.tellg();
-  std::string buffer(size, ' ');
-  t.seekg(0);
-  t.read(&buffer[0], size);
-  t.close();
-
-  // std::cout << "Read receptor file!" << std::endl;
-
-  // For max and min no sorting is required
-  float xmin = std::numeric_limits<float>::infinity();
-  float ymin = std::numeric_limits<float>::infinity();
-  float zmin = std::numeric_limits<float>::infinity();
-  float xmax = - std::numeric_limits<float>::infinity();
-  float ymax = - std::numeric_limits<float>::infinity();
-  float zmax = - std::numeric_limits<float>::infinity();
-
-  // Read line per line, set min and max accordingly
-  std::string line;
-  std::stringstream receptorStream(buffer);
-  while (std::getline(receptorStream, line, '\n')) {
-    if (line.substr(0, 4) == "ATOM" || line.substr(0, 6) == "HETATM") {
-      float x = stof(line.substr(31, 8));
-      xmin = (x < xmin) ? x : xmin;
-      xmax = (x > xmax) ? x : xmax;
-      float y = stof(line.substr(39, 8));
-      ymin = (y < ymin) ? y : ymin;
-      ymax = (y > ymax) ? y : ymax;
-      float z = stof(line.substr(47, 8));
-      zmin = (z < zmin) ? z : zmin;
-      zmax = (z > zmax) ? z : zmax;
-    }
-  }
-
-  float sizex = xmax - xmin;
-  float sizey = ymax - ymin;
-  float sizez = zmax - zmin;
-
-  // float offsetx = xmin + sizex / 2;
-  float offsetx = xmin + sizex / 2.0;
-  float offsety = ymin + sizey / 2.0;
-  float offsetz = zmin + sizez / 2.0;
-
-  std::string outfile = receptor + "_conf";
-
-  std::ofstream confFile;
-  confFile.open(outfile.c_str(), std::ios::trunc);
-  if (!confFile) {
-    std::cout << "Could not open config file!" << std::endl;
-    exit(-1);
-  }
-  confFile << "center_x = " << offsetx << std::endl;
-  confFile << "center_y = " << offsety << std::endl;
-  confFile << "center_z = " << offsetz << std::endl;
-  confFile << std::endl;
-  confFile << "size_x = " << sizex + 30 << std::endl;
-  confFile << "size_y = " << sizey + 30 << std::endl;
-  confFile << "size_z = " << sizez + 30 << std::endl;
-  confFile.close();
-}
-
-void preparePDBQT(std::string receptor,
-                   std::string pythonShPath,
-                   std::string mgltoolstilitiesPath) {
-  // Generate a PDBQT
-  std::string command;
-  command.append(pythonShPath);
-  command.append(" ");
-  command.append(mgltoolstilitiesPath);
-  command.append("/prepare_receptor4.py -r ");
-  command.append(receptor);
-  command.append(" -A bonds_hydrogens -U nphs -o ");
-  command.append(receptor);
-  command.append("qt");
-  int success = system(command.c_str());
-  if (success != 0) {
-    throw VinaException("Could not generate pdbqt file for receptor", receptor);
-  }
-}
-
 int main(int argc, char *argv[]) {
   /* Get command line arguments */
   cxxopts::Options options("finDrGA", "Find ligands through the principles"
@@ -258,7 +88,12 @@ int main(int argc, char *argv[]) {
     ("mi",
      "(optional) Convert the target into its mirror-image (L to D or D to L)\n"
      "Target has to be unprepared (just the .pdb file, no .pdbqt and conf)\n"
-     "Attention: Original target gets overwritten!"
+     "The mirror image is prepared in workingDir/receptorcache, the original\n"
+     "target is left as it is"
+     , cxxopts::value<bool>()->default_value("false"))
+    ("local",
+     "(optional) Run on this machine only, without MPI and PoolWorker "
+     "processes; all ligands are evaluated by the threads of finDrGA"
      , cxxopts::value<bool>()->default_value("false"))
     ;
   unsigned int gen;
@@ -266,6 +101,7 @@ int main(int argc, char *argv[]) {
   float mutateProb;
   float genCpy;
   bool mirrorImage;
+  bool local;
   try {
     auto result = options.parse(argc, argv);
     gen = result["n"].as<unsigned int>();
@@ -273,6 +109,7 @@ int main(int argc, char *argv[]) {
     mutateProb = result["p"].as<float>();
     genCpy = result["c"].as<float>();
     mirrorImage = result["mi"].as<bool>();
+    local = result["local"].as<bool>();
   } catch (std::exception& e) {
     std::cout << e.what() << std::endl;
     std::cout << options.help() << std::endl;
@@ -280,18 +117,19 @@ int main(int argc, char *argv[]) {
   }
   /**************/
   /* Initialize OpenMPI */
-  int world_size, world_rank;
-  // Initialize the MPI environment
-  MPI_Init(&argc , &argv);
-  // Get the number of processes
-  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
-  // Get the rank of the process
-  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size = 1, world_rank = 0;
+  if (!local) {
+    // Initialize the MPI environment
+    MPI_Init(&argc , &argv);
+    // Get the number of processes
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    // Get the rank of the process
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  }
   // Print out information about main process
   /**************/
-  /* Prepare global random engine */
-  std::random_device rd;
-  std::mt19937 mt(rd());
+  /* Prepare global random engine, seeded from the config */
+  std::mt19937 mt;
   /**************/
   /* Read config */
   INIReader reader("config.ini");
@@ -320,6 +158,17 @@ int main(int argc, char *argv[]) {
   bool receptorsPrep = reader.GetBoolean("finDrGA", "receptorsprep", false);
   int exhaustiveness = reader.GetInteger("VINA", "exhaustiveness", 1);
   int energy_range = reader.GetInteger("VINA", "energy_range", 5);
+  std::string aggregationName = reader.Get("VINA", "aggregation", "min");
+  float kT = reader.GetReal("VINA", "boltzmannkt", 0.593);
+  bool earlyAbort = reader.GetBoolean("VINA", "earlyabort", false);
+  float abortMargin = reader.GetReal("VINA", "abortmargin", 1.0);
+  // Rescoring of poses against further receptors needs the elite cut too
+  bool rescore = reader.Get("VINA", "rescore", "none") != "none";
+  // Mirror image, docking boxes and PDBQT of the receptors
+  ReceptorPrepSettings receptorPrep = readReceptorPrepSettings(reader);
+  receptorPrep.mirror = mirrorImage;
+  // Conformations closer than this (pocket RMSD, Angstrom) docked as one
+  float ensembleCutoff = reader.GetReal("VINA", "ensemblecutoff", 0.0);
   // Required by gromacs
   std::string settings = reader.Get("GROMACS", "settings", "");
   check(settings);
@@ -334,8 +183,46 @@ int main(int argc, char *argv[]) {
   std::string initialpdbs = reader.Get("finDrGA", "initialpdbs", "");
   // Path to PDB files to take random sample from
   std::string randompdbs = reader.Get("finDrGA", "randompdbs", "");
+  // Peptide lengths taken from them, 0: no limit
+  unsigned int minLength = reader.GetInteger("finDrGA", "minlength", 0);
+  unsigned int maxLength = reader.GetInteger("finDrGA", "maxlength", 0);
   // PDB generation of initial population
   bool pymolgen = reader.GetBoolean("finDrGA", "pymolgen", false);
+  // NSGA-II selection over the affinities to each receptor
+  bool multiObjective = reader.GetBoolean("finDrGA", "multiobjective", false);
+  // Surrogate pre-screening of offspring
+  bool useSurrogate = reader.GetBoolean("finDrGA", "surrogate", false);
+  float surrogateOversample = reader.GetReal("finDrGA", "surrogateoversample",
+                                             3.0);
+  float surrogateLambda = reader.GetReal("finDrGA", "surrogatelambda", 1.0);
+  int surrogateMinSamples = reader.GetInteger("finDrGA",
+                                              "surrogateminsamples", 30);
+  // Backup copies of stragglers
+  float speculation = reader.GetReal("finDrGA", "speculation", 3.0);
+  // Failure detection
+  float workerTimeout = reader.GetReal("finDrGA", "workertimeout", 60.0);
+  // Threads of the master running jobs, by default all cores but one
+  // (all cores when running locally, there are no workers to coordinate)
+  int masterThreads = reader.GetInteger("finDrGA", "masterthreads", -1);
+  if (masterThreads < 0) {
+    masterThreads = omp_get_max_threads() - (local ? 0 : 1);
+  }
+  // Breeding ahead while the last jobs of a generation run
+  bool breedAhead = reader.GetBoolean("finDrGA", "breedahead", true);
+  int pdbThreads = reader.GetInteger("finDrGA", "pdbthreads", 4);
+  // Elastic pool: extra workers spawned while the backlog is long
+  std::string workerBinary = reader.Get("finDrGA", "poolworker",
+                                        "./PoolWorker");
+  int maxSpawn = reader.GetInteger("finDrGA", "maxspawn", 0);
+  float spawnBacklog = reader.GetReal("finDrGA", "spawnbacklog", 2.0);
+  float retireIdle = reader.GetReal("finDrGA", "retireidle", 60.0);
+  // Everything random derives from the campaign seed
+  unsigned int seed = campaignSeed(reader.GetInteger("finDrGA", "seed", 0));
+  mt.seed(deriveSeed(seed, "initial population"));
+  if (local && masterThreads == 0) {
+    std::cout << "masterthreads can not be 0 with --local" << std::endl;
+    return 1;
+  }
   if (!initialpdbs.empty()) {check(initialpdbs);}
   if (!randompdbs.empty()) {check(randompdbs);}
   /**************/
@@ -343,24 +230,33 @@ int main(int argc, char *argv[]) {
   /* Print info about master node */
   info.infoMsg("Master has rank " + std::to_string(world_rank)
                + "(should be 0)");
+  info.infoMsg("Campaign seed " + std::to_string(seed)
+               + " (seed in config.ini to repeat this run)");
   /* Get receptors */
   std::vector<std::string> receptors;
-  std::vector<std::string> receptorfiles = getReceptorsM(receptorsPath,
-                                                        receptorsPrep);
-  for (auto s : receptorfiles) {
-    if (mirrorImage) {
-      mImage(receptorsPath + "/" + s);
-    }
+  // Prepared receptors are copies, the input files are never modified
+  bool prepared = receptorsPrep && !mirrorImage;
+  for (auto s : getReceptorsM(receptorsPath, prepared)) {
     receptors.push_back(receptorsPath + "/" + s);
   }
-  if (mirrorImage || !receptorsPrep) {
-    for (auto s : receptors) {
-      prepareConfig(s);
-      try {
-        preparePDBQT(s, pythonShPath, mgltoolstilitiesPath);
-      } catch (std::exception& e) {
-        info.errorMsg(e.what(), true);
-      }
+  if (!prepared) {
+    try {
+      receptors = prepareReceptors(receptors, receptorPrep,
+                                   omp_get_max_threads(), world_size, &info);
+    } catch (std::exception& e) {
+      info.errorMsg(e.what(), true);
+    }
+  }
+  std::vector<float> receptorWeights;
+  if (ensembleCutoff > 0.0) {
+    try {
+      ReceptorEnsemble ensemble = reduceEnsemble(receptors, ensembleCutoff,
+                                                 workDir + "/receptorensemble",
+                                                 &info);
+      receptors = ensemble.representatives;
+      receptorWeights = ensemble.weights;
+    } catch (std::exception& e) {
+      info.errorMsg(e.what(), true);
     }
   }
   /**************/
@@ -374,38 +270,134 @@ int main(int argc, char *argv[]) {
                   settings.c_str(), forcefield.c_str(), forcefieldPath.c_str(),
                   water.c_str(), boundingboxtype.c_str(), boxsize,
                   clustercutoff, &info, pymolgen);
+  try {
+    poolmgr.setAggregation(aggregationFromString(aggregationName), kT,
+                           receptorWeights);
+  } catch (std::exception& e) {
+    info.errorMsg(e.what(), true);
+  }
+  poolmgr.setSpeculation(speculation);
+  poolmgr.setSeed(seed);
+  poolmgr.setPDBThreads(pdbThreads);
+  if (!local) {
+    poolmgr.sendReceptors(world_size);
+    poolmgr.setWorkerTimeout(workerTimeout);
+    if (maxSpawn > 0) {
+      poolmgr.setElastic(workerBinary, maxSpawn, spawnBacklog, retireIdle,
+                         world_size);
+    }
+  }
+  std::unique_ptr<WorkerCore> localCore;
+  if (masterThreads > 0) {
+    try {
+      PipelineSettings pipelineSettings = readPipelineSettings(reader);
+      localCore.reset(new WorkerCore(pipelineSettings, receptors,
+                                     masterThreads, &info));
+    } catch (std::exception& e) {
+      info.errorMsg(e.what(), true);
+    }
+    poolmgr.setLocalCore(localCore.get());
+    info.infoMsg("Master runs jobs on " + std::to_string(masterThreads)
+                 + " threads");
+  }
   finDrGAFitnessFunc fitnessFunc(&poolmgr);
   finDrGAGenome vinaGenome(&mt);
   // Initial pdbs
   std::vector<std::string> startingSequences;
   info.infoMsg("Gathering the initial population...");
+  // Libraries are indexed in workDir, only files new since the last run are
+  // parsed. Duplicates, broken files and lengths out of range are left out
   std::vector<std::string> initPopulation;
-  if (initialpdbs != "") {
-    info.infoMsg("Adding peptides from initialpdbs & "
-                 "randompdbs to the gene pool...");
-    std::vector<std::string> initPDB = getInitialPop(initialpdbs);
-    for (auto i : initPDB) {
-      initPopulation.push_back(initialpdbs + "/" + i);
+  std::vector<std::string> initSequences;
+  try {
+    if (initialpdbs != "") {
+      info.infoMsg("Adding peptides from initialpdbs & "
+                   "randompdbs to the gene pool...");
+      Catalog catalog(initialpdbs, workDir + "/" + "catalog_initialpdbs");
+      info.infoMsg("Indexed " + std::to_string(catalog.update())
+                   + " new or changed files of initialpdbs");
+      for (auto & entry : catalog.usable(minLength, maxLength)) {
+        initPopulation.push_back(catalog.path(entry));
+        initSequences.push_back(entry.sequence);
+      }
     }
-  }
-  if (randompdbs != "" && gen - initPopulation.size() > 0) {
-    std::vector<std::string> randomSample = getRandomSample(randompdbs,
-                                                 gen - initPopulation.size());
-    for (auto i : randomSample) {
-      initPopulation.push_back(randompdbs + "/" + i);
+    if (randompdbs != "" && noPop > initPopulation.size()) {
+      Catalog catalog(randompdbs, workDir + "/" + "catalog_randompdbs");
+      info.infoMsg("Indexed " + std::to_string(catalog.update())
+                   + " new or changed files of randompdbs");
+      std::set<std::string> taken(initSequences.begin(),
+                                  initSequences.end());
+      for (auto & entry : catalog.sample(noPop - initPopulation.size(),
+                                         minLength, maxLength, taken, mt)) {
+        initPopulation.push_back(catalog.path(entry));
+        initSequences.push_back(entry.sequence);
+      }
     }
+  } catch (std::exception& e) {
+    info.errorMsg(e.what(), true);
   }
+  std::vector<std::string> evaluated;
   if (pymolgen) {
-    startingSequences = poolmgr.getFASTAS(initPopulation);
-    poolmgr.addElementsFromFASTAs(startingSequences, world_size);
+    startingSequences = initSequences;
+    evaluated = poolmgr.addElementsFromFASTAs(startingSequences, world_size);
   } else {
-    startingSequences = poolmgr.addElementsFromPDBs(initPopulation, world_size);
+    startingSequences = poolmgr.addElementsFromPDBs(initPopulation, world_size,
+                                                    initSequences);
+    evaluated = startingSequences;
+  }
+  Surrogate surrogate(surrogateLambda, surrogateMinSamples,
+                      useSurrogate ? workDir + "/" + "surrogate" : "");
+  if (useSurrogate) {
+    for (auto s : evaluated) {
+      surrogate.addSample(s, poolmgr.getAffinity(s));
+    }
   }
   /**************/
   /* GA */
   std::vector<std::string> curGen = startingSequences;
   info.infoMsg("POPULATION SIZE: " + std::to_string(curGen.size()));
-  for (unsigned int i = 0; i < noPop; i++) {
+  Diversity diversity(workDir + "/" + "diversity");
+  // Every generation breeds with its own seed, the same no matter how
+  // much of the engine earlier generations used up
+  auto generationSeed = [seed](unsigned int generation) {
+    return deriveSeed(seed, "generation " + std::to_string(generation));
+  };
+  auto isKnown = [&poolmgr](const std::string & s) {
+    return poolmgr.contains(s);
+  };
+  auto breed = [&](GenAlgInst<std::string, finDrGAGenome,
+                              finDrGAFitnessFunc> & gi,
+                   finDrGAGenome & genome,
+                   std::vector<std::string> & parents,
+                   std::unordered_map<std::string, float> & predictions) {
+    if (multiObjective) {
+      return gi.nextGenMO(genome, fitnessFunc, parents, mutateProb, genCpy,
+                          noPop, isKnown);
+    } else if (useSurrogate && surrogate.trained()) {
+      // Over-generate and only keep the offspring with the best predicted
+      // affinity
+      return gi.nextGenScreened(genome, fitnessFunc, parents, mutateProb,
+                                genCpy, noPop, isKnown,
+                                [&surrogate, &predictions]
+                                (const std::string & s) {
+                                  float p = surrogate.predict(s);
+                                  predictions[s] = p;
+                                  return -p;
+                                }, surrogateOversample);
+    }
+    return gi.nextGenNovel(genome, fitnessFunc, parents, mutateProb, genCpy,
+                           noPop, isKnown);
+  };
+  // Diversity and best fitness of the current generation
+  auto logDiversity = [&](unsigned int generation) {
+    float best = - std::numeric_limits<float>::infinity();
+    for (auto g : curGen) {
+      float fitness = fitnessFunc.calculateFitness(g);
+      best = (fitness > best) ? fitness : best;
+    }
+    diversity.log(generation, diversity.calculate(curGen), best);
+  };
+  for (unsigned int i = 0; i < gen; i++) {
     // Output to log file
     std::string output = "Generation: ";
     output.append(std::to_string(i));
@@ -414,24 +406,82 @@ int main(int argc, char *argv[]) {
     output.append("\nItems in Pool Manager:\n");
     output.append(poolmgr.toStr());
     info.infoMsg(output);
-    // Get new generation
-    curGen = inst.nextGen(vinaGenome, fitnessFunc, curGen, mutateProb, genCpy);
-    // Remove duplicates for adding
-    std::vector<std::string> curGenDistinct;
-    curGenDistinct = curGen;
-    // Sort and then remove consecutive duplicates
-    std::sort(curGenDistinct.begin(), curGenDistinct.end());
-    curGenDistinct.erase(std::unique(curGenDistinct.begin(),
-                                     curGenDistinct.end()),
-                          curGenDistinct.end());
+    logDiversity(i);
+    // Get new generation, every offspring being a sequence not yet in the
+    // pool so each generation evaluates as many new peptides as possible
+    std::unordered_map<std::string, float> predictions;
+    mt.seed(generationSeed(i));
+    curGen = breed(inst, vinaGenome, curGen, predictions);
+    if (curGen.size() < noPop) {
+      info.infoMsg("Could only generate " + std::to_string(curGen.size())
+                   + " novel individuals");
+    }
+    // The next selection copies the best genCpy of this generation as it
+    // really is (it may be short of noPop). Offspring worse than that many
+    // copied individuals can not make it, workers may stop docking them
+    // early. With fewer copied ones some offspring get in anyway
+    if ((earlyAbort || rescore) && !multiObjective) {
+      std::vector<float> copied;
+      for (auto g : curGen) {
+        if (poolmgr.contains(g)) {copied.push_back(poolmgr.getAffinity(g));}
+      }
+      std::sort(copied.begin(), copied.end());
+      unsigned int elite = static_cast<unsigned int>(genCpy * curGen.size());
+      float bound = std::numeric_limits<float>::infinity();
+      if (elite > 0 && elite <= copied.size()) {bound = copied[elite - 1];}
+      info.infoMsg("Elite cut: " + std::to_string(bound));
+      poolmgr.setCutoff(bound);
+      if (earlyAbort) {
+        poolmgr.setBound(bound, abortMargin);
+      }
+    }
+    // While the last jobs of this generation run, breed the next one from
+    // the results so far on an engine with the seed of the next generation
+    // and prefetch its PDBs. The real breeding uses the same draws, so most
+    // of it is reused.
+    if (breedAhead && i + 1 < gen) {
+      poolmgr.setIdleHook([&]() {
+        std::mt19937 aheadMt(generationSeed(i + 1));
+        GenAlgInst<std::string, finDrGAGenome, finDrGAFitnessFunc>
+                                                      aheadInst(&aheadMt);
+        finDrGAGenome aheadGenome(&aheadMt);
+        std::unordered_map<std::string, float> aheadPredictions;
+        poolmgr.prefetch(breed(aheadInst, aheadGenome, curGen,
+                               aheadPredictions));
+      });
+    } else {
+      poolmgr.setIdleHook(std::function<void()>());
+    }
     // Add the new elements
     try {
-      poolmgr.addElementsFromFASTAs(curGenDistinct, world_size);
+      evaluated = poolmgr.addElementsFromFASTAs(curGen, world_size);
     } catch (std::exception& e) {
       info.errorMsg(e.what(), true);
     }
+    // Train surrogate on the new results, log its error on them
+    if (useSurrogate) {
+      std::vector<std::pair<float, float>> errors;
+      for (auto s : evaluated) {
+        float aff = poolmgr.getAffinity(s);
+        if (predictions.count(s) != 0) {
+          errors.push_back(std::make_pair(predictions[s], aff));
+        }
+        surrogate.addSample(s, aff);
+      }
+      if (!errors.empty()) {
+        float mae = surrogate.logError(i, errors);
+        info.infoMsg("Surrogate mean absolute error: " + std::to_string(mae)
+                     + " kcal/mol over " + std::to_string(errors.size())
+                     + " peptides");
+      }
+    }
   }
+  // The last generation is evaluated, but never bred from
+  logDiversity(gen);
   /**************/
-  MPI_Finalize();
+  if (!local) {
+    poolmgr.shutdownWorkers(world_size);
+    MPI_Finalize();
+  }
   return 0;
 }
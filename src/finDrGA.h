@@ -8,12 +8,22 @@
 #ifndef SRC_FINDRGA_H_
 #define SRC_FINDRGA_H_
 #include <mpi.h>
+#include <omp.h>
 #include <sys/stat.h>
 #include <fstream>
+#include <memory>
 #include "lib/GenAlgInst.h"
 #include "finDrGAGenome.h"
 #include "finDrGAFitnessFunc.h"
 #include "PoolManager/PoolManager.h"
+#include "Diversity/Diversity.h"
+#include "Surrogate/Surrogate.h"
+#include "Pocket/Pocket.h"
+#include "PDB/PDB.h"
+#include "Catalog/Catalog.h"
+#include "ReceptorPrep/ReceptorPrep.h"
+#include "Ensemble/Ensemble.h"
+#include "Seed/Seed.h"
 #include "inih/INIReader.h"
 #include "cxxopts/cxxopts.hpp"
 #endif  // SRC_FINDRGA_H_
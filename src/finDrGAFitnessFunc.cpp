@@ -4,3 +4,15 @@
 float finDrGAFitnessFunc::calculateFitness(std::string & inp, ...) {
   return (-1.0) * poolmgr->getAffinity(inp);
 }
+
+std::vector<float> finDrGAFitnessFunc::calculateObjectives(std::string & inp) {
+  std::vector<float> objectives = poolmgr->getAffinities(inp);
+  // Failed MD or docking, same affinity as in getAffinity for each receptor
+  if (objectives.empty()) {
+    objectives.assign(poolmgr->getNumReceptors(), poolmgr->getAffinity(inp));
+  }
+  for (unsigned int i = 0; i < objectives.size(); i++) {
+    objectives.at(i) *= -1.0;
+  }
+  return objectives;
+}
@@ -8,6 +8,7 @@
 #ifndef SRC_FINDRGAFITNESSFUNC_H_
 #define SRC_FINDRGAFITNESSFUNC_H_
 #include <string>
+#include <vector>
 #include "lib/FitnessFunction.h"
 #include "PoolManager/PoolManager.h"
 class finDrGAFitnessFunc {
@@ -20,6 +21,12 @@ class finDrGAFitnessFunc {
     }
 
     float calculateFitness(std::string &, ...);
+    /* calculateObjectives(FASTA):
+     *
+     * Returns negated binding affinity to each receptor, for multi-objective
+     * selection
+    */
+    std::vector<float> calculateObjectives(std::string &);
 };
 
 #endif  // SRC_FINDRGAFITNESSFUNC_H_
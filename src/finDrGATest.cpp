@@ -9,6 +9,7 @@
 
 /**** Tests for GenAlgInst ****/
 #include <random>
+#include <set>
 #include "lib/GenAlgInst.h"
 #include "lib/Genome.h"
 /** TEST #1: Top individuals being copied **/
@@ -195,6 +196,67 @@ TEST(GenAlgInst, mutate25) {
   ASSERT_NEAR(2, (float) numberMut / (float) n, 0.1);
 }
 
+/** TEST #4: Offspring are novel **/
+class TestGenomeNovel : public Genome<int> {
+ public:
+    int counter = 0;
+    int crossOver(int& x, int& y, ...) {
+      return (x + y + counter++) % 40;
+    }
+    int mutate(int& x, ...) {
+      return x;
+    }
+};
+
+TEST(GenAlgInst, novel) {
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  TestFitnessFunctionCpy testFitnessFunction;
+  TestGenomeNovel testGenome;
+  GenAlgInst<int, TestGenomeNovel, TestFitnessFunctionCpy> genAlgInst(&mt);
+
+  std::vector<int> initialPop = {1, 2, 3, 4, 5, 6, 7, 8};
+  // Everything below 20 has already been evaluated
+  std::vector<int> nextgen = genAlgInst.nextGenNovel(testGenome,
+                                    testFitnessFunction,
+                                    initialPop,
+                                    0,
+                                    0.25,
+                                    10,
+                                    [](const int & x) { return x < 20; });
+  ASSERT_EQ(10u, nextgen.size());
+  // Top two copied, then eight distinct new ones
+  ASSERT_EQ(8, nextgen.at(0));
+  ASSERT_EQ(7, nextgen.at(1));
+  std::set<int> offspring(nextgen.begin() + 2, nextgen.end());
+  ASSERT_EQ(8u, offspring.size());
+  ASSERT_GE(*offspring.begin(), 20);
+}
+
+TEST(GenAlgInst, screened) {
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  TestFitnessFunctionCpy testFitnessFunction;
+  TestGenomeNovel testGenome;
+  GenAlgInst<int, TestGenomeNovel, TestFitnessFunctionCpy> genAlgInst(&mt);
+
+  std::vector<int> initialPop = {1, 2, 3, 4};
+  // Oversampling by 5 breeds all 20 offspring >= 20 and < 40 (no copies),
+  // keeping the four with the highest score
+  std::vector<int> nextgen = genAlgInst.nextGenScreened(testGenome,
+                                    testFitnessFunction,
+                                    initialPop,
+                                    0,
+                                    0,
+                                    4,
+                                    [](const int & x) { return x < 20; },
+                                    [](const int & x) { return (float) -x; },
+                                    5);
+  ASSERT_EQ(4u, nextgen.size());
+  std::set<int> offspring(nextgen.begin(), nextgen.end());
+  ASSERT_EQ(std::set<int>({20, 21, 22, 23}), offspring);
+}
+
 /**** PDB to FASTA tests ****/
 #include "PoolManager/PoolManager.h"
 #include "Info.h"
@@ -252,7 +314,1513 @@ TEST(Serialization, Pairs) {
   deserialize(out, seri, resultsSize);
   ASSERT_EQ(test, out);
 }
+TEST(Serialization, VectorPairs) {
+  std::vector<std::pair<std::string, std::vector<float>>> test;
+  test.push_back(std::make_pair("blub", std::vector<float>({2.013f, -7.1f})));
+  test.push_back(std::make_pair("blab", std::vector<float>()));
+  test.push_back(std::make_pair("blib", std::vector<float>({-223323.231f})));
+
+  unsigned int resultsSize;
+  char * seri = serialize(test, &resultsSize);
+
+  std::vector<std::pair<std::string, std::vector<float>>> out;
+  deserialize(out, seri, resultsSize);
+  ASSERT_EQ(test, out);
+  delete[] seri;
+}
+
+/**** NSGA-II tests ****/
+#include "lib/NSGA2.h"
+
+TEST(NSGA2, Fronts) {
+  // Maximization of both objectives
+  std::vector<std::vector<float>> objs = {
+    {1, 5}, {2, 4}, {3, 3},  // Pareto front
+    {1, 3}, {2, 2},          // Second front
+    {0, 0},                  // Third front
+    {NAN, 6}                 // Not dominated by anything
+  };
+  std::vector<std::vector<size_t>> fronts = NSGA2::nonDominatedSort(objs);
+  ASSERT_EQ(3u, fronts.size());
+  ASSERT_EQ(std::vector<size_t>({0, 1, 2, 6}), fronts.at(0));
+  ASSERT_EQ(std::vector<size_t>({3, 4}), fronts.at(1));
+  ASSERT_EQ(std::vector<size_t>({5}), fronts.at(2));
+  std::vector<float> crowding = NSGA2::crowdingDistance(objs, {0, 1, 2});
+  ASSERT_TRUE(std::isinf(crowding.at(0)));
+  ASSERT_NEAR(2.0, crowding.at(1), 1e-6);
+  ASSERT_TRUE(std::isinf(crowding.at(2)));
+}
+/**** Aggregation tests ****/
+#include "Aggregation/Aggregation.h"
+
+TEST(Aggregation, Types) {
+  std::vector<float> affs = {-7.0, -5.0, NAN, -6.0};
+  ASSERT_FLOAT_EQ(-7.0, aggregate(affs, AGGMIN, 0.593));
+  ASSERT_FLOAT_EQ(-6.0, aggregate(affs, AGGMEAN, 0.593));
+  float boltzmann = aggregate(affs, AGGBOLTZMANN, 0.593);
+  ASSERT_LT(boltzmann, -6.0);
+  ASSERT_GT(boltzmann, -7.0);
+  // Low temperature limit is the minimum, offset by kT ln(3)
+  ASSERT_NEAR(-7.0 + 0.01 * std::log(3.0),
+              aggregate(affs, AGGBOLTZMANN, 0.01), 1e-4);
+}
+
+TEST(Aggregation, Weights) {
+  std::vector<float> affs = {-6.0, -8.0, NAN};
+  std::vector<float> weights = {0.75, 0.125, 0.125};
+  ASSERT_FLOAT_EQ(-8.0, aggregate(affs, AGGMIN, 0.593, weights));
+  // NaN left out, weights of the others normalized
+  ASSERT_FLOAT_EQ((0.75 * -6.0 + 0.125 * -8.0) / 0.875,
+                  aggregate(affs, AGGMEAN, 0.593, weights));
+  // Equal weights are the unweighted aggregate
+  ASSERT_FLOAT_EQ(aggregate(affs, AGGBOLTZMANN, 0.593),
+                  aggregate(affs, AGGBOLTZMANN, 0.593, {1.0, 1.0, 1.0}));
+  ASSERT_GT(aggregate(affs, AGGBOLTZMANN, 0.593, weights),
+            aggregate(affs, AGGBOLTZMANN, 0.593));
+}
+
+TEST(Aggregation, EarlyAbort) {
+  DockingBound bound;
+  bound.bound = -8.0;
+  bound.order = {0, 1, 2};
+  bound.floors = {-9.0, -8.5, -10.0};
+  std::vector<float> affs = {-6.0, NAN, NAN};
+  // Mean could still reach (-6 - 8.5 - 10) / 3 < -8
+  ASSERT_FALSE(cannotMakeCut(affs, bound, AGGMEAN, 0.593));
+  affs.at(1) = -6.0;
+  // (-6 - 6 - 10) / 3 > -8
+  ASSERT_TRUE(cannotMakeCut(affs, bound, AGGMEAN, 0.593));
+  // Min could still reach -10 with the last receptor
+  ASSERT_FALSE(cannotMakeCut(affs, bound, AGGMIN, 0.593));
+  bound.floors.at(2) = -7.0;
+  ASSERT_TRUE(cannotMakeCut(affs, bound, AGGMIN, 0.593));
+  // No floor known, anything is possible
+  bound.floors.clear();
+  ASSERT_FALSE(cannotMakeCut(affs, bound, AGGMIN, 0.593));
+  // Round trip through serialization format
+  bound.floors = {-9.0, -8.5, -10.0};
+  bound.weights = {0.5, 0.25, 0.25};
+  DockingBound restored = unpackBound(packBound(bound));
+  ASSERT_EQ(bound.order, restored.order);
+  ASSERT_EQ(bound.floors, restored.floors);
+  ASSERT_EQ(bound.weights, restored.weights);
+  ASSERT_TRUE(std::isinf(restored.cutoff));
+  bound.cutoff = -7.0;
+  ASSERT_FLOAT_EQ(unpackBound(packBound(bound)).cutoff, -7.0);
+  ASSERT_FLOAT_EQ(bound.bound, restored.bound);
+}
+
+/**** Diversity tests ****/
+#include "Diversity/Diversity.h"
+
+TEST(Diversity, Unique) {
+  std::vector<std::string> seqs = {"ARND", "ARND", "CQEG", "ARNE", "CQEG"};
+  ASSERT_EQ(3u, Diversity::uniqueCount(seqs));
+}
+
+TEST(Diversity, PositionEntropy) {
+  std::vector<std::string> seqs = {"AA", "AR", "AN", "AD"};
+  std::vector<float> entropy = Diversity::positionEntropy(seqs);
+  ASSERT_EQ(2u, entropy.size());
+  ASSERT_NEAR(0.0, entropy.at(0), 1e-6);
+  ASSERT_NEAR(2.0, entropy.at(1), 1e-6);  // Four equally likely residues
+}
+
+TEST(Diversity, Hamming) {
+  // Longer than 16 residues to cover more than one SIMD block
+  std::string a = "ARNDCQEGHILKMFPSTWYVAR";
+  std::string b = a; b[0] = 'V'; b[20] = 'V';
+  std::string c = a.substr(0, 18);
+  std::vector<std::string> seqs = {a, b, c};
+  // d(a, b) = 2, d(a, c) = 4, d(b, c) = 1 + 4
+  ASSERT_NEAR(11.0 / 3.0, Diversity::meanHamming(seqs), 1e-5);
+}
+/**** Surrogate tests ****/
+#include "Surrogate/Surrogate.h"
+
+TEST(Surrogate, Ridge) {
+  std::mt19937 mt(42);
+  std::string alphabet = "ARNDCQEGHILKMFPSTWYV";
+  std::uniform_int_distribution<int> residue(0, 19);
+  std::uniform_int_distribution<int> length(6, 14);
+  // Affinity linear in the features: W and F bind, D and E do not
+  auto affinity = [](const std::string & s) {
+    float a = -0.2 * s.size();
+    for (auto c : s) {
+      if (c == 'W' || c == 'F') {a -= 1.0;}
+      if (c == 'D' || c == 'E') {a += 0.5;}
+    }
+    return a;
+  };
+  Surrogate surrogate(0.001, 50, "");
+  ASSERT_FALSE(surrogate.trained());
+  for (int i = 0; i < 2000; i++) {
+    std::string s;
+    int l = length(mt);
+    for (int j = 0; j < l; j++) {s.push_back(alphabet[residue(mt)]);}
+    surrogate.addSample(s, affinity(s));
+  }
+  ASSERT_TRUE(surrogate.trained());
+  ASSERT_LT(surrogate.predict("WWFWFWFW"), surrogate.predict("DEDEDEDE"));
+  ASSERT_NEAR(affinity("AWDFKLWE"), surrogate.predict("AWDFKLWE"), 0.5);
+}
+
+/**** ThreadPool tests ****/
+#include <atomic>
+#include "ThreadPool/ThreadPool.h"
+
+TEST(ThreadPool, NestedTasks) {
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.size(), 4);
+  std::atomic<int> done(0);
+  // Every task submits 10 subtasks, wait() has to cover them too
+  for (int i = 0; i < 20; i++) {
+    pool.submit([&pool, &done]() {
+      for (int j = 0; j < 10; j++) {
+        pool.submit([&done]() { done++; });
+      }
+      done++;
+    });
+  }
+  pool.wait();
+  EXPECT_EQ(done.load(), 220);
+  // Escaping exceptions do not stall the pool
+  pool.submit([]() { throw std::runtime_error("task failed"); });
+  pool.submit([&done]() { done++; });
+  pool.wait();
+  EXPECT_EQ(done.load(), 221);
+}
+
+TEST(ThreadPool, NestedFirst) {
+  ThreadPool pool(1);
+  std::vector<std::string> order;
+  // Subtasks of a started task run before work submitted from outside
+  pool.submit([&pool, &order]() {
+    order.push_back("A");
+    pool.submit([&order]() { order.push_back("B1"); });
+    pool.submit([&order]() { order.push_back("B2"); });
+  });
+  pool.submit([&order]() { order.push_back("C"); });
+  pool.wait();
+  std::vector<std::string> expected = {"A", "B1", "B2", "C"};
+  EXPECT_EQ(order, expected);
+}
+
+TEST(ThreadPool, SubmitFirst) {
+  ThreadPool pool(1);
+  std::vector<std::string> order;
+  std::atomic<bool> started(false);
+  std::mutex gate;
+  gate.lock();
+  pool.submit([&]() {
+    started = true;
+    std::unique_lock<std::mutex> lock(gate);
+    order.push_back("A");
+  });
+  while (!started) {std::this_thread::yield();}
+  // Queued while A runs, D jumps ahead of C
+  pool.submit([&order]() { order.push_back("C"); });
+  pool.submit([&order]() { order.push_back("D"); }, true);
+  gate.unlock();
+  pool.wait();
+  std::vector<std::string> expected = {"A", "D", "C"};
+  EXPECT_EQ(order, expected);
+}
+
+/**** Pocket tests ****/
+#include "Pocket/Pocket.h"
+
+TEST(Pocket, Cavity) {
+  // Cup of atoms open to +z, centred at the origin with 12 A walls
+  std::vector<PocketAtom> atoms;
+  for (int i = -6; i <= 6; i++) {
+    for (int j = -6; j <= 6; j++) {
+      for (int k = -6; k <= 6; k++) {
+        bool wall = (std::abs(i) == 6 || std::abs(j) == 6 || k == -6);
+        if (wall) {atoms.push_back({1.0f * i, 1.0f * j, 1.0f * k, 'A', 1});}
+      }
+    }
+  }
+  std::vector<DockingBox> pockets = detectPockets(atoms, 1.0, 3, 2.0, 10);
+  ASSERT_EQ(pockets.size(), 1);
+  EXPECT_NEAR(pockets[0].center[0], 0.0, 0.5);
+  EXPECT_NEAR(pockets[0].center[1], 0.0, 0.5);
+  // Pocket box is smaller than the receptor box
+  DockingBox whole = boundingBox(atoms, 15.0);
+  for (int k = 0; k < 3; k++) {
+    EXPECT_LT(pockets[0].size[k], whole.size[k]);
+  }
+  // Nothing found with a huge minimum pocket size
+  EXPECT_TRUE(detectPockets(atoms, 1.0, 3, 2.0, 100000).empty());
+}
+
+TEST(Pocket, Residues) {
+  std::vector<std::pair<char, int>> residues = parseResidues("A:45, 67");
+  ASSERT_EQ(residues.size(), 2);
+  EXPECT_EQ(residues[0], std::make_pair('A', 45));
+  EXPECT_EQ(residues[1], std::make_pair(' ', 67));
+  EXPECT_THROW(parseResidues("AB:4"), PocketException);
+  std::vector<PocketAtom> atoms = {{0, 0, 0, 'A', 45}, {2, 4, 6, 'B', 67},
+                                   {100, 100, 100, 'B', 45}};
+  DockingBox box = residueBox(atoms, residues, 1.0);
+  EXPECT_FLOAT_EQ(box.center[0], 1.0);
+  EXPECT_FLOAT_EQ(box.center[2], 3.0);
+  EXPECT_FLOAT_EQ(box.size[1], 6.0);
+  EXPECT_THROW(residueBox(atoms, parseResidues("C:1"), 1.0), PocketException);
+}
+
+/**** Scheduler tests ****/
+#include "Scheduler/Scheduler.h"
+
+TEST(Scheduler, LongestFirst) {
+  Scheduler scheduler;
+  scheduler.addWorker(1, 1);
+  scheduler.addWorker(2, 2);
+  float costs[] = {2, 9, 4, 7};
+  for (unsigned int i = 0; i < 4; i++) {
+    Job job;
+    job.id = i;
+    job.cost = costs[i];
+    scheduler.push(job);
+  }
+  EXPECT_EQ(scheduler.pending(), 4);
+  Job job;
+  int rank;
+  // Longest job to the worker finishing it first, i.e. with more threads
+  ASSERT_TRUE(scheduler.dispatch(job, rank, 0));
+  EXPECT_EQ(job.id, 1);
+  EXPECT_EQ(rank, 2);
+  ASSERT_TRUE(scheduler.dispatch(job, rank, 0));
+  EXPECT_EQ(job.id, 3);
+  EXPECT_EQ(rank, 1);
+  ASSERT_TRUE(scheduler.dispatch(job, rank, 0));
+  EXPECT_EQ(job.id, 2);
+  EXPECT_EQ(rank, 2);
+  // All three slots busy
+  EXPECT_FALSE(scheduler.dispatch(job, rank, 0));
+  Completion completion = scheduler.complete(3, 1, 5, false);
+  EXPECT_TRUE(completion.first);
+  EXPECT_EQ(completion.job.cost, 7);
+  ASSERT_TRUE(scheduler.dispatch(job, rank, 0));
+  EXPECT_EQ(job.id, 0);
+  EXPECT_EQ(rank, 1);
+  EXPECT_EQ(scheduler.pending(), 3);
+}
+
+TEST(Scheduler, Speculation) {
+  Scheduler scheduler;
+  scheduler.setSpeculation(2.0);
+  scheduler.addWorker(1, 4);
+  scheduler.addWorker(2, 1);
+  for (unsigned int i = 0; i < 4; i++) {
+    Job job;
+    job.id = i;
+    job.cost = 1;
+    scheduler.push(job);
+  }
+  Job job;
+  int rank;
+  while (scheduler.dispatch(job, rank, 0)) {}
+  EXPECT_EQ(scheduler.pending(), 4);
+  // Three jobs take 10 s, the one on worker 1 with id 0 hangs
+  for (unsigned int i = 1; i < 4; i++) {
+    int r = (i == 3) ? 2 : 1;
+    EXPECT_TRUE(scheduler.complete(i, r, 10, false).first);
+  }
+  EXPECT_DOUBLE_EQ(scheduler.medianDuration(), 10);
+  EXPECT_FALSE(scheduler.dispatch(job, rank, 15));
+  // Backup on the other worker after twice the median
+  ASSERT_TRUE(scheduler.dispatch(job, rank, 25));
+  EXPECT_EQ(job.id, 0);
+  EXPECT_EQ(job.attempt, 1);
+  EXPECT_EQ(rank, 2);
+  EXPECT_FALSE(scheduler.dispatch(job, rank, 30));
+  // Backup finishes first, original gets cancelled, its result ignored
+  Completion completion = scheduler.complete(0, 2, 30, false);
+  EXPECT_TRUE(completion.first);
+  ASSERT_EQ(completion.cancel.size(), 1);
+  EXPECT_EQ(completion.cancel[0], 1);
+  EXPECT_EQ(scheduler.pending(), 0);
+  EXPECT_FALSE(scheduler.complete(0, 1, 31, true).first);
+}
+
+TEST(Scheduler, FailWorker) {
+  Scheduler scheduler;
+  scheduler.setSpeculation(0.0);
+  scheduler.addWorker(1, 2);
+  scheduler.addWorker(2, 1);
+  for (unsigned int i = 0; i < 3; i++) {
+    Job job;
+    job.id = i;
+    job.cost = 3 - i;
+    scheduler.push(job);
+  }
+  Job job;
+  int rank;
+  while (scheduler.dispatch(job, rank, 0)) {}
+  EXPECT_TRUE(scheduler.complete(0, 1, 1, false).first);
+  // Worker 1 dies with job 2, which goes to the survivor in a fresh copy
+  EXPECT_EQ(scheduler.failWorker(1), 1);
+  EXPECT_EQ(scheduler.aliveWorkers(), std::vector<int>{2});
+  // Gone for good, the survivor's running job is still tracked
+  EXPECT_EQ(scheduler.numWorkers(), 1);
+  EXPECT_EQ(scheduler.runningOn(2), 1);
+  EXPECT_EQ(scheduler.pending(), 2);
+  EXPECT_FALSE(scheduler.dispatch(job, rank, 2));
+  EXPECT_TRUE(scheduler.complete(1, 2, 3, false).first);
+  ASSERT_TRUE(scheduler.dispatch(job, rank, 3));
+  EXPECT_EQ(job.id, 2);
+  EXPECT_EQ(job.attempt, 1);
+  EXPECT_EQ(rank, 2);
+  EXPECT_TRUE(scheduler.complete(2, 2, 4, false).first);
+  EXPECT_EQ(scheduler.pending(), 0);
+}
+
+TEST(Scheduler, Elastic) {
+  Scheduler scheduler;
+  scheduler.addWorker(1, 1);
+  for (unsigned int i = 0; i < 3; i++) {
+    Job job;
+    job.id = i;
+    job.cost = 3 - i;
+    scheduler.push(job);
+  }
+  Job job;
+  int rank;
+  while (scheduler.dispatch(job, rank, 0)) {}
+  EXPECT_EQ(scheduler.queued(), 2);
+  EXPECT_EQ(scheduler.slots(), 1);
+  // A worker joining mid-generation takes part right away
+  scheduler.addWorker(5, 2);
+  EXPECT_EQ(scheduler.slots(), 3);
+  while (scheduler.dispatch(job, rank, 1)) {
+    EXPECT_EQ(rank, 5);
+  }
+  EXPECT_EQ(scheduler.queued(), 0);
+  EXPECT_EQ(scheduler.runningOn(5), 2);
+  // Only idle workers can leave
+  EXPECT_FALSE(scheduler.retireWorker(5));
+  EXPECT_TRUE(scheduler.complete(1, 5, 2, false).first);
+  EXPECT_TRUE(scheduler.complete(2, 5, 2, false).first);
+  EXPECT_TRUE(scheduler.retireWorker(5));
+  EXPECT_EQ(scheduler.aliveWorkers(), std::vector<int>{1});
+  EXPECT_EQ(scheduler.numWorkers(), 1);
+  EXPECT_EQ(scheduler.pending(), 1);
+}
+
+TEST(Scheduler, CostModel) {
+  CostModel model;
+  // Length is used until enough jobs are done
+  EXPECT_FLOAT_EQ(model.predict(12, 3), 12);
+  for (unsigned int l = 5; l < 25; l++) {
+    JobResult result;
+    result.atoms = 1000 + 100 * l;
+    result.mdSeconds = 0.1 * result.atoms;
+    result.dockSeconds = 2 * (10 + l);
+    result.affinities = {-5, -6};
+    model.addSample(l, result);
+  }
+  // md(atoms(30)) + 3 * dock(30) = 400 + 3 * 40
+  EXPECT_NEAR(model.predict(30, 3), 520, 10);
+}
+
+TEST(Scheduler, Pack) {
+  Job job;
+  job.id = 42;
+  job.file = "/work/AAK/AAK.pdb";
+  job.length = 3;
+  job.cost = 1.5;
+  job.attempt = 2;
+  DockingBound bound;
+  bound.bound = -7.5;
+  bound.order = {1, 0};
+  bound.floors = {-9, -8};
+  Job job2;
+  DockingBound bound2;
+  unpackJob(packJob(job, bound), job2, bound2);
+  EXPECT_EQ(job2.id, 42);
+  EXPECT_EQ(job2.file, job.file);
+  EXPECT_EQ(job2.length, 3);
+  EXPECT_EQ(job2.attempt, 2);
+  EXPECT_FLOAT_EQ(bound2.bound, -7.5);
+  EXPECT_EQ(bound2.order, bound.order);
+  EXPECT_FALSE(job2.dockOnly);
+  EXPECT_TRUE(job2.known.empty());
+  EXPECT_EQ(job2.seed, 0);
+  job.dockOnly = true;
+  job.seed = 2147483647;
+  job.known = {-8.5, NAN};
+  unpackJob(packJob(job, bound), job2, bound2);
+  EXPECT_TRUE(job2.dockOnly);
+  EXPECT_EQ(job2.seed, 2147483647);
+  ASSERT_EQ(job2.known.size(), 2);
+  EXPECT_FLOAT_EQ(job2.known[0], -8.5);
+  EXPECT_TRUE(std::isnan(job2.known[1]));
+  EXPECT_EQ(bound2.floors, bound.floors);
+  JobResult result;
+  result.id = 7;
+  result.file = job.file;
+  result.affinities = {-6.5, NAN};
+  result.mdSeconds = 100;
+  result.atoms = 3000;
+  result.rescored = {1};
+  JobResult result2 = unpackResult(packResult(result));
+  EXPECT_EQ(result2.id, 7);
+  EXPECT_FLOAT_EQ(result2.affinities[0], -6.5);
+  EXPECT_TRUE(std::isnan(result2.affinities[1]));
+  EXPECT_FLOAT_EQ(result2.mdSeconds, 100);
+  EXPECT_FLOAT_EQ(result2.atoms, 3000);
+  EXPECT_EQ(result2.rescored, result.rescored);
+}
+
+/**** Process tests ****/
+#include <thread>
+#include "Process/Process.h"
+
+TEST(Process, Run) {
+  std::string output;
+  EXPECT_EQ(runCommand("echo finDrGA; echo ignored >&2", &output), 0);
+  EXPECT_EQ(output, "finDrGA\n");
+  EXPECT_NE(runCommand("exit 3"), 0);
+  setStageTimeout(0.2);
+  EXPECT_THROW(runCommand("sleep 10"), ProcessException);
+  setStageTimeout(0);
+  // A short limit for docking leaves the MD alone
+  setStageTimeout(STAGEDOCK, 0.2);
+  EXPECT_THROW(runCommand("sleep 10", NULL, STAGEDOCK), ProcessException);
+  EXPECT_EQ(runCommand("sleep 0.5", NULL, STAGEMD), 0);
+  setStageTimeout(0);
+}
+
+TEST(Process, Cancel) {
+  bool threw = false;
+  std::thread t([&threw]() {
+    setCurrentJob(17);
+    try {
+      runCommand("sleep 10");
+    } catch (ProcessException & e) {
+      threw = true;
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  cancelJob(17);
+  t.join();
+  EXPECT_TRUE(threw);
+  // Later commands of the job fail right away, others are unaffected
+  setCurrentJob(17);
+  EXPECT_THROW(runCommand("true"), ProcessException);
+  // Until the cancellation is handled
+  forgetJob(17);
+  EXPECT_EQ(runCommand("true"), 0);
+  setCurrentJob(kNoJob);
+  EXPECT_EQ(runCommand("true"), 0);
+}
+
+/**** WorkerCore tests ****/
+#include "PoolManager/WorkerCore.h"
+
+TEST(WorkerCore, FailedJobReported) {
+  // Every program fails, the job still has to come back, without affinities
+  PipelineSettings settings;
+  settings.gromacsPath = "false";
+  settings.pymolPath = "false";
+  settings.vinaPath = "false";
+  settings.pythonShPath = "false";
+  settings.boxsize = 1.0;
+  settings.clustercutoff = 0.12;
+  settings.exhaustiveness = 1;
+  settings.energy_range = 5;
+  settings.aggregation = AGGMIN;
+  settings.kT = 0.593;
+  settings.ioThreads = -1;
+  Info * info = new Info(false, false, "");
+  WorkerCore core(settings, {"receptor.pdb"}, 2, info);
+  // Two CPU threads, one for I/O stages
+  EXPECT_EQ(core.threads(), 3);
+  Job job;
+  job.id = 5;
+  job.file = "/nonexistent/AAK/AAK.pdb";
+  core.submit(job, DockingBound());
+  core.wait();
+  std::vector<JobResult> results = core.collect();
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].id, 5);
+  EXPECT_EQ(results[0].file, job.file);
+  EXPECT_TRUE(results[0].affinities.empty());
+  EXPECT_TRUE(core.collect().empty());
+}
 
+TEST(WorkerCore, DockOnly) {
+  char tmpl[] = "/tmp/dockonlyXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  // Any MD step would leave a trace
+  PipelineSettings settings;
+  settings.gromacsPath = "touch " + dir + "/md; false";
+  settings.pymolPath = "false";
+  settings.vinaPath = "false";
+  settings.pythonShPath = "false";
+  settings.boxsize = 1.0;
+  settings.clustercutoff = 0.12;
+  settings.exhaustiveness = 1;
+  settings.energy_range = 5;
+  settings.aggregation = AGGMIN;
+  settings.kT = 0.593;
+  Info * info = new Info(false, false, "");
+  WorkerCore core(settings, {"r1.pdb", "r2.pdb"}, 2, info);
+  DockingBound bound;
+  bound.order = {0, 1};
+  Job job;
+  job.id = 1;
+  job.file = dir + "/AAK/AAK.pdb";
+  job.dockOnly = true;
+  // Both known, nothing to do, nothing new to report
+  job.known = {-7.0, -8.0};
+  core.submit(job, bound);
+  core.wait();
+  std::vector<JobResult> results = core.collect();
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_EQ(results[0].affinities.size(), 2);
+  EXPECT_TRUE(std::isnan(results[0].affinities[0]));
+  EXPECT_TRUE(std::isnan(results[0].affinities[1]));
+  // Second receptor missing, docking is tried without any MD
+  job.id = 2;
+  job.known = {-7.0, NAN};
+  core.submit(job, bound);
+  core.wait();
+  results = core.collect();
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_TRUE(results[0].affinities.empty());
+  struct stat st;
+  EXPECT_NE(stat((dir + "/md").c_str(), &st), 0);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(WorkerCore, CancelFinished) {
+  char tmpl[] = "/tmp/cancelXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::string vina = dir + "/vina";
+  std::ofstream(vina) << "#!/bin/sh\n"
+                      << "printf -- '-----+\\n   1       -8.5      0.000\\n'\n";
+  chmod(vina.c_str(), 0755);
+  PipelineSettings settings;
+  settings.gromacsPath = "false";
+  settings.pymolPath = "false";
+  settings.vinaPath = vina;
+  settings.pythonShPath = "false";
+  settings.boxsize = 1.0;
+  settings.clustercutoff = 0.12;
+  settings.exhaustiveness = 1;
+  settings.energy_range = 5;
+  settings.aggregation = AGGMIN;
+  settings.kT = 0.593;
+  Info * info = new Info(false, false, "");
+  WorkerCore core(settings, {"r1.pdb"}, 1, info);
+  DockingBound bound;
+  bound.order = {0};
+  Job job;
+  job.id = 3;
+  job.file = dir + "/AAK/AAK.pdb";
+  job.dockOnly = true;
+  core.submit(job, bound);
+  core.wait();
+  std::vector<JobResult> results = core.collect();
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].affinities, std::vector<float>({-8.5}));
+  // Cancelling a job that is done already does not affect a later one
+  // with the same id
+  core.cancel(3);
+  core.submit(job, bound);
+  core.wait();
+  results = core.collect();
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].affinities, std::vector<float>({-8.5}));
+  runCommand("rm -rf " + dir);
+}
+
+TEST(WorkerCore, BackupOutputs) {
+  char tmpl[] = "/tmp/backupXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  runCommand("mkdir " + dir + "/AAK; touch " + dir + "/AAK/AAK.pdb "
+             + dir + "/AAK/topcluster.pdb");
+  std::string vina = dir + "/vina";
+  std::ofstream(vina) << "#!/bin/sh\n"
+                      << "while [ $# -gt 0 ]; do\n"
+                      << "  [ \"$1\" = --out ] && echo MODEL > \"$2\"\n"
+                      << "  shift\n"
+                      << "done\n"
+                      << "printf -- '-----+\\n   1       -8.5      0.000\\n'\n";
+  chmod(vina.c_str(), 0755);
+  PipelineSettings settings;
+  settings.gromacsPath = "false";
+  settings.pymolPath = "false";
+  settings.vinaPath = vina;
+  settings.pythonShPath = "false";
+  settings.boxsize = 1.0;
+  settings.clustercutoff = 0.12;
+  settings.exhaustiveness = 1;
+  settings.energy_range = 5;
+  settings.aggregation = AGGMIN;
+  settings.kT = 0.593;
+  Info * info = new Info(false, false, "");
+  WorkerCore core(settings, {dir + "/r1.pdb"}, 1, info);
+  DockingBound bound;
+  bound.order = {0};
+  Job job;
+  job.id = 1;
+  job.file = dir + "/AAK/AAK.pdb";
+  job.dockOnly = true;
+  job.attempt = 1;
+  core.submit(job, bound);
+  core.wait();
+  std::vector<JobResult> results = core.collect();
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].affinities, std::vector<float>({-8.5}));
+  // Docked in the backup directory, the pose is found next to the ligand
+  struct stat st;
+  EXPECT_EQ(stat((dir + "/AAK/backup1/topcluster.pdbr1.pdb").c_str(), &st),
+            0);
+  EXPECT_EQ(stat((dir + "/AAK/topcluster.pdbr1.pdb").c_str(), &st), 0);
+  runCommand("rm -rf " + dir);
+}
+
+// Fake vina logging "mode receptor" per call: docking always gives -8,
+// rescoring -4 against receptors named *r2* and -7.6 otherwise
+static std::string rescoreVina(const std::string & dir) {
+  std::string vina = dir + "/vina";
+  std::ofstream(vina)
+      << "#!/bin/sh\n"
+      << "mode=dock\n"
+      << "while [ $# -gt 0 ]; do\n"
+      << "  case \"$1\" in\n"
+      << "    --out) out=$2;;\n"
+      << "    --receptor) rec=${2##*/};;\n"
+      << "    --score_only) mode=score;;\n"
+      << "  esac\n"
+      << "  shift\n"
+      << "done\n"
+      << "echo \"$mode $rec\" >> " << dir << "/calls\n"
+      << "if [ $mode = dock ]; then\n"
+      << "  echo MODEL > \"$out\"\n"
+      << "  printf -- '-----+\\n   1       -8.0      0.000\\n'\n"
+      << "else\n"
+      << "  case \"$rec\" in\n"
+      << "    *r2*) echo 'Affinity: -4.0 (kcal/mol)';;\n"
+      << "    *) echo 'Affinity: -7.6 (kcal/mol)';;\n"
+      << "  esac\n"
+      << "fi\n";
+  chmod(vina.c_str(), 0755);
+  return vina;
+}
+
+TEST(WorkerCore, Rescore) {
+  char tmpl[] = "/tmp/rescoreXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  runCommand("mkdir " + dir + "/AAK");
+  PipelineSettings settings;
+  settings.gromacsPath = "false";
+  settings.pymolPath = "false";
+  settings.vinaPath = rescoreVina(dir);
+  settings.pythonShPath = "false";
+  settings.boxsize = 1.0;
+  settings.clustercutoff = 0.12;
+  settings.exhaustiveness = 1;
+  settings.energy_range = 5;
+  settings.aggregation = AGGMIN;
+  settings.kT = 0.593;
+  settings.rescore = "score";
+  settings.rescoreMargin = 1.0;
+  Info * info = new Info(false, false, "");
+  WorkerCore core(settings, {dir + "/r1.pdb", dir + "/r2.pdb",
+                             dir + "/r3.pdb"}, 2, info);
+  DockingBound bound;
+  bound.order = {0, 1, 2};
+  bound.cutoff = -7.0;
+  Job job;
+  job.id = 1;
+  job.file = dir + "/AAK/AAK.pdb";
+  job.dockOnly = true;
+  core.submit(job, bound);
+  core.wait();
+  std::vector<JobResult> results = core.collect();
+  ASSERT_EQ(results.size(), 1);
+  // r2 rescored far from the cut is taken, r3 too close to it is docked
+  EXPECT_EQ(results[0].affinities, std::vector<float>({-8.0, -4.0, -8.0}));
+  EXPECT_EQ(results[0].rescored, std::vector<unsigned int>({1}));
+  // The others wait for the first docking, its pose is rescored
+  std::ifstream in(dir + "/calls");
+  std::vector<std::string> calls;
+  for (std::string line; std::getline(in, line);) {calls.push_back(line);}
+  ASSERT_EQ(calls.size(), 4);
+  EXPECT_EQ(calls[0], "dock r1.pdbqt");
+  std::sort(calls.begin() + 1, calls.end());
+  EXPECT_EQ(calls[1], "dock r3.pdbqt");
+  EXPECT_EQ(calls[2], "score r2.pdbqt");
+  EXPECT_EQ(calls[3], "score r3.pdbqt");
+  runCommand("rm -rf " + dir);
+}
+
+/**** VinaInstance tests ****/
+#include "VinaInstance/VinaInstance.h"
+
+TEST(VinaInstance, Rescore) {
+  char tmpl[] = "/tmp/rescoreXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  // Records its arguments and the ligand it got
+  std::string vina = dir + "/vina";
+  std::ofstream script(vina);
+  script << "#!/bin/sh\necho \"$@\" > " << dir << "/args\n"
+         << "while [ \"$1\" != --ligand ]; do shift; done\n"
+         << "cp \"$2\" " << dir << "/ligand\n"
+         << "echo 'Affinity: -7.25 (kcal/mol)'\n";
+  script.close();
+  chmod(vina.c_str(), 0755);
+  std::ofstream(dir + "/poses") << "MODEL 1\nBEST\nENDMDL\n"
+                                << "MODEL 2\nWORSE\nENDMDL\n";
+  Info * info = new Info(false, false, "");
+  std::string ligand = dir + "/topcluster.pdb";
+  VinaInstance vinaInstance(vina.c_str(), (dir + "/rec.pdb").c_str(),
+                            ligand.c_str(), info);
+  EXPECT_EQ(vinaInstance.poseFile(), ligand + "rec.pdb");
+  EXPECT_FLOAT_EQ(vinaInstance.rescore(dir + "/poses", true), -7.25);
+  std::string args, seed;
+  runCommand("cat " + dir + "/args", &args);
+  runCommand("cat " + dir + "/ligand", &seed);
+  EXPECT_NE(args.find("--local_only --out " + ligand + "rec.pdb"),
+            std::string::npos);
+  EXPECT_NE(args.find("--receptor " + dir + "/rec.pdbqt"), std::string::npos);
+  EXPECT_EQ(seed, "BEST\n");
+  vinaInstance.rescore(dir + "/poses", false);
+  args.clear();
+  runCommand("cat " + dir + "/args", &args);
+  EXPECT_NE(args.find("--score_only"), std::string::npos);
+  EXPECT_THROW(vinaInstance.rescore(dir + "/missing", true), VinaException);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(VinaInstance, Seed) {
+  char tmpl[] = "/tmp/vinaseedXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::string vina = dir + "/vina";
+  std::ofstream script(vina);
+  script << "#!/bin/sh\necho \"$@\" > " << dir << "/args\n"
+         << "printf -- '-----+\\n   1       -8.5      0.000\\n'\n";
+  script.close();
+  chmod(vina.c_str(), 0755);
+  Info * info = new Info(false, false, "");
+  std::string ligand = dir + "/topcluster.pdb";
+  VinaInstance vinaInstance(vina.c_str(), (dir + "/rec.pdb").c_str(),
+                            ligand.c_str(), info);
+  std::string args;
+  EXPECT_FLOAT_EQ(vinaInstance.calculateBindingAffinity(1, 5), -8.5);
+  runCommand("cat " + dir + "/args", &args);
+  EXPECT_EQ(args.find("--seed"), std::string::npos);
+  vinaInstance.setSeed(12345);
+  vinaInstance.calculateBindingAffinity(1, 5);
+  args.clear();
+  runCommand("cat " + dir + "/args", &args);
+  EXPECT_NE(args.find("--seed 12345 "), std::string::npos);
+  runCommand("rm -rf " + dir);
+}
+
+/**** PoolManager tests ****/
+#include "PoolManager/PoolManager.h"
+
+TEST(PoolManager, KnownScores) {
+  char tmpl[] = "/tmp/scoresXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/scores") << "AAK\tr1.pdb\t-7.5\n"
+                                 << "AAK\tr2.pdb\t-8.5\n"
+                                 << "GGW\tr1.pdb\t-6\n";
+  Info * info = new Info(false, false, "");
+  // Nothing runs: pymol, vina and gromacs all fail
+  PoolMGR poolmgr(dir.c_str(), "false", "false", "false", "false",
+                  {"r1.pdb", "r2.pdb"}, 1, 5, "false", "", "", "", "", "",
+                  1.0, 0.12, info, true);
+  std::vector<std::string> fastas = {"AAK"};
+  EXPECT_EQ(poolmgr.addElementsFromFASTAs(fastas, 1), fastas);
+  EXPECT_EQ(poolmgr.getAffinities("AAK"), std::vector<float>({-7.5, -8.5}));
+  EXPECT_FLOAT_EQ(poolmgr.getAffinity("AAK"), -8.5);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(PoolManager, EarlyAbortStored) {
+  char tmpl[] = "/tmp/abortXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  // GGW sets the floors (-6, -5), AAK only needs docking, always -9
+  std::ofstream(dir + "/scores") << "GGW\tr1.pdb\t-6\n"
+                                 << "GGW\tr2.pdb\t-5\n";
+  runCommand("mkdir " + dir + "/AAK; touch " + dir + "/AAK/topcluster.pdbqt");
+  std::string vina = dir + "/vina";
+  std::ofstream(vina) << "#!/bin/sh\n"
+                      << "printf -- '-----+\\n   1       -9.0      0.000\\n'\n";
+  chmod(vina.c_str(), 0755);
+  PipelineSettings settings;
+  settings.gromacsPath = "false";
+  settings.pymolPath = "false";
+  settings.vinaPath = vina;
+  settings.pythonShPath = "false";
+  settings.boxsize = 1.0;
+  settings.clustercutoff = 0.12;
+  settings.exhaustiveness = 1;
+  settings.energy_range = 5;
+  settings.aggregation = AGGMEAN;
+  settings.kT = 0.593;
+  Info * info = new Info(false, false, "");
+  PoolMGR poolmgr(dir.c_str(), "false", "false", "false", "false",
+                  {"r1.pdb", "r2.pdb"}, 1, 5, "false", "", "", "", "", "",
+                  1.0, 0.12, info, true);
+  poolmgr.setAggregation(AGGMEAN, 0.593);
+  std::vector<std::string> fastas = {"GGW"};
+  poolmgr.addElementsFromFASTAs(fastas, 1);
+  // One CPU thread: the first receptor rules AAK out (mean of -9 and the
+  // other floor is above -8), the second one is never docked
+  WorkerCore core(settings, {"r1.pdb", "r2.pdb"}, 1, info);
+  poolmgr.setLocalCore(&core);
+  poolmgr.setBound(-8.0, 0.0);
+  fastas = {"AAK"};
+  EXPECT_EQ(poolmgr.addElementsFromFASTAs(fastas, 1), fastas);
+  std::vector<float> affinities = poolmgr.getAffinities("AAK");
+  ASSERT_EQ(affinities.size(), 2);
+  EXPECT_EQ(std::isnan(affinities[0]) + std::isnan(affinities[1]), 1);
+  // Not the -9 of the receptor docked, which would beat the cut
+  EXPECT_GT(poolmgr.getAffinity("AAK"), -8.0);
+  EXPECT_LE(poolmgr.getAffinity("AAK"), -7.0);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(PoolManager, Prefetch) {
+  char tmpl[] = "/tmp/prefetchXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  // Fake pymol writing the file named after "save"
+  std::string pymol = dir + "/pymol";
+  std::ofstream(pymol) << "#!/bin/sh\n"
+                       << "echo ATOM > \"${3##*save }\"\n";
+  chmod(pymol.c_str(), 0755);
+  std::ofstream(dir + "/scores") << "KKK\tr1.pdb\t-7\n";
+  // GGW was docked in an earlier run
+  runCommand("mkdir " + dir + "/GGW; touch " + dir + "/GGW/topcluster.pdbqt");
+  Info * info = new Info(false, false, "");
+  PoolMGR poolmgr(dir.c_str(), "false", "false", "false", pymol.c_str(),
+                  {"r1.pdb"}, 1, 5, "false", "", "", "", "", "",
+                  1.0, 0.12, info, true);
+  poolmgr.prefetch({"GGW", "AAK", "KKK"});
+  // Waits for the prefetch
+  poolmgr.setPDBThreads(1);
+  struct stat st;
+  EXPECT_EQ(stat((dir + "/AAK/AAK.pdb").c_str(), &st), 0);
+  std::vector<std::string> fastas = {"KKK"};
+  EXPECT_EQ(poolmgr.addElementsFromFASTAs(fastas, 1), fastas);
+  EXPECT_EQ(stat((dir + "/GGW/topcluster.pdbqt").c_str(), &st), 0);
+  EXPECT_NE(stat((dir + "/GGW/GGW.pdb").c_str(), &st), 0);
+  EXPECT_NE(stat((dir + "/AAK").c_str(), &st), 0);
+  EXPECT_NE(stat((dir + "/KKK").c_str(), &st), 0);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(PoolManager, RescoredNotStored) {
+  char tmpl[] = "/tmp/rescoredXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  runCommand("mkdir " + dir + "/AAK; touch " + dir + "/AAK/topcluster.pdbqt");
+  PipelineSettings settings;
+  settings.gromacsPath = "false";
+  settings.pymolPath = "false";
+  settings.vinaPath = rescoreVina(dir);
+  settings.pythonShPath = "false";
+  settings.boxsize = 1.0;
+  settings.clustercutoff = 0.12;
+  settings.exhaustiveness = 1;
+  settings.energy_range = 5;
+  settings.aggregation = AGGMIN;
+  settings.kT = 0.593;
+  settings.rescore = "score";
+  Info * info = new Info(false, false, "");
+  std::vector<std::string> receptors = {dir + "/r1.pdb", dir + "/r2.pdb"};
+  WorkerCore core(settings, receptors, 1, info);
+  {
+    PoolMGR poolmgr(dir.c_str(), "false", "false", "false", "false",
+                    receptors, 1, 5, "false", "", "", "", "", "",
+                    1.0, 0.12, info, true);
+    poolmgr.setLocalCore(&core);
+    poolmgr.setCutoff(-7.0);
+    std::vector<std::string> fastas = {"AAK"};
+    EXPECT_EQ(poolmgr.addElementsFromFASTAs(fastas, 1), fastas);
+    EXPECT_EQ(poolmgr.getAffinities("AAK"), std::vector<float>({-8.0, -4.0}));
+  }
+  // Only the docked affinity is kept for later runs
+  std::ifstream in(dir + "/scores");
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(in, line);) {lines.push_back(line);}
+  EXPECT_EQ(lines, std::vector<std::string>({"AAK\t" + receptors[0]
+                                             + "\t-8"}));
+  runCommand("rm -rf " + dir);
+}
+
+/**** GMXInstance tests ****/
+#include "GMXInstance/GMXInstance.h"
+
+TEST(GMXInstance, SkipDoneSteps) {
+  char tmpl[] = "/tmp/gmxstepsXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/AAK.pdb") << "ATOM\n";
+  std::ofstream(dir + "/ions.mdp") << "nsteps = 1\n";
+  // Fake gromacs counting its calls
+  std::string gmx = "echo >> " + dir + "/calls; true";
+  Info * info = new Info(false, false, "");
+  auto calls = [&dir]() {
+    std::ifstream in(dir + "/calls");
+    return std::count(std::istreambuf_iterator<char>(in),
+                      std::istreambuf_iterator<char>(), '\n');
+  };
+  GMXInstance gmxInstance((dir + "/AAK.pdb").c_str(), gmx.c_str(), "",
+                          dir.c_str(), "", "", "", "", 0.12, 1.0,
+                          dir.c_str(), info);
+  gmxInstance.buildSystem();
+  EXPECT_EQ(calls(), 5);
+  // Nothing changed, nothing to do
+  gmxInstance.buildSystem();
+  EXPECT_EQ(calls(), 5);
+  // Changed settings of grompp rerun it and everything after it
+  std::ofstream(dir + "/ions.mdp") << "nsteps = 2\n";
+  gmxInstance.buildSystem();
+  EXPECT_EQ(calls(), 7);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(GMXInstance, ChangedInputs) {
+  char tmpl[] = "/tmp/gmxinputsXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/AAK.pdb") << "ATOM\n";
+  std::ofstream(dir + "/ions.mdp") << "nsteps = 1\n";
+  std::ofstream(dir + "/processed.gro") << "aaaa\n";
+  // Fake gromacs logging its calls, pdb2gmx writes the topology, solvate
+  // and genion extend it
+  std::string gmx = dir + "/gmx";
+  std::ofstream(gmx) << "#!/bin/sh\n"
+                     << "echo \"$1\" >> " << dir << "/calls\n"
+                     << "case \"$1\" in\n"
+                     << "  pdb2gmx) cp clean.pdb topol.top;;\n"
+                     << "  solvate|genion) echo \"$1\" >> topol.top;;\n"
+                     << "esac\n";
+  chmod(gmx.c_str(), 0755);
+  Info * info = new Info(false, false, "");
+  auto read = [&dir](const std::string & file) {
+    std::ifstream in(dir + "/" + file);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+  };
+  GMXInstance gmxInstance((dir + "/AAK.pdb").c_str(), gmx.c_str(), "",
+                          dir.c_str(), "", "", "", "", 0.12, 1.0,
+                          dir.c_str(), info);
+  gmxInstance.buildSystem();
+  std::string calls = read("calls");
+  EXPECT_EQ(read("topol.top"), "ATOM\nsolvate\ngenion\n");
+  // The topology changed by later steps does not count as changed input
+  gmxInstance.buildSystem();
+  EXPECT_EQ(read("calls"), calls);
+  // An input replaced outside the pipeline (same size, pdb2gmx's outputs
+  // look intact) reruns the steps reading it and everything after
+  std::ofstream(dir + "/processed.gro") << "bbbb\n";
+  gmxInstance.buildSystem();
+  calls += "editconf\nsolvate\ngrompp\ngenion\n";
+  EXPECT_EQ(read("calls"), calls);
+  EXPECT_EQ(read("topol.top"), "ATOM\nsolvate\ngenion\n");
+  // A new topology from pdb2gmx is not replaced by stale snapshots of it
+  std::ofstream(dir + "/AAK.pdb") << "ATOM 2\n";
+  gmxInstance.buildSystem();
+  calls += "pdb2gmx\neditconf\nsolvate\ngrompp\ngenion\n";
+  EXPECT_EQ(read("calls"), calls);
+  EXPECT_EQ(read("topol.top"), "ATOM 2\nsolvate\ngenion\n");
+  runCommand("rm -rf " + dir);
+}
+
+TEST(GMXInstance, SeededGenion) {
+  char tmpl[] = "/tmp/gmxgenionXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/AAK.pdb") << "ATOM\n";
+  std::ofstream(dir + "/ions.mdp") << "nsteps = 1\n";
+  Info * info = new Info(false, false, "");
+  // Fake gromacs printing its arguments into the log
+  GMXInstance gmxInstance((dir + "/AAK.pdb").c_str(), "echo", "",
+                          dir.c_str(), "", "", "", "", 0.12, 1.0,
+                          dir.c_str(), info);
+  gmxInstance.setSeed(7);
+  gmxInstance.buildSystem();
+  std::ifstream in(dir + "/GMXINSTLOG");
+  std::stringstream log;
+  log << in.rdbuf();
+  EXPECT_NE(log.str().find("genion -s ions.tpr"), std::string::npos);
+  std::string seed = "-seed " + std::to_string(deriveSeed(7, "genion"));
+  EXPECT_NE(log.str().find(seed), std::string::npos);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(GMXInstance, AdaptiveMD) {
+  char tmpl[] = "/tmp/gmxmdpXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/md.mdp") << "integrator = md ; leap-frog\n"
+                                 << "nsteps      = 50000 ; 100 ps\n";
+  EXPECT_EQ(mdpSteps(dir + "/md.mdp"), 50000);
+  EXPECT_EQ(mdpSteps(dir + "/missing.mdp"), -1);
+  runCommand("rm -rf " + dir);
+  // Rising RMSD has not settled, a flat one has
+  std::vector<float> rising, flat;
+  for (int i = 0; i < 40; i++) {
+    rising.push_back(0.01 * i);
+    flat.push_back((i < 10) ? 0.02 * i : 0.2 + 0.005 * (i % 2));
+  }
+  EXPECT_FALSE(rmsdPlateau(rising, 4, 0.02));
+  EXPECT_TRUE(rmsdPlateau(flat, 4, 0.02));
+  // The first chunk still relaxes, neither alone nor against the second
+  // can it show a plateau
+  EXPECT_FALSE(rmsdPlateau(flat, 1, 0.02));
+  EXPECT_FALSE(rmsdPlateau(flat, 2, 0.02));
+  std::vector<float> settled(40, 0.2);
+  EXPECT_FALSE(rmsdPlateau(settled, 2, 0.02));
+  EXPECT_TRUE(rmsdPlateau(settled, 3, 0.02));
+  // Resuming from a checkpoint: chunks of 250 steps, cut off in the third
+  EXPECT_EQ(completedChunks(-1, 1000, 4), 0);
+  EXPECT_EQ(completedChunks(249, 1000, 4), 0);
+  EXPECT_EQ(completedChunks(250, 1000, 4), 1);
+  EXPECT_EQ(completedChunks(600, 1000, 4), 2);
+  EXPECT_EQ(completedChunks(1000, 1000, 4), 4);
+}
+
+TEST(GMXInstance, ResumeChunks) {
+  char tmpl[] = "/tmp/gmxresumeXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/md.mdp") << "nsteps = 1000\n";
+  std::ofstream(dir + "/md_0_1.cpt") << "checkpoint\n";
+  // Fake gromacs logging its calls, checkpointed in the third chunk
+  std::string gmx = dir + "/gmx";
+  std::ofstream(gmx) << "#!/bin/sh\n"
+                     << "echo \"$@\" >> " << dir << "/calls\n"
+                     << "if [ \"$1\" = dump ]; then echo '   step = 600'; fi\n";
+  chmod(gmx.c_str(), 0755);
+  Info * info = new Info(false, false, "");
+  GMXInstance gmxInstance((dir + "/AAK.pdb").c_str(), gmx.c_str(), "",
+                          dir.c_str(), "", "", "", "", 0.12, 1.0,
+                          dir.c_str(), info);
+  gmxInstance.setAdaptiveMD(4, 0.02);
+  gmxInstance.simulate();
+  std::ifstream in(dir + "/calls");
+  std::vector<std::string> chunks;
+  for (std::string line; std::getline(in, line);) {
+    if (line.compare(0, 11, "convert-tpr") == 0) {
+      chunks.push_back(line.substr(line.find("-nsteps")));
+    }
+  }
+  ASSERT_EQ(chunks.size(), 2);
+  EXPECT_EQ(chunks[0].compare(0, 11, "-nsteps 750"), 0);
+  EXPECT_EQ(chunks[1].compare(0, 12, "-nsteps 1000"), 0);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(GMXInstance, SeededMdp) {
+  char tmpl[] = "/tmp/gmxseedXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/nvt.mdp") << "gen_vel = yes\n"
+                                  << "gen-seed = -1 ; random\n"
+                                  << "ld_seed  = -1\n"
+                                  << "; gen_seed = -1 in a comment\n";
+  ASSERT_TRUE(seedMdp(dir + "/nvt.mdp", dir + "/seeded", 42));
+  std::ifstream in(dir + "/seeded");
+  std::stringstream seeded;
+  seeded << in.rdbuf();
+  EXPECT_EQ(seeded.str(), "gen_vel = yes\n"
+                          "; gen_seed = -1 in a comment\n"
+                          "gen_seed = 42\n"
+                          "ld_seed = 42\n");
+  EXPECT_FALSE(seedMdp(dir + "/missing.mdp", dir + "/seeded", 42));
+  runCommand("rm -rf " + dir);
+}
+
+/**** PDB tests ****/
+#include "PDB/PDB.h"
+
+TEST(PDB, Parse) {
+  std::string pdb =
+    "HEADER    PEPTIDE\n"
+    "ATOM      1  N   GLY B 180      45.021   8.769  -8.855  1.00 29.18\n"
+    "ATOM      2  CA  GLY B 180      45.790   8.370  -7.668  1.00 28.93\r\n"
+    "TER\n"
+    "HETATM    3  O   HOH B 181      -0.5     .25   100.000\n"
+    "ATOM      4  CA  LYS C 182       1.000   2.000   3.000";
+  AtomTable atoms = parsePDB(pdb.data(), pdb.size());
+  ASSERT_EQ(atoms.size(), 4);
+  EXPECT_EQ(atoms.offset[1], pdb.find("ATOM      2"));
+  EXPECT_FLOAT_EQ(atoms.x[0], 45.021);
+  EXPECT_FLOAT_EQ(atoms.z[1], -7.668);
+  EXPECT_FLOAT_EQ(atoms.x[2], -0.5);
+  EXPECT_FLOAT_EQ(atoms.y[2], 0.25);
+  EXPECT_EQ(atoms.resSeq[3], 182);
+  EXPECT_EQ(atoms.chain[3], 'C');
+  EXPECT_EQ(atoms.name(1), "CA");
+  EXPECT_EQ(atoms.resName(2), "HOH");
+  // Water is not part of the sequence
+  EXPECT_EQ(sequence(atoms), "GK");
+  std::string bad = "ATOM      1  N   GLY B 180      45.0x1   8.769  -8.855";
+  EXPECT_THROW(parsePDB(bad.data(), bad.size()), PDBException);
+  EXPECT_THROW(readPDB("src/testpdbs/missing.pdb"), PDBException);
+  AtomTable file = readPDB("src/testpdbs/8_5icn_D_18.pdb");
+  EXPECT_EQ(sequence(file), "GDGVEEAF");
+  EXPECT_FLOAT_EQ(file.y[0], 8.769);
+}
+
+/**** Catalog tests ****/
+#include "Catalog/Catalog.h"
+
+TEST(Catalog, Incremental) {
+  char tmpl[] = "/tmp/catalogXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::string lib = dir + "/lib";
+  mkdir(lib.c_str(), 0777);
+  runCommand("cp src/testpdbs/8_5icn_D_18.pdb src/testpdbs/9_5usn_D_2.pdb "
+             "src/testpdbs/10_5zop_D_6.pdb " + lib);
+  // Same sequence twice, a broken file and one with a ligand
+  runCommand("cp " + lib + "/8_5icn_D_18.pdb " + lib + "/copy.pdb");
+  std::ofstream(lib + "/broken.pdb") << "not a pdb\n";
+  std::ofstream(lib + "/ligand.pdb")
+    << "ATOM      1  CA  GLY A   1       1.000   2.000   3.000\n"
+    << "HETATM    2  C1  NAG A   2       1.000   2.000   3.000\n";
+  Catalog catalog(lib, dir + "/index");
+  EXPECT_EQ(catalog.update(), 6);
+  EXPECT_EQ(catalog.size(), 6);
+  std::vector<CatalogEntry> usable = catalog.usable(0, 0);
+  ASSERT_EQ(usable.size(), 3);
+  EXPECT_EQ(usable[0].sequence, "SEAHTLLYGT");
+  EXPECT_EQ(usable[0].residues, 10);
+  EXPECT_EQ(catalog.usable(9, 0).size(), 2);
+  EXPECT_EQ(catalog.usable(0, 9).size(), 2);
+  // Index is persistent, only changed files are parsed again
+  Catalog reloaded(lib, dir + "/index");
+  EXPECT_EQ(reloaded.size(), 6);
+  EXPECT_EQ(reloaded.update(), 0);
+  std::ofstream(lib + "/broken.pdb") << "still not a pdb\n";
+  std::remove((lib + "/ligand.pdb").c_str());
+  EXPECT_EQ(reloaded.update(), 1);
+  EXPECT_EQ(reloaded.size(), 5);
+  EXPECT_EQ(Catalog(lib, dir + "/index").size(), 5);
+  // Sampling without replacement, taken sequences left out
+  std::mt19937 mt(42);
+  std::vector<CatalogEntry> sample = reloaded.sample(5, 0, 0, {"GDGVEEAF"},
+                                                     mt);
+  ASSERT_EQ(sample.size(), 2);
+  EXPECT_NE(sample[0].sequence, sample[1].sequence);
+  for (auto & entry : sample) {
+    EXPECT_NE(entry.sequence, "GDGVEEAF");
+    EXPECT_EQ(reloaded.path(entry), lib + "/" + entry.name);
+  }
+  runCommand("rm -rf " + dir);
+}
+
+/**** SolventBox tests ****/
+#include "SolventBox/SolventBox.h"
+
+// Cubic box of 6^3 three-atom waters, 0.5 nm apart
+static GroSystem waterGrid() {
+  GroSystem water;
+  water.title = "Water";
+  boxVectors("cubic", 3.0, water.box);
+  int resnr = 1;
+  for (int i = 0; i < 216; i++) {
+    float o[3] = {0.25f + 0.5f * (i / 36), 0.25f + 0.5f * ((i / 6) % 6),
+                  0.25f + 0.5f * (i % 6)};
+    const char * names[3] = {"OW", "HW1", "HW2"};
+    for (int a = 0; a < 3; a++) {
+      GroAtom atom = {resnr, "SOL", names[a], {o[0], o[1], o[2]}};
+      if (a > 0) {atom.x[a - 1] += 0.05;}
+      water.atoms.push_back(atom);
+    }
+    resnr++;
+  }
+  return water;
+}
+
+TEST(SolventBox, Box) {
+  GroSystem solute;
+  solute.atoms.push_back({1, "ALA", "N", {0.0, 0.0, 0.0}});
+  solute.atoms.push_back({1, "ALA", "C", {3.0, 0.0, 0.0}});
+  EXPECT_NEAR(boxLength(solute, 1.0, 0.2), 5.0, 1e-4);
+  solute.atoms[1].x[0] = 3.05;
+  EXPECT_NEAR(boxLength(solute, 1.0, 0.2), 5.2, 1e-4);
+  // Lying diagonally it needs its diameter, not its extent along an axis
+  solute.atoms[1].x[0] = 3.0;
+  solute.atoms[1].x[1] = 3.0;
+  EXPECT_NEAR(boxLength(solute, 1.0, 0.2), 6.4, 1e-4);
+  EXPECT_EQ(boxTemplateName("dodecahedron", 5.2), "dodecahedron_5.20.gro");
+  float box[9];
+  boxVectors("dodecahedron", 5.0, box);
+  EXPECT_NEAR(box[2], 5.0 * std::sqrt(0.5), 1e-4);
+  EXPECT_NEAR(box[7], 2.5, 1e-4);
+  EXPECT_FALSE(boxSupported("octahedron"));
+  EXPECT_THROW(boxVectors("octahedron", 5.0, box), SolventBoxException);
+}
+
+TEST(SolventBox, InsertAndIons) {
+  GroSystem solute;
+  solute.title = "Peptide";
+  solute.atoms.push_back({7, "LYS", "NZ", {10.0, 10.0, 10.0}});
+  char tmpl[] = "/tmp/solventboxXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  writeGro(dir + "/water.gro", waterGrid());
+  GroSystem water = readGro(dir + "/water.gro");
+  ASSERT_EQ(water.atoms.size(), 648);
+  // Solute goes to the center, the 8 waters around it are removed
+  GroSystem system = insertSolute(solute, water, 0.45);
+  ASSERT_EQ(system.atoms.size(), 1 + 208 * 3);
+  EXPECT_NEAR(system.atoms[0].x[0], 1.5, 1e-4);
+  EXPECT_EQ(system.atoms[1].resnr, 8);
+  EXPECT_NEAR(system.box[2], 3.0, 1e-4);
+  // Corner waters are farthest, but periodic images of each other
+  EXPECT_EQ(replaceWithIons(system, 1, "CL", 2, 0.6), 206);
+  ASSERT_EQ(system.atoms.size(), 1 + 206 * 3 + 2);
+  GroAtom a = system.atoms[system.atoms.size() - 2];
+  GroAtom b = system.atoms.back();
+  EXPECT_EQ(a.resname, "CL");
+  EXPECT_EQ(b.name, "CL");
+  EXPECT_EQ(b.resnr, a.resnr + 1);
+  float d2 = 0.0;
+  for (int k = 0; k < 3; k++) {
+    float d = std::fabs(a.x[k] - b.x[k]);
+    d = std::min(d, 3.0f - d);
+    d2 += d * d;
+  }
+  EXPECT_GE(std::sqrt(d2), 0.6);
+  EXPECT_THROW(replaceWithIons(system, 1, "NA", 300, 0.6),
+               SolventBoxException);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(SolventBox, Topology) {
+  char tmpl[] = "/tmp/solventtopXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::ofstream(dir + "/chain_B.itp")
+    << "[ moleculetype ]\n; name nrexcl\nChain_B 3\n\n[ atoms ]\n"
+    << "  1 N3 1 ASP N 1 -0.5 14.01\n  2 O2 1 ASP O 2 -0.5 16.00\n";
+  std::ofstream(dir + "/topol.top")
+    << "#include \"amber.ff/forcefield.itp\"\n\n"
+    << "[ moleculetype ]\nChain_A 3\n[ atoms ]\n"
+    << "  1 N3 1 LYS N 1 1.0 14.01 ; qtot 1\n"
+    << "  2 C 1 LYS C 2 1.5 12.01\n  3 O 1 LYS O 3 -0.5 16.00\n"
+    << "#ifdef POSRES\n#include \"posre.itp\"\n#endif\n\n"
+    << "#include \"chain_B.itp\"\n\n"
+    << "[ system ]\nPeptide\n\n[ molecules ]\n; Compound #mols\n"
+    << "Chain_A 1\nChain_B 1\nSOL 10\n";
+  EXPECT_EQ(topologyCharge(dir + "/topol.top"), 1);
+  setMolecules(dir + "/topol.top", 5, "CL", 1);
+  std::ifstream in(dir + "/topol.top");
+  std::vector<std::string> molecules;
+  std::string line;
+  bool section = false;
+  while (std::getline(in, line)) {
+    if (section && !line.empty() && line[0] != ';') {
+      std::istringstream fields(line);
+      std::string name, count;
+      fields >> name >> count;
+      molecules.push_back(name + " " + count);
+    }
+    section = section || line == "[ molecules ]";
+  }
+  EXPECT_EQ(molecules, std::vector<std::string>({"Chain_A 1", "Chain_B 1",
+                                                 "SOL 5", "CL 1"}));
+  // Ions of the force field count as neutral, the net charge stays
+  EXPECT_EQ(topologyCharge(dir + "/topol.top"), 1);
+  runCommand("rm -rf " + dir);
+}
+
+/**** ReceptorPrep tests ****/
+#include "ReceptorPrep/ReceptorPrep.h"
+
+TEST(ReceptorPrep, Cache) {
+  char tmpl[] = "/tmp/receptorprepXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::string receptor = dir + "/rec.pdb";
+  runCommand("cp src/testpdbs/8_5icn_D_18.pdb " + receptor);
+  // Stands in for pythonsh, the PDBQT is the 9th argument
+  std::string fake = dir + "/pythonsh";
+  std::ofstream script(fake);
+  script << "#!/bin/sh\ntouch \"$9\"\necho run >> " << dir << "/runs\n";
+  script.close();
+  chmod(fake.c_str(), 0755);
+  ReceptorPrepSettings settings;
+  settings.pythonShPath = fake;
+  settings.mgltoolsPath = dir;
+  settings.cacheDir = dir + "/cache";
+  Info * info = new Info(false, false, "");
+  std::vector<std::string> files = prepareReceptors({receptor}, settings, 2, 1,
+                                                    info);
+  ASSERT_EQ(files.size(), 1);
+  EXPECT_EQ(files[0], settings.cacheDir + "/rec_"
+                      + receptorKey(receptor, settings) + "/rec.pdb");
+  struct stat st;
+  EXPECT_EQ(stat((files[0] + "qt").c_str(), &st), 0);
+  EXPECT_EQ(stat((files[0] + "_conf").c_str(), &st), 0);
+  // Cached, nothing is run again
+  EXPECT_EQ(prepareReceptors({receptor}, settings, 2, 1, info), files);
+  EXPECT_EQ(runCommand("test $(wc -l < " + dir + "/runs) -eq 1"), 0);
+  // Mirror image is a receptor of its own, the input stays as it is
+  settings.mirror = true;
+  std::vector<std::string> mirrored = prepareReceptors({receptor}, settings,
+                                                       2, 1, info);
+  ASSERT_EQ(mirrored.size(), 1);
+  EXPECT_NE(mirrored[0], files[0]);
+  EXPECT_FLOAT_EQ(readPDB(mirrored[0]).x[0], -readPDB(receptor).x[0]);
+  EXPECT_EQ(runCommand("cmp -s " + receptor
+                       + " src/testpdbs/8_5icn_D_18.pdb"), 0);
+  // Failed preparation is reported and not cached
+  settings.pythonShPath = "false";
+  runCommand("cp " + receptor + " " + dir + "/other.pdb");
+  runCommand("echo REMARK >> " + dir + "/other.pdb");
+  EXPECT_THROW(prepareReceptors({dir + "/other.pdb"}, settings, 2, 1, info),
+               ReceptorPrepException);
+  EXPECT_EQ(runCommand("ls " + settings.cacheDir + " | grep -q other"), 1);
+  runCommand("rm -rf " + dir);
+}
+
+TEST(ReceptorPrep, Pockets) {
+  char tmpl[] = "/tmp/receptorpocketsXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  // Two cups open to +z, 40 A apart
+  std::string receptor = dir + "/rec.pdb";
+  std::ofstream pdb(receptor);
+  int serial = 1;
+  for (int cup = 0; cup < 2; cup++) {
+    for (int i = -6; i <= 6; i++) {
+      for (int j = -6; j <= 6; j++) {
+        for (int k = -6; k <= 6; k++) {
+          if (std::abs(i) != 6 && std::abs(j) != 6 && k != -6) {continue;}
+          char line[128];
+          snprintf(line, sizeof(line), "ATOM  %5d  CA  ALA A%4d    "
+                   "%8.3f%8.3f%8.3f  1.00  0.00           C\n",
+                   serial, serial % 10000, 40.0 * cup + i, 1.0 * j, 1.0 * k);
+          pdb << line;
+          serial++;
+        }
+      }
+    }
+  }
+  pdb.close();
+  std::string fake = dir + "/pythonsh";
+  std::ofstream script(fake);
+  script << "#!/bin/sh\necho \"$9\" > \"$9\"\necho run >> " << dir
+         << "/runs\n";
+  script.close();
+  chmod(fake.c_str(), 0755);
+  ReceptorPrepSettings settings;
+  settings.pythonShPath = fake;
+  settings.mgltoolsPath = dir;
+  settings.cacheDir = dir + "/cache";
+  settings.pocket.mode = "grid";
+  settings.pocket.maxPockets = 2;
+  settings.pocket.padding = 2.0;
+  settings.pocket.spacing = 1.0;
+  settings.pocket.minPoints = 10;
+  Info * info = new Info(false, false, "");
+  std::vector<std::string> files = prepareReceptors({receptor}, settings, 2, 1,
+                                                    info);
+  ASSERT_EQ(files.size(), 2);
+  // One PDBQT for both pockets, a box each
+  EXPECT_EQ(runCommand("test $(wc -l < " + dir + "/runs) -eq 1"), 0);
+  EXPECT_EQ(runCommand("cmp -s " + files[0] + "qt " + files[1] + "qt"), 0);
+  EXPECT_NE(readConf(files[0] + "_conf").center[0],
+            readConf(files[1] + "_conf").center[0]);
+  EXPECT_EQ(prepareReceptors({receptor}, settings, 2, 1, info), files);
+  runCommand("rm -rf " + dir);
+}
+
+/**** Ensemble tests ****/
+#include "Ensemble/Ensemble.h"
+
+TEST(Ensemble, RMSD) {
+  std::vector<float> a = {0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3};
+  // Rotated by 90 degrees around z and shifted
+  std::vector<float> b = {5, 5, 5, 5, 6, 5, 3, 5, 5, 5, 5, 8};
+  EXPECT_NEAR(superposedRMSD(a, b), 0.0, 1e-3);
+  // Mirror image can not be superposed by a rotation
+  std::vector<float> c = {0, 0, 0, -1, 0, 0, 0, 2, 0, 0, 0, 3};
+  EXPECT_GT(superposedRMSD(a, c), 0.1);
+}
+
+TEST(Ensemble, Cluster) {
+  char tmpl[] = "/tmp/ensembleXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  std::vector<std::string> receptors = {dir + "/a.pdb", dir + "/b.pdb",
+                                        dir + "/c.pdb"};
+  for (auto & r : receptors) {
+    runCommand("cp src/testpdbs/8_5icn_D_18.pdb " + r);
+    writeConf(r + "_conf", {{0, 0, 0}, {1000, 1000, 1000}, 0});
+  }
+  // b: a shifted along x, c: mirror image of a
+  std::string shifted;
+  {
+    MappedFile file(receptors[1]);
+    AtomTable atoms = parsePDB(file.data(), file.size());
+    shifted.assign(file.data(), file.size());
+    for (size_t i = 0; i < atoms.size(); i++) {
+      char x[9];
+      snprintf(x, sizeof(x), "%8.3f", atoms.x[i] + 5.0);
+      shifted.replace(atoms.offset[i] + 30, 8, x, 8);
+    }
+  }
+  std::ofstream(receptors[1]) << shifted;
+  mImage(receptors[2]);
+  ReceptorEnsemble ensemble = clusterReceptors(receptors, 0.5);
+  ASSERT_EQ(ensemble.representatives.size(), 2);
+  EXPECT_EQ(ensemble.representatives[0], receptors[0]);
+  EXPECT_EQ(ensemble.cluster, std::vector<unsigned int>({0, 0, 1}));
+  EXPECT_FLOAT_EQ(ensemble.weights[0], 2.0 / 3.0);
+  EXPECT_FLOAT_EQ(ensemble.weights[1], 1.0 / 3.0);
+  // Mapping reused for the same receptors and cutoff only
+  saveEnsemble(dir + "/mapping", ensemble, 0.5);
+  ReceptorEnsemble loaded;
+  ASSERT_TRUE(loadEnsemble(dir + "/mapping", receptors, 0.5, loaded));
+  EXPECT_EQ(loaded.representatives, ensemble.representatives);
+  EXPECT_EQ(loaded.cluster, ensemble.cluster);
+  EXPECT_EQ(loaded.weights, ensemble.weights);
+  EXPECT_FALSE(loadEnsemble(dir + "/mapping", receptors, 1.0, loaded));
+  receptors.pop_back();
+  EXPECT_FALSE(loadEnsemble(dir + "/mapping", receptors, 0.5, loaded));
+  runCommand("rm -rf " + dir);
+}
+
+TEST(Ensemble, OverlappingPockets) {
+  char tmpl[] = "/tmp/ensembleXXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  // One structure, two boxes sharing nearly all residues
+  std::vector<std::string> receptors = {dir + "/a.pdb", dir + "/a2.pdb",
+                                        dir + "/a3.pdb"};
+  for (auto & r : receptors) {
+    runCommand("cp src/testpdbs/8_5icn_D_18.pdb " + r);
+  }
+  writeConf(receptors[0] + "_conf", {{0, 0, 0}, {1000, 1000, 1000}, 0});
+  writeConf(receptors[1] + "_conf", {{3, 0, 0}, {1000, 1000, 1000}, 0});
+  writeConf(receptors[2] + "_conf", {{0.3, 0, 0}, {1000, 1000, 1000}, 0});
+  EXPECT_NEAR(pocketRMSD(readPocket(receptors[0]), readPocket(receptors[1])),
+              0.0, 1e-3);
+  // The same pocket found a bit off is merged, the other one is kept
+  ReceptorEnsemble ensemble = clusterReceptors(receptors, 0.5);
+  ASSERT_EQ(ensemble.representatives.size(), 2);
+  EXPECT_EQ(ensemble.cluster, std::vector<unsigned int>({0, 1, 0}));
+  runCommand("rm -rf " + dir);
+}
+
+/**** Seed tests ****/
+#include "Seed/Seed.h"
+
+TEST(Seed, Derive) {
+  // Same seed and key, same result, on every rank and in every run
+  EXPECT_EQ(deriveSeed(7, "AAK"), deriveSeed(7, "AAK"));
+  EXPECT_NE(deriveSeed(7, "AAK"), deriveSeed(7, "AAG"));
+  EXPECT_NE(deriveSeed(7, "AAK"), deriveSeed(8, "AAK"));
+  for (unsigned int seed = 0; seed < 100; seed++) {
+    unsigned int derived = deriveSeed(seed, "generation 0");
+    EXPECT_GE(derived, 1u);
+    EXPECT_LE(derived, 2147483647u);
+  }
+  EXPECT_EQ(campaignSeed(42), 42);
+  EXPECT_NE(campaignSeed(0), 0);
+}
 
 int main(int argc, char ** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -10,11 +10,16 @@
 #define SRC_LIB_GENALGINST_H_
 #include "Genome.h"
 #include "FitnessFunction.h"
+#include "NSGA2.h"
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <numeric>
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <unordered_set>
+#include <functional>
 template <typename GenoType, typename Genome, typename FitnessFunction>
 class GenAlgInst {
  public:
@@ -131,45 +136,244 @@ class GenAlgInst {
         }
       }
       if (entropy) {
-          std::ofstream outfile;
-
-          outfile.open(entropyFile, std::ios::out | std::ios::app);
-          outfile.close();
-          outfile.open(entropyFile, std::ios_base::app);
-          outfile << calculateEntropy(newGen) << "\t"
-                  << fitnesses[sortedindices[0]] << std::endl;
+        // Keep the file open between generations, only reopen if the
+        // name changes
+        if (!entropyOut.is_open() || entropyOutName != entropyFile) {
+          if (entropyOut.is_open()) {entropyOut.close();}
+          entropyOutName = entropyFile;
+          entropyOut.open(entropyFile, std::ios::out | std::ios::app);
+        }
+        entropyOut << calculateEntropy(newGen) << "\t"
+                   << fitnesses[sortedindices[0]] << "\n";
+        entropyOut.flush();
       }
 
       // std::move?
       return newGen;
     }
 
+    /* nextGenNovel(..., size, isKnown, maxTries):
+     *
+     * Like nextGen, but copies the top individuals unchanged and then
+     * resamples crossover and mutation until the generation has size
+     * individuals, all offspring being distinct from each other, from the
+     * copied ones and from every genotype for which isKnown(genotype) is
+     * true (e.g. already evaluated ones).
+     *
+     * Requires std::hash on GenoType. Gives up after maxTries draws per
+     * missing offspring, returning a smaller generation.
+    */
+    template <typename Known>
+    std::vector<GenoType> nextGenNovel(Genome genome,
+                                       FitnessFunction fitnessfunc,
+                                       std::vector<GenoType> genotypes,
+                                       float mutateProb,
+                                       float copy,
+                                       unsigned int size,
+                                       Known isKnown,
+                                       unsigned int maxTries = 100) {
+      std::vector<float> fitnesses;
+      std::unordered_set<GenoType> seen;
+      std::vector<GenoType> newGen = selectTop(fitnessfunc, genotypes, copy,
+                                               size, fitnesses, seen);
+      std::vector<GenoType> offspring = breedNovel(genome, genotypes,
+                                                   proportional(fitnesses),
+                                                   mutateProb,
+                                                   size - newGen.size(),
+                                                   isKnown, seen, maxTries);
+      newGen.insert(newGen.end(), offspring.begin(), offspring.end());
+      return newGen;
+    }
+
+    /* nextGenScreened(..., size, isKnown, score, oversample, maxTries):
+     *
+     * Like nextGenNovel, but breeds oversample times as many novel offspring
+     * as required and only keeps the ones with the highest score(genotype),
+     * e.g. a cheap estimate of their fitness
+    */
+    template <typename Known, typename Score>
+    std::vector<GenoType> nextGenScreened(Genome genome,
+                                          FitnessFunction fitnessfunc,
+                                          std::vector<GenoType> genotypes,
+                                          float mutateProb,
+                                          float copy,
+                                          unsigned int size,
+                                          Known isKnown,
+                                          Score score,
+                                          float oversample,
+                                          unsigned int maxTries = 100) {
+      std::vector<float> fitnesses;
+      std::unordered_set<GenoType> seen;
+      std::vector<GenoType> newGen = selectTop(fitnessfunc, genotypes, copy,
+                                               size, fitnesses, seen);
+      unsigned int needed = size - newGen.size();
+      unsigned int candidates = static_cast<unsigned int>(needed * oversample);
+      candidates = (candidates < needed) ? needed : candidates;
+      std::vector<GenoType> offspring = breedNovel(genome, genotypes,
+                                                   proportional(fitnesses),
+                                                   mutateProb, candidates,
+                                                   isKnown, seen, maxTries);
+      std::vector<float> scores;
+      for (unsigned int i = 0; i < offspring.size(); i++) {
+        scores.push_back(score(offspring.at(i)));
+      }
+      std::vector<size_t> sortedindices(offspring.size());
+      std::iota(sortedindices.begin(), sortedindices.end(), 0);
+      sort(sortedindices.begin(), sortedindices.end(),
+          [&scores](size_t i1, size_t i2) {
+            return scores[i1] > scores[i2];});
+      for (unsigned int i = 0; i < needed && i < offspring.size(); i++) {
+        newGen.push_back(offspring[sortedindices[i]]);
+      }
+      return newGen;
+    }
+
+    /* nextGenMO(genome, fitnessfunc, genotypes, mutateProb, copy, size,
+     *           isKnown, maxTries):
+     *
+     * Multi-objective variant of nextGenNovel using NSGA-II: individuals are
+     * ranked by non-dominated sorting of
+     * fitnessfunc.calculateObjectives(genotype) (all maximized), ties
+     * broken by crowding distance. The best copy percent are copied, parents
+     * are chosen by binary tournament on that ranking.
+    */
+    template <typename Known>
+    std::vector<GenoType> nextGenMO(Genome genome,
+                                    FitnessFunction fitnessfunc,
+                                    std::vector<GenoType> genotypes,
+                                    float mutateProb,
+                                    float copy,
+                                    unsigned int size,
+                                    Known isKnown,
+                                    unsigned int maxTries = 100) {
+      std::vector<std::vector<float>> objectives;
+      for (unsigned int i = 0; i < genotypes.size(); i++) {
+        objectives.push_back(fitnessfunc.calculateObjectives(genotypes.at(i)));
+      }
+      std::vector<unsigned int> rank;
+      std::vector<float> crowding;
+      NSGA2::rankAndCrowding(objectives, rank, crowding);
+      // SELECTION
+      std::vector<size_t> sortedindices(genotypes.size());
+      std::iota(sortedindices.begin(), sortedindices.end(), 0);
+      sort(sortedindices.begin(), sortedindices.end(),
+          [&rank, &crowding](size_t i1, size_t i2) {
+            return NSGA2::crowdedLess(i1, i2, rank, crowding);});
+      std::vector<GenoType> newGen;
+      std::unordered_set<GenoType> seen;
+      unsigned int amount = static_cast<int>((copy * genotypes.size()));
+      for (unsigned int i = 0; i < amount && newGen.size() < size; i++) {
+        if (seen.insert(genotypes[sortedindices[i]]).second) {
+          newGen.push_back(genotypes[sortedindices[i]]);
+        }
+      }
+      // RECOMBINATION & MUTATION, binary tournament selection of parents
+      std::uniform_int_distribution<size_t> uniform(0, genotypes.size() - 1);
+      std::mt19937 * engine = mt;
+      auto tournament = [&]() {
+        size_t a = uniform(*engine);
+        size_t b = uniform(*engine);
+        return NSGA2::crowdedLess(b, a, rank, crowding) ? b : a;
+      };
+      std::vector<GenoType> offspring = breedNovel(genome, genotypes,
+                                                   tournament, mutateProb,
+                                                   size - newGen.size(),
+                                                   isKnown, seen, maxTries);
+      newGen.insert(newGen.end(), offspring.begin(), offspring.end());
+      return newGen;
+    }
+
  private:
     std::mt19937 * mt;
+    std::ofstream entropyOut;
+    std::string entropyOutName;
 
     /* calculateEntropy(vector of genotypes):
      *
      * Returns number of different individuals in generation,
-     * requires a "==" relation on GenoType
+     * requires std::hash and a "==" relation on GenoType
+    */
+    int calculateEntropy(const std::vector<GenoType> & genotypes) {
+      std::unordered_set<GenoType> unique(genotypes.begin(), genotypes.end());
+      return unique.size();
+    }
+
+    /* proportional(fitnesses):
+     *
+     * Returns a parent picker drawing index i with probability
+     * fitness_i / sum(fitnesses)
+    */
+    std::function<size_t()> proportional(std::vector<float> & fitnesses) {
+      std::discrete_distribution<int> fitnessdistribution(fitnesses.begin(),
+                                                          fitnesses.end());
+      std::mt19937 * engine = mt;
+      return [fitnessdistribution, engine]() mutable {
+        return static_cast<size_t>(fitnessdistribution(*engine));
+      };
+    }
+
+    /* selectTop(fitnessfunc, genotypes, copy, size, fitnesses, seen):
+     *
+     * Calculates fitnesses and returns the distinct top copy percent of
+     * genotypes (at most size), adding them to seen
     */
-    int calculateEntropy(std::vector<GenoType> genotypes) {
-      unsigned int entropy = 0;
-      // O(n log n) could be possible with sort and unique, but then
-      // would have to require '<' relation on GenoType
-      // Naive O(n^2) Worst Case implementation
+    std::vector<GenoType> selectTop(FitnessFunction & fitnessfunc,
+                                    std::vector<GenoType> & genotypes,
+                                    float copy,
+                                    unsigned int size,
+                                    std::vector<float> & fitnesses,
+                                    std::unordered_set<GenoType> & seen) {
+      std::vector<GenoType> top;
       for (unsigned int i = 0; i < genotypes.size(); i++) {
-        bool unique = true;
-        for (unsigned int j = i + 1; j < genotypes.size(); j++) {
-          if (genotypes[i] == genotypes[j]) {
-            unique = false;
-            break;
-          }
+        fitnesses.push_back(fitnessfunc.calculateFitness(genotypes.at(i)));
+      }
+      std::vector<size_t> sortedindices(fitnesses.size());
+      std::iota(sortedindices.begin(), sortedindices.end(), 0);
+      sort(sortedindices.begin(), sortedindices.end(),
+          [&fitnesses](size_t i1, size_t i2) {
+            return fitnesses[i1] > fitnesses[i2];});
+      unsigned int amount = static_cast<int>((copy * genotypes.size()));
+      for (unsigned int i = 0; i < amount && top.size() < size; i++) {
+        if (seen.insert(genotypes[sortedindices[i]]).second) {
+          top.push_back(genotypes[sortedindices[i]]);
         }
-        if (unique) {
-          entropy++;
+      }
+      return top;
+    }
+
+    /* breedNovel(genome, genotypes, pickParent, mutateProb, n, isKnown,
+     *            seen, maxTries):
+     *
+     * Recombines two parents, each an index returned by pickParent(), and
+     * mutates the child with probability mutateProb until n offspring not in
+     * seen and not known have been found, or maxTries * n draws are
+     * exhausted
+    */
+    template <typename Picker, typename Known>
+    std::vector<GenoType> breedNovel(Genome & genome,
+                                     std::vector<GenoType> & genotypes,
+                                     Picker pickParent,
+                                     float mutateProb,
+                                     unsigned int n,
+                                     Known & isKnown,
+                                     std::unordered_set<GenoType> & seen,
+                                     unsigned int maxTries) {
+      std::vector<GenoType> offspring;
+      std::uniform_real_distribution<float> uniformdistribution(0.0, 1.0);
+      unsigned int tries = 0;
+      while (offspring.size() < n && tries < maxTries * n) {
+        tries++;
+        GenoType inda = genotypes[pickParent()];
+        GenoType indb = genotypes[pickParent()];
+        GenoType child = genome.crossOver(inda, indb);
+        if (uniformdistribution(*mt) <= mutateProb) {
+          child = genome.mutate(child);
         }
+        if (isKnown(child) || seen.count(child) != 0) {continue;}
+        seen.insert(child);
+        offspring.push_back(child);
       }
-      return entropy;
+      return offspring;
     }
 };
 
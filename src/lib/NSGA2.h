@@ -0,0 +1,141 @@
+/* Copyright 2019 iGEM Team Freiburg 2019
+ *
+ * Building blocks of NSGA-II (Deb et al., 2002) for multi-objective
+ * selection in GA. Every individual has a vector of objectives, all of which
+ * are maximized; NaN counts as the worst possible value.
+*/
+#ifndef SRC_LIB_NSGA2_H_
+#define SRC_LIB_NSGA2_H_
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+namespace NSGA2 {
+/* dominates(a, b):
+ *
+ * Returns true if a is at least as good as b in every objective and better
+ * in at least one
+*/
+inline bool dominates(const std::vector<float> & a,
+                      const std::vector<float> & b) {
+  bool better = false;
+  for (size_t k = 0; k < a.size() && k < b.size(); k++) {
+    float x = std::isnan(a[k]) ? - std::numeric_limits<float>::infinity()
+                               : a[k];
+    float y = std::isnan(b[k]) ? - std::numeric_limits<float>::infinity()
+                               : b[k];
+    if (x < y) {return false;}
+    if (x > y) {better = true;}
+  }
+  return better;
+}
+
+/* nonDominatedSort(objectives):
+ *
+ * Fast non-dominated sorting, returns the fronts as vectors of indices,
+ * first front being the Pareto front
+*/
+inline std::vector<std::vector<size_t>> nonDominatedSort(
+                            const std::vector<std::vector<float>> & objs) {
+  size_t n = objs.size();
+  std::vector<std::vector<size_t>> dominated(n);
+  std::vector<unsigned int> dominationCount(n, 0);
+  std::vector<std::vector<size_t>> fronts(1);
+  for (size_t p = 0; p < n; p++) {
+    for (size_t q = 0; q < n; q++) {
+      if (p == q) {continue;}
+      if (dominates(objs[p], objs[q])) {
+        dominated[p].push_back(q);
+      } else if (dominates(objs[q], objs[p])) {
+        dominationCount[p]++;
+      }
+    }
+    if (dominationCount[p] == 0) {
+      fronts[0].push_back(p);
+    }
+  }
+  size_t i = 0;
+  while (!fronts[i].empty()) {
+    std::vector<size_t> next;
+    for (auto p : fronts[i]) {
+      for (auto q : dominated[p]) {
+        if (--dominationCount[q] == 0) {
+          next.push_back(q);
+        }
+      }
+    }
+    fronts.push_back(next);
+    i++;
+  }
+  fronts.pop_back();  // Last one is empty
+  return fronts;
+}
+
+/* crowdingDistance(objectives, front):
+ *
+ * Returns crowding distance of each member of front (same order), boundary
+ * individuals get infinity
+*/
+inline std::vector<float> crowdingDistance(
+                            const std::vector<std::vector<float>> & objs,
+                            const std::vector<size_t> & front) {
+  std::vector<float> distance(front.size(), 0.0f);
+  if (front.empty()) {return distance;}
+  size_t m = objs[front[0]].size();
+  std::vector<size_t> order(front.size());
+  for (size_t k = 0; k < m; k++) {
+    std::iota(order.begin(), order.end(), 0);
+    auto value = [&](size_t i) {
+      float v = objs[front[i]][k];
+      return std::isnan(v) ? - std::numeric_limits<float>::infinity() : v;
+    };
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return value(a) < value(b); });
+    float range = value(order.back()) - value(order.front());
+    distance[order.front()] = std::numeric_limits<float>::infinity();
+    distance[order.back()] = std::numeric_limits<float>::infinity();
+    if (!(range > 0.0f) || std::isinf(range)) {continue;}
+    for (size_t i = 1; i + 1 < order.size(); i++) {
+      distance[order[i]] += (value(order[i + 1]) - value(order[i - 1]))
+                            / range;
+    }
+  }
+  return distance;
+}
+
+/* rankAndCrowding(objectives, rank, crowding):
+ *
+ * Fills front index (0 = Pareto front) and crowding distance of every
+ * individual
+*/
+inline void rankAndCrowding(const std::vector<std::vector<float>> & objs,
+                            std::vector<unsigned int> & rank,
+                            std::vector<float> & crowding) {
+  rank.assign(objs.size(), 0);
+  crowding.assign(objs.size(), 0.0f);
+  std::vector<std::vector<size_t>> fronts = nonDominatedSort(objs);
+  for (size_t f = 0; f < fronts.size(); f++) {
+    std::vector<float> d = crowdingDistance(objs, fronts[f]);
+    for (size_t i = 0; i < fronts[f].size(); i++) {
+      rank[fronts[f][i]] = f;
+      crowding[fronts[f][i]] = d[i];
+    }
+  }
+}
+
+/* crowdedLess(i, j, rank, crowding):
+ *
+ * Crowded-comparison operator: true if i is better than j, i.e. lower rank
+ * or same rank and less crowded
+*/
+inline bool crowdedLess(size_t i, size_t j,
+                        const std::vector<unsigned int> & rank,
+                        const std::vector<float> & crowding) {
+  if (rank[i] != rank[j]) {return rank[i] < rank[j];}
+  return crowding[i] > crowding[j];
+}
+}  // namespace NSGA2
+
+#endif  // SRC_LIB_NSGA2_H_